@@ -0,0 +1,368 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * XOR forward error correction for RTP packets sent in QUIC DATAGRAMs. See
+ * gstroqfec.h for the format of the repair packets.
+ *
+ * The encoder folds each packet it is given into a running parity, so the
+ * sender only ever holds one packet's worth of data per block. The decoder
+ * keeps references to the last few packets received, and can rebuild a packet
+ * when it is the only one of a repair packet's block that is missing.
+ */
+
+#include "gstroqfec.h"
+
+#include <gstquiccommon.h>
+
+#include <string.h>
+
+#define GST_ROQ_FEC_HISTORY_MASK (GST_ROQ_FEC_HISTORY - 1)
+#define GST_ROQ_FEC_MIN_RTP_LEN 12
+
+void
+gst_roq_fec_encoder_init (GstRoQFecEncoder *enc)
+{
+  memset (enc, 0, sizeof (GstRoQFecEncoder));
+  enc->parity = g_byte_array_new ();
+}
+
+void
+gst_roq_fec_encoder_clear (GstRoQFecEncoder *enc)
+{
+  if (enc->parity) {
+    g_byte_array_unref (enc->parity);
+    enc->parity = NULL;
+  }
+  enc->count = 0;
+}
+
+/*
+ * Returns TRUE if rtp can be added to the block being built. It can't if it's
+ * from a different source, goes backwards or lies beyond the reach of the
+ * mask, in which case the block should be finished first.
+ */
+gboolean
+gst_roq_fec_encoder_accepts (GstRoQFecEncoder *enc, GstBuffer *rtp)
+{
+  guint8 header[GST_ROQ_FEC_MIN_RTP_LEN];
+  guint16 offset;
+
+  if (enc->count == 0) {
+    return TRUE;
+  }
+
+  if (gst_buffer_extract (rtp, 0, header, GST_ROQ_FEC_MIN_RTP_LEN) <
+      GST_ROQ_FEC_MIN_RTP_LEN) {
+    return TRUE;
+  }
+
+  offset = GST_READ_UINT16_BE (header + 2) - enc->base_seq;
+
+  return GST_READ_UINT32_BE (header + 8) == enc->ssrc &&
+      (header[1] & 0x7f) == enc->pt && offset < GST_ROQ_FEC_MAX_BLOCK &&
+      offset > (guint16) (enc->last_seq - enc->base_seq);
+}
+
+/*
+ * Fold rtp into the block's parity. Anything too short to be an RTP packet is
+ * left unprotected.
+ */
+void
+gst_roq_fec_encoder_add (GstRoQFecEncoder *enc, GstBuffer *rtp)
+{
+  GstMapInfo map;
+  guint16 seq;
+  gsize i;
+
+  if (!gst_buffer_map (rtp, &map, GST_MAP_READ)) {
+    return;
+  }
+
+  if (map.size < GST_ROQ_FEC_MIN_RTP_LEN || map.size > G_MAXUINT16) {
+    gst_buffer_unmap (rtp, &map);
+    return;
+  }
+
+  seq = GST_READ_UINT16_BE (map.data + 2);
+
+  if (enc->count == 0) {
+    enc->ssrc = GST_READ_UINT32_BE (map.data + 8);
+    enc->pt = map.data[1] & 0x7f;
+    enc->base_seq = seq;
+    enc->mask = 0;
+    enc->length_xor = 0;
+    g_byte_array_set_size (enc->parity, 0);
+  }
+
+  if (enc->parity->len < map.size) {
+    guint old_len = enc->parity->len;
+
+    g_byte_array_set_size (enc->parity, map.size);
+    memset (enc->parity->data + old_len, 0, map.size - old_len);
+  }
+
+  for (i = 0; i < map.size; i++) {
+    enc->parity->data[i] ^= map.data[i];
+  }
+
+  enc->length_xor ^= (guint16) map.size;
+  enc->mask |= 1u << (31 - (guint16) (seq - enc->base_seq));
+  enc->last_seq = seq;
+  enc->count++;
+
+  gst_buffer_unmap (rtp, &map);
+}
+
+/*
+ * Returns the repair packet for the block so far, for protecting packets sent
+ * on flow_id, and starts a new block. Returns NULL if the block is empty.
+ */
+GstBuffer *
+gst_roq_fec_encoder_finish (GstRoQFecEncoder *enc, guint64 flow_id)
+{
+  GstBuffer *repair;
+  GstMapInfo map;
+  gsize off;
+
+  if (enc->count == 0) {
+    return NULL;
+  }
+
+  off = gst_quiclib_set_varint (flow_id, NULL);
+
+  repair = gst_buffer_new_allocate (NULL,
+      off + GST_ROQ_FEC_HEADER_LEN + enc->parity->len, NULL);
+
+  gst_buffer_map (repair, &map, GST_MAP_WRITE);
+
+  gst_quiclib_set_varint (flow_id, map.data);
+  GST_WRITE_UINT32_BE (map.data + off, enc->ssrc);
+  map.data[off + 4] = enc->pt;
+  GST_WRITE_UINT16_BE (map.data + off + 5, enc->base_seq);
+  GST_WRITE_UINT32_BE (map.data + off + 7, enc->mask);
+  GST_WRITE_UINT16_BE (map.data + off + 11, enc->length_xor);
+  memcpy (map.data + off + GST_ROQ_FEC_HEADER_LEN, enc->parity->data,
+      enc->parity->len);
+
+  gst_buffer_unmap (repair, &map);
+
+  enc->count = 0;
+
+  return repair;
+}
+
+void
+gst_roq_fec_decoder_init (GstRoQFecDecoder *dec)
+{
+  memset (dec, 0, sizeof (GstRoQFecDecoder));
+}
+
+void
+gst_roq_fec_decoder_clear (GstRoQFecDecoder *dec)
+{
+  guint i;
+
+  for (i = 0; i < GST_ROQ_FEC_HISTORY; i++) {
+    if (dec->history[i].buf) {
+      gst_buffer_unref (dec->history[i].buf);
+      dec->history[i].buf = NULL;
+    }
+  }
+}
+
+/*
+ * Keep a reference to a received RTP packet in case a later repair packet
+ * needs it, in place of whichever packet was GST_ROQ_FEC_HISTORY before it.
+ */
+void
+gst_roq_fec_decoder_store (GstRoQFecDecoder *dec, GstBuffer *rtp)
+{
+  GstRoQFecHistoryEntry *entry;
+  guint8 header[4];
+  guint16 seq;
+
+  if (gst_buffer_extract (rtp, 0, header, 4) < 4) {
+    return;
+  }
+
+  seq = GST_READ_UINT16_BE (header + 2);
+  entry = &dec->history[seq & GST_ROQ_FEC_HISTORY_MASK];
+
+  if (entry->buf) {
+    gst_buffer_unref (entry->buf);
+  }
+
+  entry->seq = seq;
+  entry->buf = gst_buffer_ref (rtp);
+}
+
+/*
+ * Read the flow ID, SSRC and payload type of the packets that a repair packet
+ * protects. The repair packet starts after its own RoQ flow identifier.
+ */
+gboolean
+gst_roq_fec_parse_header (GstBuffer *repair, guint64 *flow_id, guint32 *ssrc,
+    guint8 *pt)
+{
+  GstMapInfo map;
+  gsize off;
+  gboolean rv = FALSE;
+
+  if (!gst_buffer_map (repair, &map, GST_MAP_READ)) {
+    return FALSE;
+  }
+
+  if (map.size > 0) {
+    off = gst_quiclib_get_varint (map.data, flow_id);
+
+    if (map.size >= off + GST_ROQ_FEC_HEADER_LEN + GST_ROQ_FEC_MIN_RTP_LEN) {
+      *ssrc = GST_READ_UINT32_BE (map.data + off);
+      *pt = map.data[off + 4] & 0x7f;
+      rv = TRUE;
+    }
+  }
+
+  gst_buffer_unmap (repair, &map);
+
+  return rv;
+}
+
+/*
+ * Rebuild the packet missing from a repair packet's block. Returns NULL if
+ * nothing is missing, or more than one packet is, as then there is nothing
+ * that can be done.
+ */
+GstBuffer *
+gst_roq_fec_decoder_recover (GstRoQFecDecoder *dec, GstBuffer *repair)
+{
+  GstMapInfo map, out_map;
+  GstBuffer *out = NULL;
+  const guint8 *parity;
+  gsize off, parity_len, length;
+  guint64 flow_id;
+  guint16 base_seq;
+  guint32 mask;
+  gint missing = -1;
+  guint n;
+
+  if (!gst_buffer_map (repair, &map, GST_MAP_READ)) {
+    return NULL;
+  }
+
+  off = gst_quiclib_get_varint (map.data, &flow_id);
+  if (map.size < off + GST_ROQ_FEC_HEADER_LEN + GST_ROQ_FEC_MIN_RTP_LEN) {
+    goto done;
+  }
+
+  base_seq = GST_READ_UINT16_BE (map.data + off + 5);
+  mask = GST_READ_UINT32_BE (map.data + off + 7);
+  length = GST_READ_UINT16_BE (map.data + off + 11);
+  parity = map.data + off + GST_ROQ_FEC_HEADER_LEN;
+  parity_len = map.size - off - GST_ROQ_FEC_HEADER_LEN;
+
+  for (n = 0; n < GST_ROQ_FEC_MAX_BLOCK; n++) {
+    guint16 seq = base_seq + n;
+    GstRoQFecHistoryEntry *entry =
+        &dec->history[seq & GST_ROQ_FEC_HISTORY_MASK];
+
+    if (!(mask & (1u << (31 - n)))) {
+      continue;
+    }
+
+    if (entry->buf != NULL && entry->seq == seq) {
+      continue;
+    }
+
+    if (missing != -1) {
+      goto done;
+    }
+
+    missing = n;
+  }
+
+  if (missing == -1) {
+    goto done;
+  }
+
+  out = gst_buffer_new_allocate (NULL, parity_len, NULL);
+  gst_buffer_map (out, &out_map, GST_MAP_WRITE);
+  memcpy (out_map.data, parity, parity_len);
+
+  for (n = 0; n < GST_ROQ_FEC_MAX_BLOCK; n++) {
+    guint16 seq = base_seq + n;
+    GstRoQFecHistoryEntry *entry =
+        &dec->history[seq & GST_ROQ_FEC_HISTORY_MASK];
+    GstMapInfo in_map;
+    gsize i;
+
+    if (!(mask & (1u << (31 - n))) || n == (guint) missing) {
+      continue;
+    }
+
+    gst_buffer_map (entry->buf, &in_map, GST_MAP_READ);
+    for (i = 0; i < MIN (in_map.size, parity_len); i++) {
+      out_map.data[i] ^= in_map.data[i];
+    }
+    length ^= in_map.size & G_MAXUINT16;
+    gst_buffer_unmap (entry->buf, &in_map);
+  }
+
+  /* Make sure it really is the packet that went missing */
+  if (length < GST_ROQ_FEC_MIN_RTP_LEN || length > parity_len ||
+      GST_READ_UINT16_BE (out_map.data + 2) != (guint16) (base_seq + missing)) {
+    gst_buffer_unmap (out, &out_map);
+    gst_buffer_unref (out);
+    out = NULL;
+    goto done;
+  }
+
+  gst_buffer_unmap (out, &out_map);
+  gst_buffer_resize (out, 0, length);
+
+done:
+  gst_buffer_unmap (repair, &map);
+
+  return out;
+}
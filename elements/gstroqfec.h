@@ -0,0 +1,145 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_ROQFEC_H__
+#define __GST_ROQFEC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * A simple XOR parity code across the RTP packets that rtpquicmux sends in
+ * QUIC DATAGRAMs, which lets rtpquicdemux rebuild any one packet of a block
+ * that was lost. Each repair packet is sent as a datagram on a flow ID of its
+ * own, and after the RoQ flow identifier carries:
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |             Protected RTP flow ID (i)                       ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                             SSRC                              |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |0|     PT      |       Base sequence number    |  Mask ...     |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |   ... Mask                    |        Length recovery        |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |         XOR of the protected RTP packets, header included   ...
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * Bit n of the mask is set if the packet with sequence number base + n is
+ * protected, most significant bit first. The length recovery field is the XOR
+ * of the lengths of the protected packets, and shorter packets are padded
+ * with zeroes for the XOR.
+ */
+#define GST_ROQ_FEC_MAX_BLOCK 32
+#define GST_ROQ_FEC_HEADER_LEN 13
+
+/* Received packets kept for recovery, a power of two above the block size */
+#define GST_ROQ_FEC_HISTORY 128
+
+/*
+ * The repair packet being built up for one RTP sink pad. Owned by the
+ * streaming thread of that pad.
+ */
+struct _GstRoQFecEncoder
+{
+  guint32 ssrc;
+  guint8 pt;
+  guint16 base_seq;
+  guint16 last_seq;
+  guint32 mask;
+  guint count;
+  guint16 length_xor;
+  GByteArray *parity;
+};
+
+typedef struct _GstRoQFecEncoder GstRoQFecEncoder;
+
+struct _GstRoQFecHistoryEntry
+{
+  guint16 seq;
+  GstBuffer *buf;
+};
+
+typedef struct _GstRoQFecHistoryEntry GstRoQFecHistoryEntry;
+
+/*
+ * The most recent RTP packets received for one SSRC and payload type, indexed
+ * by sequence number.
+ */
+struct _GstRoQFecDecoder
+{
+  GstRoQFecHistoryEntry history[GST_ROQ_FEC_HISTORY];
+};
+
+typedef struct _GstRoQFecDecoder GstRoQFecDecoder;
+
+void gst_roq_fec_encoder_init (GstRoQFecEncoder *enc);
+
+void gst_roq_fec_encoder_clear (GstRoQFecEncoder *enc);
+
+gboolean gst_roq_fec_encoder_accepts (GstRoQFecEncoder *enc, GstBuffer *rtp);
+
+void gst_roq_fec_encoder_add (GstRoQFecEncoder *enc, GstBuffer *rtp);
+
+GstBuffer *gst_roq_fec_encoder_finish (GstRoQFecEncoder *enc,
+    guint64 flow_id);
+
+void gst_roq_fec_decoder_init (GstRoQFecDecoder *dec);
+
+void gst_roq_fec_decoder_clear (GstRoQFecDecoder *dec);
+
+void gst_roq_fec_decoder_store (GstRoQFecDecoder *dec, GstBuffer *rtp);
+
+gboolean gst_roq_fec_parse_header (GstBuffer *repair, guint64 *flow_id,
+    guint32 *ssrc, guint8 *pt);
+
+GstBuffer *gst_roq_fec_decoder_recover (GstRoQFecDecoder *dec,
+    GstBuffer *repair);
+
+G_END_DECLS
+
+#endif /* __GST_ROQFEC_H__ */
@@ -0,0 +1,262 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A small allocator for the RoQ headers that rtpquicmux prepends to RTP and
+ * RTCP packets when upstream hasn't left any headroom for them.
+ *
+ * Every memory is backed by a fixed size chunk. When a memory is freed, its
+ * chunk goes back onto a lock-free queue instead of back to the system
+ * allocator, so in the steady state every header allocation is satisfied from
+ * chunks that have already been used. Requests larger than a chunk are passed
+ * on to the default allocator.
+ */
+
+#include "gstroqheaderallocator.h"
+
+GST_DEBUG_CATEGORY_STATIC (roqheaderallocator);
+#define GST_CAT_DEFAULT roqheaderallocator
+
+typedef struct _GstRoQHeaderMemory
+{
+  GstMemory mem;
+
+  /* Points at storage, or at the storage of the parent for shared memories */
+  guint8 *data;
+  guint8 storage[GST_ROQ_HEADER_ALLOCATOR_CHUNK_SIZE];
+} GstRoQHeaderMemory;
+
+#define gst_roq_header_allocator_parent_class parent_class
+G_DEFINE_TYPE (GstRoQHeaderAllocator, gst_roq_header_allocator,
+    GST_TYPE_ALLOCATOR);
+
+static GstMemory *gst_roq_header_allocator_alloc (GstAllocator *allocator,
+    gsize size, GstAllocationParams *params);
+static void gst_roq_header_allocator_free (GstAllocator *allocator,
+    GstMemory *mem);
+static void gst_roq_header_allocator_finalize (GObject *object);
+
+static gpointer gst_roq_header_mem_map (GstMemory *mem, gsize maxsize,
+    GstMapFlags flags);
+static void gst_roq_header_mem_unmap (GstMemory *mem);
+static GstMemory *gst_roq_header_mem_share (GstMemory *mem, gssize offset,
+    gssize size);
+
+static void
+gst_roq_header_allocator_class_init (GstRoQHeaderAllocatorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  object_class->finalize = gst_roq_header_allocator_finalize;
+
+  allocator_class->alloc = gst_roq_header_allocator_alloc;
+  allocator_class->free = gst_roq_header_allocator_free;
+
+  GST_DEBUG_CATEGORY_INIT (roqheaderallocator, "roqheaderallocator", 0,
+      "Recycling allocator for RoQ header memories");
+}
+
+static void
+gst_roq_header_allocator_init (GstRoQHeaderAllocator *allocator)
+{
+  GstAllocator *alloc = GST_ALLOCATOR_CAST (allocator);
+
+  alloc->mem_type = GST_ROQ_HEADER_ALLOCATOR_MEMORY_TYPE;
+  alloc->mem_map = gst_roq_header_mem_map;
+  alloc->mem_unmap = gst_roq_header_mem_unmap;
+  alloc->mem_share = gst_roq_header_mem_share;
+
+  allocator->free_chunks = gst_atomic_queue_new (64);
+  allocator->max_free_chunks = 1024;
+  allocator->hits = 0;
+  allocator->misses = 0;
+}
+
+static void
+gst_roq_header_allocator_finalize (GObject *object)
+{
+  GstRoQHeaderAllocator *allocator = GST_ROQ_HEADER_ALLOCATOR (object);
+  GstRoQHeaderMemory *chunk;
+
+  while ((chunk = gst_atomic_queue_pop (allocator->free_chunks)) != NULL) {
+    g_slice_free (GstRoQHeaderMemory, chunk);
+  }
+
+  gst_atomic_queue_unref (allocator->free_chunks);
+
+  GST_DEBUG_OBJECT (allocator, "Finalised with %lu hits and %lu misses",
+      allocator->hits, allocator->misses);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static GstRoQHeaderMemory *
+gst_roq_header_allocator_get_chunk (GstRoQHeaderAllocator *allocator,
+    gboolean *hit)
+{
+  GstRoQHeaderMemory *chunk = gst_atomic_queue_pop (allocator->free_chunks);
+
+  *hit = (chunk != NULL);
+
+  if (chunk == NULL) {
+    chunk = g_slice_new (GstRoQHeaderMemory);
+  }
+
+  return chunk;
+}
+
+static GstMemory *
+gst_roq_header_allocator_alloc (GstAllocator *alloc, gsize size,
+    GstAllocationParams *params)
+{
+  GstRoQHeaderAllocator *allocator = GST_ROQ_HEADER_ALLOCATOR (alloc);
+  GstRoQHeaderMemory *chunk;
+  gboolean hit;
+
+  if (size > GST_ROQ_HEADER_ALLOCATOR_CHUNK_SIZE ||
+      (params != NULL && (params->prefix > 0 || params->padding > 0))) {
+    GST_LOG_OBJECT (allocator, "Request for %lu bytes doesn't fit in a chunk",
+        size);
+    g_atomic_pointer_add (&allocator->misses, 1);
+    return gst_allocator_alloc (NULL, size, params);
+  }
+
+  chunk = gst_roq_header_allocator_get_chunk (allocator, &hit);
+
+  if (hit) {
+    g_atomic_pointer_add (&allocator->hits, 1);
+  } else {
+    g_atomic_pointer_add (&allocator->misses, 1);
+  }
+
+  chunk->data = chunk->storage;
+
+  gst_memory_init (GST_MEMORY_CAST (chunk),
+      (params != NULL)?(params->flags):(0), alloc, NULL,
+      GST_ROQ_HEADER_ALLOCATOR_CHUNK_SIZE, 0, 0, size);
+
+  return GST_MEMORY_CAST (chunk);
+}
+
+static void
+gst_roq_header_allocator_free (GstAllocator *alloc, GstMemory *mem)
+{
+  GstRoQHeaderAllocator *allocator = GST_ROQ_HEADER_ALLOCATOR (alloc);
+
+  if ((guint) gst_atomic_queue_length (allocator->free_chunks) <
+      allocator->max_free_chunks) {
+    gst_atomic_queue_push (allocator->free_chunks, mem);
+  } else {
+    g_slice_free (GstRoQHeaderMemory, (GstRoQHeaderMemory *) mem);
+  }
+}
+
+static gpointer
+gst_roq_header_mem_map (GstMemory *mem, gsize maxsize, GstMapFlags flags)
+{
+  return ((GstRoQHeaderMemory *) mem)->data;
+}
+
+static void
+gst_roq_header_mem_unmap (GstMemory *mem)
+{
+}
+
+static GstMemory *
+gst_roq_header_mem_share (GstMemory *mem, gssize offset, gssize size)
+{
+  GstRoQHeaderAllocator *allocator = GST_ROQ_HEADER_ALLOCATOR (mem->allocator);
+  GstRoQHeaderMemory *sub;
+  GstMemory *parent;
+  gboolean hit;
+
+  if (size == -1) {
+    size = mem->size - offset;
+  }
+
+  if ((parent = mem->parent) == NULL) {
+    parent = mem;
+  }
+
+  /* Shared memories reuse a chunk for the wrapper, but map the parent's data */
+  sub = gst_roq_header_allocator_get_chunk (allocator, &hit);
+  sub->data = ((GstRoQHeaderMemory *) parent)->data;
+
+  gst_memory_init (GST_MEMORY_CAST (sub),
+      GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+      mem->allocator, parent, mem->maxsize, mem->align, mem->offset + offset,
+      size);
+
+  return GST_MEMORY_CAST (sub);
+}
+
+/**
+ * gst_roq_header_allocator_new:
+ * @max_free_chunks: The number of freed chunks to keep for reuse
+ *
+ * Returns: (transfer full): A new #GstRoQHeaderAllocator
+ */
+GstAllocator *
+gst_roq_header_allocator_new (guint max_free_chunks)
+{
+  GstRoQHeaderAllocator *allocator =
+      g_object_new (GST_TYPE_ROQ_HEADER_ALLOCATOR, NULL);
+
+  allocator->max_free_chunks = max_free_chunks;
+
+  return GST_ALLOCATOR_CAST (gst_object_ref_sink (allocator));
+}
+
+void
+gst_roq_header_allocator_get_stats (GstRoQHeaderAllocator *allocator,
+    guint64 *hits, guint64 *misses)
+{
+  if (hits) {
+    *hits = (gsize) g_atomic_pointer_get (&allocator->hits);
+  }
+  if (misses) {
+    *misses = (gsize) g_atomic_pointer_get (&allocator->misses);
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_ROQHEADERALLOCATOR_H__
+#define __GST_ROQHEADERALLOCATOR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Every memory handed out by this allocator is backed by a chunk of this size,
+ * which is large enough for the longest RoQ header (see
+ * RTP_QUIC_MUX_MAX_HEADER_LEN).
+ */
+#define GST_ROQ_HEADER_ALLOCATOR_CHUNK_SIZE 24
+
+#define GST_ROQ_HEADER_ALLOCATOR_MEMORY_TYPE "RoQHeaderMemory"
+
+#define GST_TYPE_ROQ_HEADER_ALLOCATOR (gst_roq_header_allocator_get_type())
+G_DECLARE_FINAL_TYPE (GstRoQHeaderAllocator, gst_roq_header_allocator, GST,
+    ROQ_HEADER_ALLOCATOR, GstAllocator)
+
+struct _GstRoQHeaderAllocator
+{
+  GstAllocator parent;
+
+  /* Chunks returned by freed memories, ready to be handed out again */
+  GstAtomicQueue *free_chunks;
+  guint max_free_chunks;
+
+  /*
+   * Bumped from every thread that allocates headers, so these are
+   * pointer-sized and only touched with the g_atomic_pointer_* functions.
+   */
+  gsize hits;
+  gsize misses;
+};
+
+GstAllocator *gst_roq_header_allocator_new (guint max_free_chunks);
+
+void gst_roq_header_allocator_get_stats (GstRoQHeaderAllocator *allocator,
+    guint64 *hits, guint64 *misses);
+
+G_END_DECLS
+
+#endif /* __GST_ROQHEADERALLOCATOR_H__ */
@@ -0,0 +1,557 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * A pacer for rtpquicmux, which spreads the packets of large frames out over
+ * time instead of handing them to quicmux in one burst.
+ *
+ * Streaming threads work out when each buffer should leave and hand it over
+ * with gst_roq_pacer_push(), which never blocks for longer than it takes to
+ * queue the buffer. A single pacing thread then pushes the buffers on their
+ * pads as their time comes round on a hashed timer wheel, so nothing sleeps
+ * in a streaming thread.
+ *
+ * Buffers are queued on flows, and each flow is in the wheel at most once, in
+ * the slot for the release time of the buffer at its head. That keeps the
+ * buffers of a flow in order even when their release times are equal, and
+ * means the wheel only ever holds as many entries as there are flows with
+ * something waiting.
+ *
+ * The result of pushing a buffer can't be returned to the streaming thread
+ * that paced it, so the first flow return other than GST_FLOW_OK is kept on
+ * the flow for the streaming thread to pick up with
+ * gst_roq_pacer_flow_take_return(). Once a pad has returned
+ * GST_FLOW_QUIC_STREAM_CLOSED, the rest of the buffers waiting for that pad
+ * are dropped.
+ */
+
+#include "gstroqpacer.h"
+
+#include <gstquiccommon.h>
+
+GST_DEBUG_CATEGORY_STATIC (roqpacer);
+#define GST_CAT_DEFAULT roqpacer
+
+#define GST_ROQ_PACER_WHEEL_MASK (GST_ROQ_PACER_WHEEL_SLOTS - 1)
+
+/*
+ * A buffer waiting to be pushed on pad. A NULL buffer stands for removing pad
+ * from its element once everything before it has been sent.
+ */
+typedef struct _GstRoQPacerEntry
+{
+  GstBuffer *buf;
+  GstPad *pad;
+  gint64 release;
+} GstRoQPacerEntry;
+
+struct _GstRoQPacerFlow
+{
+  /* GQueue of GstRoQPacerEntry */
+  GQueue entries;
+
+  gboolean scheduled;
+
+  /* Entries have been taken off the queue and are being pushed */
+  gboolean sending;
+
+  gint flow_return;
+};
+
+#define gst_roq_pacer_parent_class parent_class
+G_DEFINE_TYPE (GstRoQPacer, gst_roq_pacer, GST_TYPE_OBJECT);
+
+static void gst_roq_pacer_finalize (GObject *object);
+
+static void
+gst_roq_pacer_class_init (GstRoQPacerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gst_roq_pacer_finalize;
+
+  GST_DEBUG_CATEGORY_INIT (roqpacer, "roqpacer", 0,
+      "Timer wheel pacer for rtpquicmux");
+}
+
+static void
+gst_roq_pacer_init (GstRoQPacer *pacer)
+{
+  g_mutex_init (&pacer->lock);
+  g_cond_init (&pacer->wake_cond);
+  g_cond_init (&pacer->drain_cond);
+  pacer->thread = NULL;
+  pacer->running = FALSE;
+  pacer->tick = 0;
+  pacer->scheduled = 0;
+  pacer->flows = NULL;
+  pacer->buffers_paced = 0;
+}
+
+static void
+gst_roq_pacer_entry_free (GstRoQPacerEntry *entry)
+{
+  if (entry->buf) {
+    gst_buffer_unref (entry->buf);
+  }
+  gst_object_unref (entry->pad);
+  g_slice_free (GstRoQPacerEntry, entry);
+}
+
+static void
+gst_roq_pacer_flow_free_entries (GstRoQPacerFlow *flow)
+{
+  g_queue_clear_full (&flow->entries,
+      (GDestroyNotify) gst_roq_pacer_entry_free);
+  g_free (flow);
+}
+
+static void
+gst_roq_pacer_finalize (GObject *object)
+{
+  GstRoQPacer *pacer = GST_ROQ_PACER (object);
+
+  gst_roq_pacer_stop (pacer);
+
+  g_list_free_full (pacer->flows,
+      (GDestroyNotify) gst_roq_pacer_flow_free_entries);
+  pacer->flows = NULL;
+
+  g_mutex_clear (&pacer->lock);
+  g_cond_clear (&pacer->wake_cond);
+  g_cond_clear (&pacer->drain_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+GstRoQPacer *
+gst_roq_pacer_new (void)
+{
+  return GST_ROQ_PACER (g_object_new (GST_TYPE_ROQ_PACER, NULL));
+}
+
+GstRoQPacerFlow *
+gst_roq_pacer_flow_new (GstRoQPacer *pacer)
+{
+  GstRoQPacerFlow *flow = g_new0 (GstRoQPacerFlow, 1);
+
+  g_queue_init (&flow->entries);
+  flow->flow_return = GST_FLOW_OK;
+
+  g_mutex_lock (&pacer->lock);
+  pacer->flows = g_list_prepend (pacer->flows, flow);
+  g_mutex_unlock (&pacer->lock);
+
+  return flow;
+}
+
+/*
+ * Put a flow into the wheel at the release tick of the buffer at its head, or
+ * at the next tick to be run if that has already gone. Must be called with the
+ * lock held.
+ */
+static void
+gst_roq_pacer_schedule (GstRoQPacer *pacer, GstRoQPacerFlow *flow)
+{
+  GstRoQPacerEntry *head = g_queue_peek_head (&flow->entries);
+  gint64 tick;
+
+  if (flow->scheduled || flow->sending || head == NULL) {
+    return;
+  }
+
+  tick = MAX (head->release / GST_ROQ_PACER_TICK_US, pacer->tick);
+
+  pacer->wheel[tick & GST_ROQ_PACER_WHEEL_MASK] = g_list_prepend (
+      pacer->wheel[tick & GST_ROQ_PACER_WHEEL_MASK], flow);
+  flow->scheduled = TRUE;
+  pacer->scheduled++;
+}
+
+static void
+gst_roq_pacer_remove_pad (GstPad *pad)
+{
+  GstElement *parent = gst_pad_get_parent_element (pad);
+
+  if (parent) {
+    gst_pad_set_active (pad, FALSE);
+    gst_element_remove_pad (parent, pad);
+    gst_object_unref (parent);
+  }
+}
+
+/*
+ * Push the buffers that have been taken off a flow, in order. Called without
+ * the lock held.
+ */
+static void
+gst_roq_pacer_flow_send (GstRoQPacer *pacer, GstRoQPacerFlow *flow,
+    GQueue *due)
+{
+  GstRoQPacerEntry *entry;
+  GstPad *closed = NULL;
+  GstFlowReturn rv;
+
+  while ((entry = g_queue_pop_head (due)) != NULL) {
+    if (entry->buf == NULL) {
+      gst_roq_pacer_remove_pad (entry->pad);
+    } else if (entry->pad == closed) {
+      GST_LOG_OBJECT (pacer, "Dropping buffer %p for closed pad %"
+          GST_PTR_FORMAT, entry->buf, entry->pad);
+    } else {
+      rv = gst_pad_push (entry->pad, entry->buf);
+      entry->buf = NULL;
+
+      if (rv != GST_FLOW_OK) {
+        GST_DEBUG_OBJECT (pacer, "Pushing on pad %" GST_PTR_FORMAT
+            " returned %s", entry->pad, gst_flow_get_name (rv));
+
+        g_atomic_int_compare_and_exchange (&flow->flow_return, GST_FLOW_OK,
+            rv);
+
+        if (rv == GST_FLOW_QUIC_STREAM_CLOSED) {
+          closed = entry->pad;
+        }
+      }
+    }
+
+    gst_roq_pacer_entry_free (entry);
+  }
+}
+
+/*
+ * Run one tick of the wheel, pushing every buffer that is due by the end of
+ * it. Must be called with the lock held, which is released while pushing.
+ */
+static void
+gst_roq_pacer_run_tick (GstRoQPacer *pacer, gint64 tick)
+{
+  GList *flows = pacer->wheel[tick & GST_ROQ_PACER_WHEEL_MASK];
+  GList *it;
+
+  pacer->wheel[tick & GST_ROQ_PACER_WHEEL_MASK] = NULL;
+
+  for (it = flows; it != NULL; it = it->next) {
+    GstRoQPacerFlow *flow = it->data;
+    GstRoQPacerEntry *head;
+    GQueue due = G_QUEUE_INIT;
+
+    flow->scheduled = FALSE;
+    pacer->scheduled--;
+
+    while ((head = g_queue_peek_head (&flow->entries)) != NULL &&
+        head->release / GST_ROQ_PACER_TICK_US <= tick) {
+      g_queue_push_tail (&due, g_queue_pop_head (&flow->entries));
+    }
+
+    if (due.length > 0) {
+      pacer->buffers_paced += due.length;
+      flow->sending = TRUE;
+      g_mutex_unlock (&pacer->lock);
+
+      gst_roq_pacer_flow_send (pacer, flow, &due);
+
+      g_mutex_lock (&pacer->lock);
+      flow->sending = FALSE;
+    }
+
+    /* Anything left is for a later tick, or a later turn of the wheel */
+    gst_roq_pacer_schedule (pacer, flow);
+  }
+
+  g_list_free (flows);
+}
+
+static gpointer
+gst_roq_pacer_thread (gpointer user_data)
+{
+  GstRoQPacer *pacer = GST_ROQ_PACER (user_data);
+
+  g_mutex_lock (&pacer->lock);
+  while (pacer->running) {
+    gint64 now, now_tick;
+
+    if (pacer->scheduled == 0) {
+      g_cond_broadcast (&pacer->drain_cond);
+      g_cond_wait (&pacer->wake_cond, &pacer->lock);
+      continue;
+    }
+
+    now = g_get_monotonic_time ();
+    now_tick = now / GST_ROQ_PACER_TICK_US;
+
+    if (pacer->tick > now_tick) {
+      g_cond_wait_until (&pacer->wake_cond, &pacer->lock,
+          pacer->tick * GST_ROQ_PACER_TICK_US);
+      continue;
+    }
+
+    /* After a long stall, one turn of the wheel catches everything up */
+    if (now_tick - pacer->tick >= GST_ROQ_PACER_WHEEL_SLOTS) {
+      GST_DEBUG_OBJECT (pacer, "Pacer fell %ld ticks behind",
+          now_tick - pacer->tick);
+      pacer->tick = now_tick - GST_ROQ_PACER_WHEEL_SLOTS + 1;
+    }
+
+    while (pacer->running && pacer->tick <= now_tick) {
+      /*
+       * Move on before running the tick, so that anything paced while the
+       * lock is dropped lands in a slot that is still to come.
+       */
+      gint64 tick = pacer->tick++;
+
+      gst_roq_pacer_run_tick (pacer, tick);
+    }
+
+    g_cond_broadcast (&pacer->drain_cond);
+  }
+  g_mutex_unlock (&pacer->lock);
+
+  return NULL;
+}
+
+/*
+ * Hand a buffer to the pacer to be pushed on pad at the monotonic time release
+ * (in microseconds), after everything already queued on the same flow. Takes
+ * ownership of buf and of a reference to pad. If buf is NULL, pad is removed
+ * from its element once the buffers in front of it have been pushed.
+ */
+void
+gst_roq_pacer_push (GstRoQPacer *pacer, GstRoQPacerFlow *flow, GstPad *pad,
+    GstBuffer *buf, gint64 release)
+{
+  GstRoQPacerEntry *entry = g_slice_new (GstRoQPacerEntry);
+
+  entry->buf = buf;
+  entry->pad = pad;
+  entry->release = release;
+
+  g_mutex_lock (&pacer->lock);
+
+  if (!pacer->running) {
+    if (pacer->thread) {
+      /* Stopping, so there's no-one to push it */
+      g_mutex_unlock (&pacer->lock);
+      gst_roq_pacer_entry_free (entry);
+      return;
+    }
+
+    pacer->running = TRUE;
+    pacer->tick = g_get_monotonic_time () / GST_ROQ_PACER_TICK_US;
+    pacer->thread = g_thread_new ("roqpacer", gst_roq_pacer_thread, pacer);
+  }
+
+  g_queue_push_tail (&flow->entries, entry);
+  if (!flow->scheduled && !flow->sending) {
+    gst_roq_pacer_schedule (pacer, flow);
+    g_cond_signal (&pacer->wake_cond);
+  }
+
+  g_mutex_unlock (&pacer->lock);
+}
+
+/*
+ * Returns the first flow return other than GST_FLOW_OK that a buffer on the
+ * flow got since the last call, and clears it.
+ */
+GstFlowReturn
+gst_roq_pacer_flow_take_return (GstRoQPacerFlow *flow)
+{
+  gint rv = g_atomic_int_get (&flow->flow_return);
+
+  if (G_LIKELY (rv == GST_FLOW_OK)) {
+    return GST_FLOW_OK;
+  }
+
+  while (!g_atomic_int_compare_and_exchange (&flow->flow_return, rv,
+      GST_FLOW_OK)) {
+    rv = g_atomic_int_get (&flow->flow_return);
+  }
+
+  return (GstFlowReturn) rv;
+}
+
+/*
+ * Wait until everything queued on a flow has been pushed, such as before
+ * sending EOS.
+ */
+void
+gst_roq_pacer_flow_drain (GstRoQPacer *pacer, GstRoQPacerFlow *flow)
+{
+  g_mutex_lock (&pacer->lock);
+  while (pacer->running &&
+      (flow->sending || g_queue_get_length (&flow->entries) > 0)) {
+    g_cond_wait (&pacer->drain_cond, &pacer->lock);
+  }
+  g_mutex_unlock (&pacer->lock);
+}
+
+/*
+ * The number of buffers the pacing thread has pushed so far.
+ */
+guint64
+gst_roq_pacer_get_buffers_paced (GstRoQPacer *pacer)
+{
+  guint64 rv;
+
+  g_mutex_lock (&pacer->lock);
+  rv = pacer->buffers_paced;
+  g_mutex_unlock (&pacer->lock);
+
+  return rv;
+}
+
+/*
+ * Throw away entries taken off their flows, still removing any pads that were
+ * waiting to be removed. Called without the lock held.
+ */
+static void
+gst_roq_pacer_discard (GQueue *pending)
+{
+  GstRoQPacerEntry *entry;
+
+  while ((entry = g_queue_pop_head (pending)) != NULL) {
+    if (entry->buf == NULL) {
+      gst_roq_pacer_remove_pad (entry->pad);
+    }
+
+    gst_roq_pacer_entry_free (entry);
+  }
+}
+
+/*
+ * Remove a flow from the pacer and free it, such as when the RoQ stream it
+ * paces goes away. Anything still waiting on the flow is thrown away, although
+ * pads waiting to be removed are still removed.
+ */
+void
+gst_roq_pacer_flow_free (GstRoQPacer *pacer, GstRoQPacerFlow *flow)
+{
+  GQueue pending;
+  guint i;
+
+  g_mutex_lock (&pacer->lock);
+
+  /* The thread is still using the flow while it pushes */
+  while (flow->sending) {
+    g_cond_wait (&pacer->drain_cond, &pacer->lock);
+  }
+
+  if (flow->scheduled) {
+    for (i = 0; i < GST_ROQ_PACER_WHEEL_SLOTS; i++) {
+      if (g_list_find (pacer->wheel[i], flow)) {
+        pacer->wheel[i] = g_list_remove (pacer->wheel[i], flow);
+        break;
+      }
+    }
+    flow->scheduled = FALSE;
+    pacer->scheduled--;
+  }
+
+  pacer->flows = g_list_remove (pacer->flows, flow);
+
+  pending = flow->entries;
+  g_queue_init (&flow->entries);
+
+  g_mutex_unlock (&pacer->lock);
+
+  GST_DEBUG_OBJECT (pacer, "Freeing flow with %u buffers and pad removals "
+      "still waiting", pending.length);
+
+  gst_roq_pacer_discard (&pending);
+  gst_roq_pacer_flow_free_entries (flow);
+}
+
+/*
+ * Stop the pacing thread and throw away every buffer still waiting, although
+ * pads waiting to be removed are still removed. The thread is started again by
+ * the next buffer pushed.
+ */
+void
+gst_roq_pacer_stop (GstRoQPacer *pacer)
+{
+  GThread *thread;
+  GQueue pending = G_QUEUE_INIT;
+  GstRoQPacerEntry *entry;
+  GList *it;
+  guint i;
+
+  g_mutex_lock (&pacer->lock);
+  thread = pacer->thread;
+  pacer->running = FALSE;
+  g_cond_broadcast (&pacer->wake_cond);
+  g_cond_broadcast (&pacer->drain_cond);
+  g_mutex_unlock (&pacer->lock);
+
+  if (thread == NULL) {
+    return;
+  }
+
+  g_thread_join (thread);
+
+  g_mutex_lock (&pacer->lock);
+  for (i = 0; i < GST_ROQ_PACER_WHEEL_SLOTS; i++) {
+    g_list_free (pacer->wheel[i]);
+    pacer->wheel[i] = NULL;
+  }
+  pacer->scheduled = 0;
+
+  for (it = pacer->flows; it != NULL; it = it->next) {
+    GstRoQPacerFlow *flow = it->data;
+
+    while ((entry = g_queue_pop_head (&flow->entries)) != NULL) {
+      g_queue_push_tail (&pending, entry);
+    }
+    flow->scheduled = FALSE;
+    g_atomic_int_set (&flow->flow_return, GST_FLOW_OK);
+  }
+
+  pacer->thread = NULL;
+  g_mutex_unlock (&pacer->lock);
+
+  GST_DEBUG_OBJECT (pacer, "Stopped with %u buffers and pad removals still "
+      "waiting", pending.length);
+
+  gst_roq_pacer_discard (&pending);
+}
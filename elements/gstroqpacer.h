@@ -0,0 +1,116 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_ROQPACER_H__
+#define __GST_ROQPACER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The pacer's timer wheel has this many slots, each covering one tick, so a
+ * full turn of the wheel is 128ms. Buffers further away than that just wait
+ * for the wheel to come round again.
+ */
+#define GST_ROQ_PACER_WHEEL_SLOTS 256
+#define GST_ROQ_PACER_TICK_US 500
+
+/*
+ * A sequence of buffers that must leave in the order they were paced, such as
+ * everything sent for one RoQ stream. Owned by the pacer until it is given
+ * back with gst_roq_pacer_flow_free().
+ */
+typedef struct _GstRoQPacerFlow GstRoQPacerFlow;
+
+#define GST_TYPE_ROQ_PACER (gst_roq_pacer_get_type())
+G_DECLARE_FINAL_TYPE (GstRoQPacer, gst_roq_pacer, GST, ROQ_PACER, GstObject)
+
+struct _GstRoQPacer
+{
+  GstObject parent;
+
+  GThread *thread;
+  GMutex lock;
+  GCond wake_cond;
+  GCond drain_cond;
+  gboolean running;
+
+  /*
+   * Flows waiting for the buffer at their head to be released, in the slot
+   * for that buffer's release tick. tick is the next tick to be run.
+   *
+   * GList of GstRoQPacerFlow
+   */
+  GList *wheel[GST_ROQ_PACER_WHEEL_SLOTS];
+  gint64 tick;
+  guint scheduled;
+
+  /* GList of GstRoQPacerFlow */
+  GList *flows;
+
+  /* Read with gst_roq_pacer_get_buffers_paced() */
+  guint64 buffers_paced;
+};
+
+GstRoQPacer *gst_roq_pacer_new (void);
+
+GstRoQPacerFlow *gst_roq_pacer_flow_new (GstRoQPacer *pacer);
+
+void gst_roq_pacer_flow_free (GstRoQPacer *pacer, GstRoQPacerFlow *flow);
+
+void gst_roq_pacer_push (GstRoQPacer *pacer, GstRoQPacerFlow *flow,
+    GstPad *pad, GstBuffer *buf, gint64 release);
+
+GstFlowReturn gst_roq_pacer_flow_take_return (GstRoQPacerFlow *flow);
+
+void gst_roq_pacer_flow_drain (GstRoQPacer *pacer, GstRoQPacerFlow *flow);
+
+void gst_roq_pacer_stop (GstRoQPacer *pacer);
+
+guint64 gst_roq_pacer_get_buffers_paced (GstRoQPacer *pacer);
+
+G_END_DECLS
+
+#endif /* __GST_ROQPACER_H__ */
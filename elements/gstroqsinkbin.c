@@ -325,7 +325,7 @@ gst_roq_sink_bin_request_new_pad (GstElement *element, GstPadTemplate *templ,
         gst_pad_template_get_caps (GST_PAD_TEMPLATE (pad_templates->data)),
         gst_pad_template_get_caps (templ))) {
       internal_sink_pad = gst_element_request_pad (self->rtpquicmux,
-          GST_PAD_TEMPLATE (pad_templates->data), NULL, NULL);
+          GST_PAD_TEMPLATE (pad_templates->data), name, NULL);
     }
   }
 
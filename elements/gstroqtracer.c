@@ -0,0 +1,545 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * SECTION:tracer-roqtracer
+ *
+ * A tracer that records every RTP and RTCP packet leaving rtpquicmux and
+ * rtpquicdemux as a compact binary record: the flow identifier, the QUIC
+ * stream it was carried on, the RTP sequence number, timestamp, SSRC and
+ * payload type, the buffer size and the marker bit.
+ *
+ * Recording a packet only reads its RoQ and RTP headers and writes a record
+ * into a lock-free ring buffer. A separate thread empties the ring every
+ * interval, either into a file of records or, if no file is given, into the
+ * roqtracer debug category. If the dump thread falls behind, the oldest
+ * records are overwritten and counted as dropped.
+ *
+ * The tracer takes the following parameters:
+ *
+ * - file: path of the binary dump file. Each record is a GstRoQTracerRecord
+ *   in host byte order, after a "RoQT" magic and a guint32 record size.
+ * - size: number of records in the ring, rounded up to a power of two and
+ *   limited to 16777216. Defaults to 65536.
+ * - interval: milliseconds between dumps. Defaults to 100.
+ *
+ * For example:
+ *
+ * |[
+ * GST_TRACERS="roqtracer(file=/tmp/roq.bin,interval=50)" gst-launch-1.0 ...
+ * ]|
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+
+#include "gstroqtracer.h"
+#include "gstrtpquicmux.h"
+#include "gstrtpquicdemux.h"
+#include <gstquiccommon.h>
+#include <gstquicstream.h>
+#include <gstquicdatagram.h>
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_roq_tracer_debug);
+#define GST_CAT_DEFAULT gst_roq_tracer_debug
+
+#define GST_ROQ_TRACER_DEFAULT_SIZE 65536
+#define GST_ROQ_TRACER_MAX_SIZE (1u << 24)
+#define GST_ROQ_TRACER_DEFAULT_INTERVAL 100
+
+#define gst_roq_tracer_parent_class parent_class
+G_DEFINE_TYPE (GstRoQTracer, gst_roq_tracer, GST_TYPE_TRACER);
+
+static void gst_roq_tracer_constructed (GObject *object);
+static void gst_roq_tracer_finalize (GObject *object);
+
+static void
+gst_roq_tracer_class_init (GstRoQTracerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gst_roq_tracer_constructed;
+  object_class->finalize = gst_roq_tracer_finalize;
+}
+
+static void
+gst_roq_tracer_init (GstRoQTracer *self)
+{
+  self->mux_type = G_TYPE_INVALID;
+  self->demux_type = G_TYPE_INVALID;
+  self->head = 0;
+  self->tail = 0;
+  self->dropped = 0;
+  self->stopping = FALSE;
+  self->dump_interval = GST_ROQ_TRACER_DEFAULT_INTERVAL * GST_MSECOND;
+  self->dump_file = NULL;
+
+  g_mutex_init (&self->dump_lock);
+  g_cond_init (&self->dump_cond);
+}
+
+/*
+ * Claim the next slot in the ring and fill it in. Called from any number of
+ * streaming threads at once, without locks.
+ */
+static void
+gst_roq_tracer_push_record (GstRoQTracer *self,
+    const GstRoQTracerRecord *record)
+{
+  guint idx = (guint) g_atomic_int_add ((gint *) &self->head, 1);
+  GstRoQTracerSlot *slot = &self->ring[idx & self->ring_mask];
+
+  g_atomic_int_set ((gint *) &slot->seq, 0);
+  slot->record = *record;
+  g_atomic_int_set ((gint *) &slot->seq, (gint) (idx + 1));
+}
+
+/*
+ * Fill in the RTP or RTCP fields of a record from the packet header at data.
+ */
+static void
+gst_roq_tracer_parse_rtp (GstRoQTracer *self, GstRoQTracerRecord *record,
+    const guint8 *data, gsize len)
+{
+  if (len < 8) {
+    return;
+  }
+
+  if ((data[1] & 0x7f) >= 64 && (data[1] & 0x7f) <= 95) {
+    /* RFC 5761 */
+    record->flags |= GST_ROQ_TRACER_RECORD_RTCP;
+    record->pt = data[1];
+    record->ssrc = GST_READ_UINT32_BE (data + 4);
+    return;
+  }
+
+  if (len < 12) {
+    return;
+  }
+
+  if (data[1] & 0x80) {
+    record->flags |= GST_ROQ_TRACER_RECORD_MARKER;
+  }
+  record->pt = data[1] & 0x7f;
+  record->seq = GST_READ_UINT16_BE (data + 2);
+  record->rtp_ts = GST_READ_UINT32_BE (data + 4);
+  record->ssrc = GST_READ_UINT32_BE (data + 8);
+}
+
+/*
+ * A buffer leaving rtpquicmux, with its RoQ header in front of the RTP or RTCP
+ * packet. Only the first buffer on a QUIC stream carries the stream type and
+ * flow identifier.
+ */
+static void
+gst_roq_tracer_record_mux (GstRoQTracer *self, GstRtpQuicMux *roqmux,
+    GstClockTime ts, GstPad *pad, GstBuffer *buf)
+{
+  guint8 data[RTP_QUIC_MUX_MAX_HEADER_LEN + 12];
+  GstRoQTracerRecord record = { 0, };
+  gsize len, off = 0;
+  guint64 value;
+
+  record.ts = ts;
+  record.size = gst_buffer_get_size (buf);
+  record.flags = GST_ROQ_TRACER_RECORD_SENT;
+  record.flow_id = roqmux->rtp_flow_id;
+  record.stream_id = GST_ROQ_TRACER_NO_STREAM;
+
+  len = gst_buffer_extract (buf, 0, data, sizeof (data));
+
+  if (pad == roqmux->datagram_pad) {
+    record.flags |= GST_ROQ_TRACER_RECORD_DATAGRAM;
+    off += gst_quiclib_get_varint (data, &record.flow_id);
+  } else {
+    const gchar *idx = strrchr (GST_PAD_NAME (pad), '_');
+    RtpQuicMuxStream *stream = gst_pad_get_element_private (pad);
+
+    /* Stream pads for RTP carry their stream, and with it the session */
+    if (stream != NULL) {
+      record.flow_id = stream->flow_id;
+    }
+
+    if (idx != NULL) {
+      record.stream_id = g_ascii_strtoull (idx + 1, NULL, 10);
+    }
+
+    if (GST_BUFFER_OFFSET (buf) == 0) {
+      if (roqmux->add_uni_stream_header) {
+        off += gst_quiclib_get_varint (data + off, &value);
+      }
+      off += gst_quiclib_get_varint (data + off, &record.flow_id);
+    }
+    off += gst_quiclib_get_varint (data + off, &value);
+  }
+
+  if (off < len) {
+    gst_roq_tracer_parse_rtp (self, &record, data + off, len - off);
+  }
+
+  gst_roq_tracer_push_record (self, &record);
+}
+
+/*
+ * A plain RTP or RTCP packet leaving rtpquicdemux.
+ */
+static void
+gst_roq_tracer_record_demux (GstRoQTracer *self, GstRtpQuicDemux *roqdemux,
+    GstClockTime ts, GstBuffer *buf)
+{
+  guint8 data[12];
+  GstRoQTracerRecord record = { 0, };
+  GstQuicLibStreamMeta *stream_meta;
+  gsize len;
+
+  record.ts = ts;
+  record.size = gst_buffer_get_size (buf);
+  record.stream_id = GST_ROQ_TRACER_NO_STREAM;
+
+  stream_meta = gst_buffer_get_quiclib_stream_meta (buf);
+  if (stream_meta) {
+    record.stream_id = (guint64) stream_meta->stream_id;
+  } else if (gst_buffer_get_quiclib_datagram_meta (buf)) {
+    record.flags |= GST_ROQ_TRACER_RECORD_DATAGRAM;
+  }
+
+  len = gst_buffer_extract (buf, 0, data, sizeof (data));
+  gst_roq_tracer_parse_rtp (self, &record, data, len);
+
+  if (record.flags & GST_ROQ_TRACER_RECORD_RTCP) {
+    record.flow_id = (roqdemux->rtcp_flow_id == -1) ?
+        roqdemux->rtp_flow_id + 1 : roqdemux->rtcp_flow_id;
+  } else {
+    record.flow_id = roqdemux->rtp_flow_id;
+  }
+
+  gst_roq_tracer_push_record (self, &record);
+}
+
+static void
+gst_roq_tracer_record_buffer (GstRoQTracer *self, GstClockTime ts,
+    GstPad *pad, GstBuffer *buf)
+{
+  GstObject *parent = GST_OBJECT_PARENT (pad);
+
+  if (parent == NULL || GST_PAD_DIRECTION (pad) != GST_PAD_SRC) {
+    return;
+  }
+
+  if (self->mux_type != G_TYPE_INVALID &&
+      G_TYPE_CHECK_INSTANCE_TYPE (parent, self->mux_type)) {
+    gst_roq_tracer_record_mux (self, (GstRtpQuicMux *) parent, ts, pad, buf);
+  } else if (self->demux_type != G_TYPE_INVALID &&
+      G_TYPE_CHECK_INSTANCE_TYPE (parent, self->demux_type)) {
+    gst_roq_tracer_record_demux (self, (GstRtpQuicDemux *) parent, ts, buf);
+  }
+}
+
+static void
+do_push_buffer_pre (GstRoQTracer *self, GstClockTime ts, GstPad *pad,
+    GstBuffer *buf)
+{
+  gst_roq_tracer_record_buffer (self, ts, pad, buf);
+}
+
+static void
+do_push_buffer_list_pre (GstRoQTracer *self, GstClockTime ts, GstPad *pad,
+    GstBufferList *list)
+{
+  guint i, len = gst_buffer_list_length (list);
+
+  for (i = 0; i < len; i++) {
+    gst_roq_tracer_record_buffer (self, ts, pad, gst_buffer_list_get (list, i));
+  }
+}
+
+/*
+ * The RoQ element types only exist once their plugins have been loaded, so
+ * pick them up as the first elements of each type are created rather than
+ * looking them up on every push.
+ */
+static void
+do_element_new (GstRoQTracer *self, GstClockTime ts, GstElement *element)
+{
+  const gchar *type_name = G_OBJECT_TYPE_NAME (element);
+
+  if (self->mux_type == G_TYPE_INVALID &&
+      g_strcmp0 (type_name, "GstRtpQuicMux") == 0) {
+    self->mux_type = G_OBJECT_TYPE (element);
+  } else if (self->demux_type == G_TYPE_INVALID &&
+      g_strcmp0 (type_name, "GstRtpQuicDemux") == 0) {
+    self->demux_type = G_OBJECT_TYPE (element);
+  }
+}
+
+static void
+gst_roq_tracer_dump_record (GstRoQTracer *self,
+    const GstRoQTracerRecord *record)
+{
+  if (self->dump_file) {
+    fwrite (record, sizeof (GstRoQTracerRecord), 1, self->dump_file);
+    return;
+  }
+
+  GST_DEBUG_OBJECT (self, "%" GST_TIME_FORMAT " %s %s flow %lu stream %ld "
+      "%s pt %u ssrc %u seq %u ts %u size %u%s",
+      GST_TIME_ARGS (record->ts),
+      (record->flags & GST_ROQ_TRACER_RECORD_SENT)?("sent"):("received"),
+      (record->flags & GST_ROQ_TRACER_RECORD_DATAGRAM)?("datagram"):("stream"),
+      record->flow_id, (gint64) record->stream_id,
+      (record->flags & GST_ROQ_TRACER_RECORD_RTCP)?("RTCP"):("RTP"),
+      record->pt, record->ssrc, record->seq, record->rtp_ts, record->size,
+      (record->flags & GST_ROQ_TRACER_RECORD_MARKER)?(" marker"):(""));
+}
+
+/*
+ * Write out every record that has been completed since the last drain. If the
+ * writers have lapped the reader, skip forward and count what was lost.
+ */
+static void
+gst_roq_tracer_drain (GstRoQTracer *self)
+{
+  guint64 dropped = self->dropped;
+
+  while (TRUE) {
+    GstRoQTracerSlot *slot = &self->ring[self->tail & self->ring_mask];
+    GstRoQTracerRecord record;
+    guint seq = (guint) g_atomic_int_get ((gint *) &slot->seq);
+
+    if (seq == 0 || (gint) (seq - (self->tail + 1)) < 0) {
+      /* Still being written, or not written yet */
+      break;
+    }
+
+    if (seq != self->tail + 1) {
+      self->dropped += seq - 1 - self->tail;
+      self->tail = seq - 1;
+    }
+
+    record = slot->record;
+
+    if ((guint) g_atomic_int_get ((gint *) &slot->seq) != seq) {
+      /* Overwritten while we were reading it */
+      self->dropped++;
+      self->tail++;
+      continue;
+    }
+
+    gst_roq_tracer_dump_record (self, &record);
+    self->tail++;
+  }
+
+  if (self->dump_file) {
+    fflush (self->dump_file);
+  }
+
+  if (self->dropped != dropped) {
+    GST_WARNING_OBJECT (self, "Dump thread fell behind, %lu records dropped "
+        "so far", self->dropped);
+  }
+}
+
+static gpointer
+gst_roq_tracer_dump_thread (gpointer user_data)
+{
+  GstRoQTracer *self = GST_ROQ_TRACER (user_data);
+
+  g_mutex_lock (&self->dump_lock);
+  while (!self->stopping) {
+    g_cond_wait_until (&self->dump_cond, &self->dump_lock,
+        g_get_monotonic_time () + GST_TIME_AS_USECONDS (self->dump_interval));
+    g_mutex_unlock (&self->dump_lock);
+
+    gst_roq_tracer_drain (self);
+
+    g_mutex_lock (&self->dump_lock);
+  }
+  g_mutex_unlock (&self->dump_lock);
+
+  gst_roq_tracer_drain (self);
+
+  return NULL;
+}
+
+/*
+ * Read an unsigned parameter. Untyped values such as size=1024 are parsed as
+ * G_TYPE_INT, so accept those too as long as they aren't negative.
+ */
+static gboolean
+gst_roq_tracer_get_uint_param (const GstStructure *s, const gchar *name,
+    guint *value)
+{
+  gint int_value;
+
+  if (gst_structure_get_uint (s, name, value)) {
+    return TRUE;
+  }
+
+  if (gst_structure_get_int (s, name, &int_value) && int_value >= 0) {
+    *value = (guint) int_value;
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gst_roq_tracer_constructed (GObject *object)
+{
+  GstRoQTracer *self = GST_ROQ_TRACER (object);
+  GstTracer *tracer = GST_TRACER (object);
+  guint size = GST_ROQ_TRACER_DEFAULT_SIZE;
+  gchar *params = NULL;
+
+  G_OBJECT_CLASS (parent_class)->constructed (object);
+
+  g_object_get (self, "params", &params, NULL);
+
+  if (params) {
+    gchar *tmp = g_strdup_printf ("roqtracer,%s", params);
+    GstStructure *s = gst_structure_new_from_string (tmp);
+
+    if (s) {
+      const gchar *file = gst_structure_get_string (s, "file");
+      guint interval;
+
+      gst_roq_tracer_get_uint_param (s, "size", &size);
+      if (gst_roq_tracer_get_uint_param (s, "interval", &interval) &&
+          interval > 0) {
+        self->dump_interval = interval * GST_MSECOND;
+      }
+
+      if (file) {
+        self->dump_file = fopen (file, "wb");
+        if (self->dump_file) {
+          guint32 record_size = sizeof (GstRoQTracerRecord);
+
+          fwrite ("RoQT", 4, 1, self->dump_file);
+          fwrite (&record_size, sizeof (record_size), 1, self->dump_file);
+        } else {
+          GST_WARNING_OBJECT (self, "Couldn't open dump file %s, logging "
+              "records instead", file);
+        }
+      }
+
+      gst_structure_free (s);
+    } else {
+      GST_WARNING_OBJECT (self, "Couldn't parse parameters \"%s\"", params);
+    }
+
+    g_free (tmp);
+    g_free (params);
+  }
+
+  size = CLAMP (size, 2, GST_ROQ_TRACER_MAX_SIZE);
+  self->ring_mask = (1u << g_bit_storage (size - 1)) - 1;
+  self->ring = g_new0 (GstRoQTracerSlot, self->ring_mask + 1);
+
+  GST_DEBUG_OBJECT (self, "Ring of %u records, dumped every %" GST_TIME_FORMAT,
+      self->ring_mask + 1, GST_TIME_ARGS (self->dump_interval));
+
+  self->dump_thread = g_thread_new ("roqtracer-dump",
+      gst_roq_tracer_dump_thread, self);
+
+  gst_tracing_register_hook (tracer, "element-new",
+      G_CALLBACK (do_element_new));
+  gst_tracing_register_hook (tracer, "pad-push-pre",
+      G_CALLBACK (do_push_buffer_pre));
+  gst_tracing_register_hook (tracer, "pad-push-list-pre",
+      G_CALLBACK (do_push_buffer_list_pre));
+}
+
+static void
+gst_roq_tracer_finalize (GObject *object)
+{
+  GstRoQTracer *self = GST_ROQ_TRACER (object);
+
+  if (self->dump_thread) {
+    g_mutex_lock (&self->dump_lock);
+    self->stopping = TRUE;
+    g_cond_signal (&self->dump_cond);
+    g_mutex_unlock (&self->dump_lock);
+
+    g_thread_join (self->dump_thread);
+    self->dump_thread = NULL;
+  }
+
+  if (self->dump_file) {
+    fclose (self->dump_file);
+    self->dump_file = NULL;
+  }
+
+  g_free (self->ring);
+  self->ring = NULL;
+
+  g_mutex_clear (&self->dump_lock);
+  g_cond_clear (&self->dump_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static gboolean
+roqtracer_init (GstPlugin *plugin)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_roq_tracer_debug, "roqtracer", 0,
+      "RTP-over-QUIC packet tracer");
+
+  return gst_tracer_register (plugin, "roqtracer", GST_TYPE_ROQ_TRACER);
+}
+
+#ifndef PACKAGE
+#define PACKAGE "roqtracer"
+#endif
+
+GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    roqtracer,
+    "RTP-over-QUIC packet tracer",
+    roqtracer_init,
+    PACKAGE_VERSION, GST_LICENSE, GST_PACKAGE_NAME, GST_PACKAGE_ORIGIN)
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2026 British Broadcasting Corporation - Research and Development
+ *
+ * Author: Sam Hurst <sam.hurst@bbc.co.uk>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __GST_ROQTRACER_H__
+#define __GST_ROQTRACER_H__
+
+#include <gst/gst.h>
+
+#include <stdio.h>
+
+G_BEGIN_DECLS
+
+#define GST_ROQ_TRACER_RECORD_SENT      (1 << 0)
+#define GST_ROQ_TRACER_RECORD_DATAGRAM  (1 << 1)
+#define GST_ROQ_TRACER_RECORD_MARKER    (1 << 2)
+#define GST_ROQ_TRACER_RECORD_RTCP      (1 << 3)
+
+/* stream_id for packets that weren't carried on a known QUIC stream */
+#define GST_ROQ_TRACER_NO_STREAM G_MAXUINT64
+
+/*
+ * One packet seen on a RoQ element, as written to the dump file in host byte
+ * order after a "RoQT" magic and a guint32 record size. For RTCP packets, seq
+ * and rtp_ts are 0.
+ */
+struct _GstRoQTracerRecord
+{
+  GstClockTime ts;
+  guint64 flow_id;
+  guint64 stream_id;
+  guint32 rtp_ts;
+  guint32 ssrc;
+  guint32 size;
+  guint16 seq;
+  guint8 pt;
+  guint8 flags;
+};
+
+typedef struct _GstRoQTracerRecord GstRoQTracerRecord;
+
+/*
+ * A slot in the ring buffer. seq is 0 while a record is being written, and
+ * otherwise one more than the index of the record it holds.
+ */
+struct _GstRoQTracerSlot
+{
+  guint seq;
+  GstRoQTracerRecord record;
+};
+
+typedef struct _GstRoQTracerSlot GstRoQTracerSlot;
+
+#define GST_TYPE_ROQ_TRACER (gst_roq_tracer_get_type())
+G_DECLARE_FINAL_TYPE (GstRoQTracer, gst_roq_tracer, GST, ROQ_TRACER,
+    GstTracer)
+
+struct _GstRoQTracer
+{
+  GstTracer parent;
+
+  /* Element types to trace, looked up once they have been registered */
+  GType mux_type;
+  GType demux_type;
+
+  /* Ring of records, written by streaming threads, read by the dump thread */
+  GstRoQTracerSlot *ring;
+  guint ring_mask;
+  guint head;
+  guint tail;
+  guint64 dropped;
+
+  GThread *dump_thread;
+  GMutex dump_lock;
+  GCond dump_cond;
+  gboolean stopping;
+  GstClockTime dump_interval;
+  FILE *dump_file;
+};
+
+G_END_DECLS
+
+#endif /* __GST_ROQTRACER_H__ */
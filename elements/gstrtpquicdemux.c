@@ -73,6 +73,34 @@
  * If the flow-id does not match, then the stream query returns false or the
  * datagram frame is dropped.
  *
+ * If the fec-flow-id property is set to the flow ID that rtpquicmux sends FEC
+ * repair packets on, the last few RTP packets received in datagrams are kept
+ * for each SSRC. When a repair packet arrives for a block that is missing
+ * exactly one packet, that packet is rebuilt and pushed downstream like any
+ * other. The fec-packets-recv and fec-packets-recovered properties count the
+ * repair packets received and the packets rebuilt from them.
+ *
+ * Datagrams can arrive out of order, and the same RTP packet can arrive twice
+ * if the sender retransmits it or moves it between datagrams and streams.
+ * Setting the reorder-latency property puts the RTP packets of each SSRC and
+ * payload type back in sequence number order before they go downstream,
+ * holding back packets that arrive after a gap for no longer than
+ * reorder-latency in the hope that the gap is filled, so that a much smaller
+ * rtpjitterbuffer can be used downstream. Setting drop-duplicates drops
+ * packets with a sequence number that has already been sent downstream.
+ * Packets that have waited reorder-latency are sent on from a timer thread,
+ * whether or not anything else arrives for their source, and whatever is
+ * still held is sent downstream at EOS.
+ *
+ * The stats property holds a GstStructure with a "flows" array of reception
+ * statistics for each flow ID and SSRC received in datagrams: packets
+ * received, expected and lost, loss rate, packets that arrived after a later
+ * one and how far behind they were, a histogram of burst loss lengths taken
+ * from the gaps in sequence numbers as packets arrive, and RFC 3550
+ * interarrival jitter in nanoseconds once downstream caps give a clock-rate.
+ * Setting stats-interval also posts the same structure as an element message
+ * at that interval, checked as RTP packets arrive.
+ *
  * For both stream- and datagram-delivered RTP-over-QUIC frames, the payload
  * type and SSRC will be parsed and the element shall then match that with the
  * caps of a downstream element linked on a src pad. If no matching pad can be
@@ -100,6 +128,7 @@
 #include <gstquicstream.h>
 #include <gstquicdatagram.h>
 #include "gstrtpquicdemux.h"
+#include "gstroqfec.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_rtp_quic_demux_debug);
 #define GST_CAT_DEFAULT gst_rtp_quic_demux_debug
@@ -130,7 +159,17 @@ enum
   PROP_UNI_STREAM_TYPE,
   PROP_USE_UNI_STREAM_HEADER,
   PROP_STREAM_FRAMES_RECEIVED,
-  PROP_DATAGRAMS_RECEIVED
+  PROP_DATAGRAMS_RECEIVED,
+  PROP_FEC_FLOW_ID,
+  PROP_FEC_PACKETS_RECEIVED,
+  PROP_FEC_PACKETS_RECOVERED,
+  PROP_REORDER_LATENCY,
+  PROP_DROP_DUPLICATES,
+  PROP_PACKETS_REORDERED,
+  PROP_DUPLICATES_DROPPED,
+  PROP_REORDER_GAPS_SKIPPED,
+  PROP_STATS,
+  PROP_STATS_INTERVAL
 };
 
 /**
@@ -243,6 +282,13 @@ void rtp_quic_demux_pad_unlinked (GstPad *self, GstPad *peer,
 void rtp_quic_demux_ssrc_hash_destroy (GHashTable *pts);
 void rtp_quic_demux_pt_hash_destroy (RtpQuicDemuxSrc *src);
 
+static guint rtp_quic_demux_flow_stats_hash (gconstpointer key);
+static gboolean rtp_quic_demux_flow_stats_equal (gconstpointer a,
+    gconstpointer b);
+static GstStructure * rtp_quic_demux_build_stats (GstRtpQuicDemux *roqdemux);
+static void rtp_quic_demux_reset_reorder (GstRtpQuicDemux *roqdemux);
+static void rtp_quic_demux_reorder_stop (GstRtpQuicDemux *roqdemux);
+
 /* GObject vmethod implementations */
 
 /* initialize the rtpquicdemux's class */
@@ -306,6 +352,69 @@ gst_rtp_quic_demux_class_init (GstRtpQuicDemuxClass * klass)
           "A counter for the number of DATAGRAMs received for a RoQ stream",
           0, G_MAXUINT64, 0, G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_FEC_FLOW_ID,
+      g_param_spec_int64 ("fec-flow-id", "FEC Flow Identifier",
+          "Identifies the flow-id that FEC repair packets for the RTP flow "
+          "are received on. A value of -1 disables FEC recovery.",
+          -1, 4611686018427387902, -1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FEC_PACKETS_RECEIVED,
+      g_param_spec_uint64 ("fec-packets-recv",
+          "Number of FEC repair packets received",
+          "A counter of the number of FEC repair packets received in DATAGRAMs",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_FEC_PACKETS_RECOVERED,
+      g_param_spec_uint64 ("fec-packets-recovered",
+          "Number of RTP packets recovered",
+          "A counter of the number of lost RTP packets rebuilt from FEC repair "
+          "packets", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_REORDER_LATENCY,
+      g_param_spec_uint64 ("reorder-latency", "Reorder latency",
+          "Longest time in nanoseconds to hold RTP packets back waiting for "
+          "a missing sequence number, so that they go downstream in order. 0 "
+          "disables reordering", 0, G_MAXUINT64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DROP_DUPLICATES,
+      g_param_spec_boolean ("drop-duplicates", "Drop duplicate packets",
+          "Drop RTP packets with a sequence number that has recently been "
+          "sent downstream for the same SSRC and payload type", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PACKETS_REORDERED,
+      g_param_spec_uint64 ("packets-reordered", "Number of packets reordered",
+          "A counter of the number of RTP packets that arrived after a later "
+          "packet and were put back in order", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DUPLICATES_DROPPED,
+      g_param_spec_uint64 ("duplicates-dropped",
+          "Number of duplicate packets dropped",
+          "A counter of the number of duplicate RTP packets dropped",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_REORDER_GAPS_SKIPPED,
+      g_param_spec_uint64 ("reorder-gaps-skipped",
+          "Number of reorder gaps skipped",
+          "A counter of the number of times the reorder window stopped "
+          "waiting for a missing packet", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Datagram reception statistics",
+          "Loss, reorder, burst loss and jitter statistics for each flow ID "
+          "and SSRC received in DATAGRAMs", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics message interval",
+          "Interval in milliseconds between element messages carrying the "
+          "stats structure. 0 disables the messages", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_element_class_set_static_metadata (gstelement_class,
         "RTP-over-QUIC demultiplexer", "Demuxer/Network/Protocol",
         "Receive RTP-over-QUIC media data via QUIC transport",
@@ -339,13 +448,31 @@ gst_rtp_quic_demux_init (GstRtpQuicDemux * roqdemux)
       g_int64_equal, g_free, (GDestroyNotify) rtp_quic_demux_ssrc_hash_destroy);
   roqdemux->quic_streams = g_hash_table_new_full (g_int64_hash, g_int64_equal,
       NULL, gst_object_unref);
+  roqdemux->flow_stats = g_hash_table_new_full (rtp_quic_demux_flow_stats_hash,
+      rtp_quic_demux_flow_stats_equal, NULL, g_free);
 
   roqdemux->rtp_flow_id = -1;
   roqdemux->rtcp_flow_id = -1;
+  roqdemux->fec_flow_id = -1;
   roqdemux->datagram_sink = NULL;
 
   roqdemux->stream_frames_received = 0;
   roqdemux->datagrams_received = 0;
+  roqdemux->fec_packets_received = 0;
+  roqdemux->fec_packets_recovered = 0;
+  roqdemux->reorder_latency = 0;
+  roqdemux->drop_duplicates = FALSE;
+  roqdemux->packets_reordered = 0;
+  roqdemux->duplicates_dropped = 0;
+  roqdemux->reorder_gaps_skipped = 0;
+  g_mutex_init (&roqdemux->reorder_lock);
+  g_cond_init (&roqdemux->reorder_cond);
+  roqdemux->reorder_thread = NULL;
+  roqdemux->reorder_running = FALSE;
+  roqdemux->reorder_next_wake = G_MAXINT64;
+  roqdemux->reorder_waiting = NULL;
+  roqdemux->stats_interval = 0;
+  roqdemux->stats_next_post = 0;
 
   GST_DEBUG_OBJECT (roqdemux, "RTP QUIC demux initialised");
 }
@@ -375,6 +502,20 @@ gst_rtp_quic_demux_set_property (GObject * object, guint prop_id,
     case PROP_USE_UNI_STREAM_HEADER:
       roqdemux->match_uni_stream_type = g_value_get_boolean (value);
       break;
+    case PROP_FEC_FLOW_ID:
+      roqdemux->fec_flow_id = g_value_get_int64 (value);
+      break;
+    case PROP_REORDER_LATENCY:
+      roqdemux->reorder_latency = g_value_get_uint64 (value);
+      break;
+    case PROP_DROP_DUPLICATES:
+      roqdemux->drop_duplicates = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (roqdemux);
+      roqdemux->stats_interval = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (roqdemux);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -406,6 +547,38 @@ gst_rtp_quic_demux_get_property (GObject * object, guint prop_id,
     case PROP_DATAGRAMS_RECEIVED:
       g_value_set_uint64 (value, roqdemux->datagrams_received);
       break;
+    case PROP_FEC_FLOW_ID:
+      g_value_set_int64 (value, roqdemux->fec_flow_id);
+      break;
+    case PROP_FEC_PACKETS_RECEIVED:
+      g_value_set_uint64 (value, roqdemux->fec_packets_received);
+      break;
+    case PROP_FEC_PACKETS_RECOVERED:
+      g_value_set_uint64 (value, roqdemux->fec_packets_recovered);
+      break;
+    case PROP_REORDER_LATENCY:
+      g_value_set_uint64 (value, roqdemux->reorder_latency);
+      break;
+    case PROP_DROP_DUPLICATES:
+      g_value_set_boolean (value, roqdemux->drop_duplicates);
+      break;
+    case PROP_PACKETS_REORDERED:
+      g_value_set_uint64 (value, roqdemux->packets_reordered);
+      break;
+    case PROP_DUPLICATES_DROPPED:
+      g_value_set_uint64 (value, roqdemux->duplicates_dropped);
+      break;
+    case PROP_REORDER_GAPS_SKIPPED:
+      g_value_set_uint64 (value, roqdemux->reorder_gaps_skipped);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, rtp_quic_demux_build_stats (roqdemux));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (roqdemux);
+      g_value_set_uint (value, roqdemux->stats_interval);
+      GST_OBJECT_UNLOCK (roqdemux);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -427,6 +600,13 @@ gst_rtp_quic_demux_finalise (GObject *object)
     }
   }
 
+  g_hash_table_destroy (roqdemux->flow_stats);
+
+  rtp_quic_demux_reorder_stop (roqdemux);
+  g_list_free (roqdemux->reorder_waiting);
+  g_mutex_clear (&roqdemux->reorder_lock);
+  g_cond_clear (&roqdemux->reorder_cond);
+
   GST_WARNING_OBJECT (roqdemux, "RTP-over-QUIC demux is being finalised!");
 }
 
@@ -442,6 +622,12 @@ gst_rtp_quic_demux_change_state (GstElement *elem, GstStateChange t)
   GstStateChangeReturn rv =
       GST_ELEMENT_CLASS (parent_class)->change_state (elem, t);
 
+  if (t == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    /* The streaming threads have stopped, so nothing held will be sent */
+    rtp_quic_demux_reorder_stop (roqdemux);
+    rtp_quic_demux_reset_reorder (roqdemux);
+  }
+
   return rv;
 }
 
@@ -462,12 +648,452 @@ gst_rtp_quic_demux_setcaps (GstRtpQuicDemux *roqdemux, GstCaps *caps)
   return TRUE;
 }
 
+/*
+ * Send a packet downstream from the reorder window, remembering its sequence
+ * number so that any copy of it that turns up later can be dropped.
+ */
+static void
+rtp_quic_demux_reorder_release (RtpQuicDemuxReorder *reorder, GstBuffer *buf,
+    guint16 seq, GstBufferList *out)
+{
+  reorder->delivered[seq & RTP_QUIC_DEMUX_REORDER_MASK] = seq | 0x10000;
+  gst_buffer_list_add (out, buf);
+}
+
+/*
+ * Release the packets held in an unbroken run from next_seq onwards.
+ */
+static void
+rtp_quic_demux_reorder_release_run (RtpQuicDemuxReorder *reorder,
+    GstBufferList *out)
+{
+  while (reorder->held > 0) {
+    RtpQuicDemuxReorderSlot *slot =
+        &reorder->slots[reorder->next_seq & RTP_QUIC_DEMUX_REORDER_MASK];
+
+    if (slot->buf == NULL || slot->seq != reorder->next_seq) {
+      break;
+    }
+
+    rtp_quic_demux_reorder_release (reorder, slot->buf, slot->seq, out);
+    slot->buf = NULL;
+    reorder->held--;
+    reorder->next_seq++;
+  }
+}
+
+/*
+ * Returns the held packet with the lowest sequence number, or NULL if there
+ * isn't one.
+ */
+static RtpQuicDemuxReorderSlot *
+rtp_quic_demux_reorder_first_held (RtpQuicDemuxReorder *reorder)
+{
+  guint i;
+
+  if (reorder->held == 0) {
+    return NULL;
+  }
+
+  for (i = 0; i < RTP_QUIC_DEMUX_REORDER_SLOTS; i++) {
+    guint16 seq = reorder->next_seq + i;
+    RtpQuicDemuxReorderSlot *slot =
+        &reorder->slots[seq & RTP_QUIC_DEMUX_REORDER_MASK];
+
+    if (slot->buf != NULL && slot->seq == seq) {
+      return slot;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Stop waiting for anything missing, and release everything held in order.
+ */
+static void
+rtp_quic_demux_reorder_flush (RtpQuicDemuxReorder *reorder, GstBufferList *out)
+{
+  RtpQuicDemuxReorderSlot *slot;
+
+  while ((slot = rtp_quic_demux_reorder_first_held (reorder)) != NULL) {
+    reorder->next_seq = slot->seq;
+    rtp_quic_demux_reorder_release_run (reorder, out);
+  }
+}
+
+/*
+ * Stop waiting for anything that has been missing for longer than
+ * reorder-latency at the monotonic time now.
+ */
+static void
+rtp_quic_demux_reorder_expire (GstRtpQuicDemux *roqdemux,
+    RtpQuicDemuxReorder *reorder, gint64 now, GstBufferList *out)
+{
+  RtpQuicDemuxReorderSlot *slot;
+
+  while ((slot = rtp_quic_demux_reorder_first_held (reorder)) != NULL &&
+      (GstClockTime) (now - slot->arrival) * GST_USECOND >=
+      roqdemux->reorder_latency) {
+    GST_LOG_OBJECT (roqdemux, "Giving up on sequence numbers %u to %u",
+        reorder->next_seq, (guint16) (slot->seq - 1));
+    roqdemux->reorder_gaps_skipped++;
+    reorder->next_seq = slot->seq;
+    rtp_quic_demux_reorder_release_run (reorder, out);
+  }
+}
+
+/*
+ * The monotonic time at which the first packet held in a reorder window will
+ * have waited reorder-latency, or G_MAXINT64 if nothing is held.
+ */
+static gint64
+rtp_quic_demux_reorder_deadline (GstRtpQuicDemux *roqdemux,
+    RtpQuicDemuxReorder *reorder)
+{
+  RtpQuicDemuxReorderSlot *slot = rtp_quic_demux_reorder_first_held (reorder);
+
+  if (slot == NULL) {
+    return G_MAXINT64;
+  }
+
+  return slot->arrival + (gint64) (roqdemux->reorder_latency / GST_USECOND);
+}
+
+static gpointer rtp_quic_demux_reorder_thread (gpointer user_data);
+
+/*
+ * Make sure the timer thread will let go of what a source is holding once it
+ * has waited long enough, starting the thread if need be. Must be called with
+ * the reorder lock held.
+ */
+static void
+rtp_quic_demux_reorder_wait (GstRtpQuicDemux *roqdemux, RtpQuicDemuxSrc *src)
+{
+  if (src->reorder->held == 0) {
+    return;
+  }
+
+  if (!roqdemux->reorder_running) {
+    if (roqdemux->reorder_thread) {
+      /* Stopping, and the window is about to be thrown away anyway */
+      return;
+    }
+
+    roqdemux->reorder_running = TRUE;
+    roqdemux->reorder_thread = g_thread_new ("roqreorder",
+        rtp_quic_demux_reorder_thread, roqdemux);
+  }
+
+  if (!src->reorder->waiting) {
+    src->reorder->waiting = TRUE;
+    roqdemux->reorder_waiting = g_list_prepend (roqdemux->reorder_waiting,
+        src);
+  }
+
+  if (rtp_quic_demux_reorder_deadline (roqdemux, src->reorder) <
+      roqdemux->reorder_next_wake) {
+    g_cond_signal (&roqdemux->reorder_cond);
+  }
+}
+
+/*
+ * Pass an RTP packet through a source's duplicate filter and reorder window.
+ * Whatever can now go downstream is added to out, in sequence number order.
+ * Must be called with the reorder lock held.
+ */
+static void
+rtp_quic_demux_src_reorder (GstRtpQuicDemux *roqdemux, RtpQuicDemuxSrc *src,
+    GstBuffer *buf, GstBufferList *out)
+{
+  RtpQuicDemuxReorder *reorder;
+  RtpQuicDemuxReorderSlot *slot;
+  guint8 header[4];
+  guint16 seq;
+  gint16 diff;
+  gint64 now;
+
+  if (gst_buffer_extract (buf, 0, header, 4) < 4) {
+    gst_buffer_list_add (out, buf);
+    return;
+  }
+
+  seq = GST_READ_UINT16_BE (header + 2);
+
+  if (G_UNLIKELY (src->reorder == NULL)) {
+    src->reorder = g_new0 (RtpQuicDemuxReorder, 1);
+  }
+  reorder = src->reorder;
+  slot = &reorder->slots[seq & RTP_QUIC_DEMUX_REORDER_MASK];
+
+  if (roqdemux->drop_duplicates &&
+      (reorder->delivered[seq & RTP_QUIC_DEMUX_REORDER_MASK] ==
+          (seq | 0x10000) || (slot->buf != NULL && slot->seq == seq))) {
+    GST_LOG_OBJECT (roqdemux, "Dropping duplicate of RTP packet with "
+        "sequence number %u", seq);
+    roqdemux->duplicates_dropped++;
+    gst_buffer_unref (buf);
+    return;
+  }
+
+  if (roqdemux->reorder_latency == 0) {
+    rtp_quic_demux_reorder_release (reorder, buf, seq, out);
+    return;
+  }
+
+  if (slot->buf != NULL && slot->seq == seq) {
+    /* A copy of a packet that is held, which stays where it is */
+    gst_buffer_list_add (out, buf);
+    return;
+  }
+
+  if (!reorder->started) {
+    reorder->started = TRUE;
+    reorder->next_seq = seq;
+  }
+
+  diff = (gint16) (seq - reorder->next_seq);
+
+  if (diff < 0) {
+    /* Already given up on, so too late to put in order, but still useful */
+    rtp_quic_demux_reorder_release (reorder, buf, seq, out);
+    return;
+  }
+
+  if (diff >= RTP_QUIC_DEMUX_REORDER_SLOTS) {
+    GST_DEBUG_OBJECT (roqdemux, "Sequence number %u is %d ahead of %u, "
+        "flushing reorder window", seq, diff, reorder->next_seq);
+    rtp_quic_demux_reorder_flush (reorder, out);
+    reorder->next_seq = seq;
+    diff = 0;
+  }
+
+  if (diff == 0 && reorder->held > 0) {
+    roqdemux->packets_reordered++;
+  }
+
+  now = g_get_monotonic_time ();
+
+  slot->buf = buf;
+  slot->seq = seq;
+  slot->arrival = now;
+  reorder->held++;
+
+  rtp_quic_demux_reorder_release_run (reorder, out);
+  rtp_quic_demux_reorder_expire (roqdemux, reorder, now, out);
+  rtp_quic_demux_reorder_wait (roqdemux, src);
+}
+
+/*
+ * Throw away everything held in a reorder window and forget the sequence
+ * numbers seen, so that it starts again from the next packet.
+ */
+static void
+rtp_quic_demux_reorder_reset (RtpQuicDemuxReorder *reorder)
+{
+  guint i;
+
+  for (i = 0; i < RTP_QUIC_DEMUX_REORDER_SLOTS; i++) {
+    if (reorder->slots[i].buf) {
+      gst_buffer_unref (reorder->slots[i].buf);
+      reorder->slots[i].buf = NULL;
+    }
+    reorder->delivered[i] = 0;
+  }
+
+  reorder->held = 0;
+  reorder->started = FALSE;
+  reorder->waiting = FALSE;
+}
+
+static void
+rtp_quic_demux_reorder_free (RtpQuicDemuxReorder *reorder)
+{
+  rtp_quic_demux_reorder_reset (reorder);
+  g_free (reorder);
+}
+
+static void
+_reset_reorder_pt (gpointer key, gpointer value, gpointer user_data)
+{
+  RtpQuicDemuxSrc *src = (RtpQuicDemuxSrc *) value;
+
+  if (src->reorder != NULL) {
+    rtp_quic_demux_reorder_reset (src->reorder);
+  }
+}
+
+static void
+_reset_reorder_ssrc (gpointer key, gpointer value, gpointer user_data)
+{
+  g_hash_table_foreach ((GHashTable *) value, _reset_reorder_pt, NULL);
+}
+
+/*
+ * Drop whatever every source is holding for reordering, such as on a flush,
+ * when nothing from before it should go downstream any more.
+ */
+static void
+rtp_quic_demux_reset_reorder (GstRtpQuicDemux *roqdemux)
+{
+  g_mutex_lock (&roqdemux->reorder_lock);
+  g_hash_table_foreach (roqdemux->src_ssrcs, _reset_reorder_ssrc, NULL);
+  g_list_free (roqdemux->reorder_waiting);
+  roqdemux->reorder_waiting = NULL;
+  g_mutex_unlock (&roqdemux->reorder_lock);
+}
+
+struct _RtpQuicDemuxReorderPush
+{
+  GstPad *pad;
+  GstBufferList *list;
+};
+
+typedef struct _RtpQuicDemuxReorderPush RtpQuicDemuxReorderPush;
+
+/*
+ * Let go of whatever has waited reorder-latency in the windows that are
+ * holding packets, and work out when to look again. Returns a list of
+ * RtpQuicDemuxReorderPush for the caller to push once the lock is dropped.
+ * Must be called with the reorder lock held.
+ */
+static GList *
+rtp_quic_demux_reorder_expire_all (GstRtpQuicDemux *roqdemux, gint64 now,
+    gint64 *next_wake)
+{
+  GList *pushes = NULL;
+  GList *it, *next;
+
+  *next_wake = G_MAXINT64;
+
+  for (it = roqdemux->reorder_waiting; it != NULL; it = next) {
+    RtpQuicDemuxSrc *src = it->data;
+    gint64 deadline;
+
+    next = it->next;
+
+    if (rtp_quic_demux_reorder_deadline (roqdemux, src->reorder) <= now) {
+      RtpQuicDemuxReorderPush *push = g_new (RtpQuicDemuxReorderPush, 1);
+
+      push->pad = gst_object_ref (src->src);
+      push->list = gst_buffer_list_new ();
+      rtp_quic_demux_reorder_expire (roqdemux, src->reorder, now, push->list);
+      pushes = g_list_prepend (pushes, push);
+    }
+
+    deadline = rtp_quic_demux_reorder_deadline (roqdemux, src->reorder);
+    if (deadline == G_MAXINT64) {
+      src->reorder->waiting = FALSE;
+      roqdemux->reorder_waiting =
+          g_list_delete_link (roqdemux->reorder_waiting, it);
+    } else {
+      *next_wake = MIN (*next_wake, deadline);
+    }
+  }
+
+  return pushes;
+}
+
+/*
+ * Sleeps until the first held packet has waited reorder-latency, and pushes it
+ * downstream along with whatever it was holding up, so that a quiet source
+ * isn't left holding packets until the next one arrives.
+ */
+static gpointer
+rtp_quic_demux_reorder_thread (gpointer user_data)
+{
+  GstRtpQuicDemux *roqdemux = GST_RTPQUICDEMUX (user_data);
+
+  g_mutex_lock (&roqdemux->reorder_lock);
+  while (roqdemux->reorder_running) {
+    GList *pushes, *it;
+    gint64 next_wake;
+
+    pushes = rtp_quic_demux_reorder_expire_all (roqdemux,
+        g_get_monotonic_time (), &next_wake);
+
+    if (pushes != NULL) {
+      g_mutex_unlock (&roqdemux->reorder_lock);
+
+      for (it = g_list_reverse (pushes); it != NULL; it = it->next) {
+        RtpQuicDemuxReorderPush *push = it->data;
+
+        GST_DEBUG_OBJECT (roqdemux, "Pushing %u packets held for too long on "
+            "pad %" GST_PTR_FORMAT, gst_buffer_list_length (push->list),
+            push->pad);
+        gst_pad_push_list (push->pad, push->list);
+        gst_object_unref (push->pad);
+        g_free (push);
+      }
+      g_list_free (pushes);
+
+      g_mutex_lock (&roqdemux->reorder_lock);
+      continue;
+    }
+
+    roqdemux->reorder_next_wake = next_wake;
+    if (next_wake == G_MAXINT64) {
+      g_cond_wait (&roqdemux->reorder_cond, &roqdemux->reorder_lock);
+    } else {
+      g_cond_wait_until (&roqdemux->reorder_cond, &roqdemux->reorder_lock,
+          next_wake);
+    }
+    /* Awake, so it will look at every window again before sleeping */
+    roqdemux->reorder_next_wake = G_MININT64;
+  }
+  g_mutex_unlock (&roqdemux->reorder_lock);
+
+  return NULL;
+}
+
+/*
+ * Stop the reorder timer thread, leaving anything held where it is.
+ */
+static void
+rtp_quic_demux_reorder_stop (GstRtpQuicDemux *roqdemux)
+{
+  GThread *thread;
+
+  g_mutex_lock (&roqdemux->reorder_lock);
+  thread = roqdemux->reorder_thread;
+  roqdemux->reorder_running = FALSE;
+  g_cond_signal (&roqdemux->reorder_cond);
+  g_mutex_unlock (&roqdemux->reorder_lock);
+
+  if (thread == NULL) {
+    return;
+  }
+
+  g_thread_join (thread);
+
+  g_mutex_lock (&roqdemux->reorder_lock);
+  roqdemux->reorder_thread = NULL;
+  roqdemux->reorder_next_wake = G_MAXINT64;
+  g_mutex_unlock (&roqdemux->reorder_lock);
+}
+
 void
 _propagate_eos_pt (gpointer key, gpointer value, gpointer user_data)
 {
   RtpQuicDemuxSrc *src = (RtpQuicDemuxSrc *) value;
   GstEvent *eos = GST_EVENT (user_data);
 
+  /* Nothing else is coming to fill the gaps */
+  if (src->reorder != NULL) {
+    GstRtpQuicDemux *roqdemux = GST_RTPQUICDEMUX (GST_PAD_PARENT (src->src));
+    GstBufferList *out = gst_buffer_list_new ();
+
+    g_mutex_lock (&roqdemux->reorder_lock);
+    rtp_quic_demux_reorder_flush (src->reorder, out);
+    g_mutex_unlock (&roqdemux->reorder_lock);
+
+    if (gst_buffer_list_length (out) > 0) {
+      gst_pad_push_list (src->src, out);
+    } else {
+      gst_buffer_list_unref (out);
+    }
+  }
+
   gst_pad_push_event (src->src, eos);
 }
 
@@ -608,6 +1234,10 @@ gst_rtp_quic_demux_sink_event (GstPad * pad, GstObject * parent,
 
       break;
     }
+    case GST_EVENT_FLUSH_STOP:
+      rtp_quic_demux_reset_reorder (roqdemux);
+      ret = gst_pad_event_default (pad, parent, event);
+      break;
     default:
       ret = gst_pad_event_default (pad, parent, event);
       break;
@@ -880,40 +1510,353 @@ rtp_quic_demux_get_src_pad (GstRtpQuicDemux *roqdemux, guint64 flow_id,
     return FALSE;
   }
 
-  if (gst_debug_category_get_threshold (gst_rtp_quic_demux_debug)
-      >= GST_LEVEL_DEBUG) {
-    GstPad *peer;
-    GstElement *peer_parent;
-    gchar *parent_name;
-
-    peer = gst_pad_get_peer (srcpad);
-    if (peer == NULL) {
-      GST_DEBUG_OBJECT (roqdemux, "Couldn't get peer element for srcpad %"
-          GST_PTR_FORMAT, srcpad);
-      return srcpad;
-    } else if (!GST_IS_GHOST_PAD (peer)) {
-      peer_parent = gst_pad_get_parent_element (peer);
-      parent_name = gst_element_get_name (peer_parent);
-
-      GST_DEBUG_OBJECT (roqdemux, "Mapped RT%sP src pad for flow ID %lu, "
-          "SSRC %u, PT %u with padname %s linked to element %s",
-          (pt > 127)?("C"):(""), flow_id, ssrc, pt, GST_PAD_NAME (srcpad),
-          parent_name);
-      g_free (parent_name);
-      gst_object_unref (peer_parent);
-    } else {
-      GstGhostPad *gpad = GST_GHOST_PAD (peer);
+  GST_LOG_OBJECT (roqdemux, "Mapped RT%sP src pad %" GST_PTR_FORMAT
+      " for flow ID %lu, SSRC %u, PT %u", (pt > 127)?("C"):(""), srcpad,
+      flow_id, ssrc, pt);
+
+  return srcpad;
+}
+
+static RtpQuicDemuxSrc *
+rtp_quic_demux_lookup_rtp_src (GstRtpQuicDemux *roqdemux, guint32 ssrc,
+    guint32 pt)
+{
+  GHashTable *pts_ht;
+
+  pt = pt & 0x0000007f;
+
+  pts_ht = g_hash_table_lookup (roqdemux->src_ssrcs, &ssrc);
+  if (pts_ht == NULL) {
+    return NULL;
+  }
+
+  return g_hash_table_lookup (pts_ht, &pt);
+}
+
+/*
+ * Keep an RTP packet received in a datagram in case a repair packet is needed
+ * to rebuild one of its neighbours.
+ */
+static void
+rtp_quic_demux_fec_store (GstRtpQuicDemux *roqdemux, guint32 ssrc, guint32 pt,
+    GstBuffer *buf)
+{
+  RtpQuicDemuxSrc *src = rtp_quic_demux_lookup_rtp_src (roqdemux, ssrc, pt);
+
+  if (src == NULL) {
+    return;
+  }
+
+  if (src->fec == NULL) {
+    src->fec = g_new (GstRoQFecDecoder, 1);
+    gst_roq_fec_decoder_init (src->fec);
+  }
+
+  gst_roq_fec_decoder_store (src->fec, buf);
+}
+
+/*
+ * Rebuild a lost RTP packet from a repair packet, whose RoQ flow identifier has
+ * already been read. Returns NULL if there is nothing to rebuild.
+ */
+static GstBuffer *
+rtp_quic_demux_fec_recover (GstRtpQuicDemux *roqdemux, GstBuffer *repair)
+{
+  RtpQuicDemuxSrc *src;
+  GstBuffer *recovered;
+  guint64 flow_id;
+  guint32 ssrc;
+  guint8 pt;
+
+  roqdemux->fec_packets_received++;
+
+  if (!gst_roq_fec_parse_header (repair, &flow_id, &ssrc, &pt)) {
+    GST_WARNING_OBJECT (roqdemux, "Dropping malformed FEC repair packet of "
+        "%lu bytes", gst_buffer_get_size (repair));
+    return NULL;
+  }
+
+  if (flow_id != roqdemux->rtp_flow_id) {
+    GST_DEBUG_OBJECT (roqdemux, "Ignoring FEC repair packet for flow ID %lu, "
+        "expected RTP flow ID %ld", flow_id, roqdemux->rtp_flow_id);
+    return NULL;
+  }
+
+  /* Keyed the same way as the SSRCs read from the RTP packets */
+  ssrc = ntohl (ssrc);
+
+  src = rtp_quic_demux_lookup_rtp_src (roqdemux, ssrc, pt);
+  if (src == NULL || src->fec == NULL) {
+    return NULL;
+  }
+
+  recovered = gst_roq_fec_decoder_recover (src->fec, repair);
+  if (recovered == NULL) {
+    return NULL;
+  }
+
+  GST_BUFFER_PTS (recovered) = GST_BUFFER_PTS (repair);
+  GST_BUFFER_DTS (recovered) = GST_BUFFER_DTS (repair);
+
+  /* It arrived in the repair packet's datagram, as far as tracing goes */
+  gst_buffer_copy_into (recovered, repair, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  roqdemux->fec_packets_recovered++;
+
+  GST_DEBUG_OBJECT (roqdemux, "Recovered lost RTP packet of %lu bytes for "
+      "SSRC %u, payload type %u", gst_buffer_get_size (recovered), ssrc, pt);
+
+  return recovered;
+}
+
+/*
+ * Find the source that an RTP packet received on flow_id belongs to, for its
+ * reorder window. RTCP packets don't go through one.
+ */
+static RtpQuicDemuxSrc *
+rtp_quic_demux_reorder_src (GstRtpQuicDemux *roqdemux, guint64 flow_id,
+    GstBuffer *buf)
+{
+  guint8 header[12];
+  guint32 ssrc;
+  guint8 pt;
+
+  if (flow_id != roqdemux->rtp_flow_id ||
+      gst_buffer_extract (buf, 0, header, 12) < 12) {
+    return NULL;
+  }
+
+  pt = header[1] & 0x7f;
+  if (pt >= 64 && pt <= 95) {
+    /* RFC 5761 - Probably RTCP */
+    return NULL;
+  }
+
+  ssrc = ntohl (GST_READ_UINT32_BE (header + 8));
+
+  return rtp_quic_demux_lookup_rtp_src (roqdemux, ssrc, pt);
+}
+
+/*
+ * Find the clock rate of the RTP packets going out of pad from its caps, or
+ * failing that the caps that downstream accepts. Returns 0 if unknown.
+ */
+static gint
+rtp_quic_demux_pad_clock_rate (GstPad *pad)
+{
+  GstCaps *caps;
+  gint clock_rate = 0;
+
+  caps = gst_pad_get_current_caps (pad);
+  if (caps == NULL) {
+    caps = gst_pad_peer_query_caps (pad, NULL);
+  }
+
+  if (caps == NULL) {
+    return 0;
+  }
+
+  if (!gst_caps_is_empty (caps) && !gst_caps_is_any (caps)) {
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate",
+        &clock_rate);
+  }
+
+  gst_caps_unref (caps);
+
+  return clock_rate;
+}
+
+static GstStructure *
+rtp_quic_demux_build_stats (GstRtpQuicDemux *roqdemux)
+{
+  GstStructure *s;
+  GValue flows = G_VALUE_INIT;
+  GHashTableIter iter;
+  gpointer key;
+
+  g_value_init (&flows, GST_TYPE_ARRAY);
+
+  GST_OBJECT_LOCK (roqdemux);
+  g_hash_table_iter_init (&iter, roqdemux->flow_stats);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    RtpQuicDemuxFlowStats *stats = key;
+    GValue v = G_VALUE_INIT;
+    gint64 expected;
+    guint64 lost = 0;
+    guint64 jitter = 0;
+
+    expected = (gint64) stats->cycles + stats->max_seq - stats->base_seq + 1;
+    if (expected > (gint64) stats->received) {
+      lost = expected - stats->received;
+    }
 
-      GST_DEBUG_OBJECT (roqdemux, "Mapped RT%sP src pad for flow ID %lu, "
-          "SSRC %u, PT %u with padname %s linked to ghost pad %p",
-          (pt > 127)?(""):("C"), flow_id, ssrc, pt, GST_PAD_NAME (srcpad),
-          gpad);
+    if (stats->clock_rate > 0) {
+      jitter = (guint64) (stats->jitter * GST_SECOND / stats->clock_rate);
     }
 
-    gst_object_unref (peer);
+    g_value_init (&v, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&v, gst_structure_new ("rtp-quic-demux-flow-stats",
+        "flow-id", G_TYPE_UINT64, stats->flow_id,
+        /* Keyed in host order, so swap back to the SSRC on the wire */
+        "ssrc", G_TYPE_UINT, ntohl (stats->ssrc),
+        "packets-received", G_TYPE_UINT64, stats->received,
+        "packets-expected", G_TYPE_UINT64, (guint64) MAX (expected, 0),
+        "packets-lost", G_TYPE_UINT64, lost,
+        "loss-rate", G_TYPE_DOUBLE,
+        (expected > 0)?((gdouble) lost / expected):(0.0),
+        "packets-reordered", G_TYPE_UINT64, stats->reordered,
+        "max-reorder-depth", G_TYPE_UINT, (guint) stats->max_reorder_depth,
+        "burst-loss-1", G_TYPE_UINT64, stats->bursts[0],
+        "burst-loss-2", G_TYPE_UINT64, stats->bursts[1],
+        "burst-loss-3-4", G_TYPE_UINT64, stats->bursts[2],
+        "burst-loss-5-8", G_TYPE_UINT64, stats->bursts[3],
+        "burst-loss-9-16", G_TYPE_UINT64, stats->bursts[4],
+        "burst-loss-17-plus", G_TYPE_UINT64, stats->bursts[5],
+        "clock-rate", G_TYPE_INT, stats->clock_rate,
+        "jitter", G_TYPE_UINT64, jitter,
+        NULL));
+    gst_value_array_append_and_take_value (&flows, &v);
   }
 
-  return srcpad;
+  s = gst_structure_new ("rtp-quic-demux-stats",
+      "datagrams-recv", G_TYPE_UINT64, roqdemux->datagrams_received, NULL);
+  GST_OBJECT_UNLOCK (roqdemux);
+
+  gst_structure_take_value (s, "flows", &flows);
+
+  return s;
+}
+
+/*
+ * Account for an RTP packet received in a datagram on flow_id, from the
+ * sequence number and timestamp read along with its SSRC. Posts the stats
+ * as an element message if stats-interval has passed since the last one.
+ */
+static void
+rtp_quic_demux_flow_stats_update (GstRtpQuicDemux *roqdemux, GstPad *pad,
+    guint64 flow_id, guint32 ssrc, guint16 seq, guint32 rtp_ts)
+{
+  RtpQuicDemuxFlowStats key;
+  RtpQuicDemuxFlowStats *stats;
+  gint64 now = g_get_monotonic_time ();
+  gboolean post = FALSE;
+
+  key.flow_id = flow_id;
+  key.ssrc = ssrc;
+
+  GST_OBJECT_LOCK (roqdemux);
+  stats = g_hash_table_lookup (roqdemux->flow_stats, &key);
+  if (stats == NULL) {
+    stats = g_new0 (RtpQuicDemuxFlowStats, 1);
+    stats->flow_id = flow_id;
+    stats->ssrc = ssrc;
+    stats->base_seq = seq;
+    stats->max_seq = seq;
+
+    g_hash_table_add (roqdemux->flow_stats, stats);
+  } else {
+    gint16 delta = (gint16) (seq - stats->max_seq);
+
+    if (delta > 0) {
+      guint burst = delta - 1;
+
+      if (seq < stats->max_seq) {
+        stats->cycles += 65536;
+      }
+
+      /* g_bit_storage (0) is 1, so single losses need a bucket of their own */
+      if (burst > 0) {
+        stats->bursts[(burst == 1) ? 0 : MIN (g_bit_storage (burst - 1),
+                RTP_QUIC_DEMUX_BURST_BUCKETS - 1)]++;
+      }
+
+      stats->max_seq = seq;
+    } else if (delta < 0) {
+      stats->reordered++;
+      stats->max_reorder_depth = MAX (stats->max_reorder_depth,
+          (guint16) -delta);
+    }
+  }
+
+  stats->received++;
+
+  /* Keep asking every so often until downstream settles on a clock rate.
+   * The caps query can't be made with the object lock held, but entries stay
+   * in the table until finalize so stats is still valid afterwards. */
+  if (stats->clock_rate == 0 && (stats->received & 0xff) == 1) {
+    gint clock_rate;
+
+    GST_OBJECT_UNLOCK (roqdemux);
+    clock_rate = rtp_quic_demux_pad_clock_rate (pad);
+    GST_OBJECT_LOCK (roqdemux);
+
+    if (stats->clock_rate == 0) {
+      stats->clock_rate = clock_rate;
+    }
+  }
+
+  if (stats->clock_rate > 0) {
+    guint32 arrival = (guint32) gst_util_uint64_scale_int ((guint64) now,
+        stats->clock_rate, G_USEC_PER_SEC);
+    gint32 transit = (gint32) (arrival - rtp_ts);
+
+    if (stats->have_transit) {
+      gint32 d = transit - stats->last_transit;
+
+      stats->jitter += (ABS ((gdouble) d) - stats->jitter) / 16.0;
+    }
+
+    stats->last_transit = transit;
+    stats->have_transit = TRUE;
+  }
+
+  if (roqdemux->stats_interval > 0 && now >= roqdemux->stats_next_post) {
+    roqdemux->stats_next_post = now +
+        (gint64) roqdemux->stats_interval * G_TIME_SPAN_MILLISECOND;
+    post = TRUE;
+  }
+  GST_OBJECT_UNLOCK (roqdemux);
+
+  if (post) {
+    gst_element_post_message (GST_ELEMENT (roqdemux),
+        gst_message_new_element (GST_OBJECT (roqdemux),
+            rtp_quic_demux_build_stats (roqdemux)));
+  }
+}
+
+/*
+ * Push the frames that have been collected for a source pad as a single buffer
+ * list.
+ */
+static GstFlowReturn
+rtp_quic_demux_push_pending (GstRtpQuicDemux *roqdemux, GstPad **target_pad,
+    GstBufferList **list)
+{
+  GstFlowReturn rv = GST_FLOW_OK;
+
+  if (*target_pad == NULL) {
+    return rv;
+  }
+
+  if (gst_buffer_list_length (*list) == 0) {
+    /* Everything was held back or dropped */
+    gst_buffer_list_unref (*list);
+    *target_pad = NULL;
+    *list = NULL;
+    return rv;
+  }
+
+  GST_DEBUG_OBJECT (roqdemux, "Pushing list of %u buffers on pad %p",
+      gst_buffer_list_length (*list), *target_pad);
+
+  rv = gst_pad_push_list (*target_pad, *list);
+
+  GST_DEBUG_OBJECT (roqdemux, "Push result: %d", rv);
+
+  *target_pad = NULL;
+  *list = NULL;
+
+  return rv;
 }
 
 /* chain function
@@ -927,7 +1870,9 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
   RtpQuicDemuxStream *stream = NULL;
   GstQuicLibDatagramMeta *datagram_meta = NULL;
   guint64 flow_id;
-  GstFlowReturn rv = GST_FLOW_ERROR;
+  GstBufferList *out = NULL;
+  GstPad *out_pad = NULL;
+  GstFlowReturn rv = GST_FLOW_OK;
 
   roqdemux = GST_RTPQUICDEMUX (parent);
 
@@ -1002,6 +1947,8 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
     GstPad *target_pad = NULL;
     GstBuffer *target_buffer = NULL;
     GstEvent *segment_event;
+    RtpQuicDemuxSrc *reorder_src;
+    gboolean recovered = FALSE;
 
     GST_TRACE_OBJECT (roqdemux, "Entry to while loop, buffer size %lu",
         gst_buffer_get_size (buf));
@@ -1016,7 +1963,7 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
         if (stream->buf) {
           gst_buffer_unref (buf);
         }
-        return GST_FLOW_OK;
+        break;
       }
 
       /*
@@ -1051,7 +1998,7 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
           buf = NULL;
 
           /* Haven't seen the end of this frame yet so wait for the next part */
-          if (target_buffer == NULL) return GST_FLOW_OK;
+          if (target_buffer == NULL) break;
 
           GST_DEBUG_OBJECT (roqdemux,
               "Reception of frame of length %lu bytes complete",
@@ -1090,7 +2037,7 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
           stream->expected_payloadlen = (guint64) length;
           gst_buffer_unref (buf);
           buf = NULL;
-          return GST_FLOW_OK;
+          break;
         }       
       } else {
         /* 
@@ -1101,18 +2048,36 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
 
         flow_id = varint;
 
-        if (flow_id != roqdemux->rtp_flow_id &&
+        if (roqdemux->fec_flow_id != -1 &&
+            flow_id == (guint64) roqdemux->fec_flow_id) {
+          /* Repair packets only go downstream as the packet they rebuild */
+          target_buffer = rtp_quic_demux_fec_recover (roqdemux, buf);
+          gst_buffer_unref (buf);
+          buf = NULL;
+
+          if (target_buffer == NULL) {
+            break;
+          }
+
+          recovered = TRUE;
+          flow_id = roqdemux->rtp_flow_id;
+        } else if (flow_id != roqdemux->rtp_flow_id &&
             flow_id != roqdemux->rtcp_flow_id) {
           GST_WARNING_OBJECT (roqdemux, "Received unexpected flow ID %lu, "
               "expected RTP flow ID %lu, RTCP flow ID %lu", flow_id,
               roqdemux->rtp_flow_id, roqdemux->rtcp_flow_id);
-          return GST_FLOW_ERROR;
+          gst_buffer_unref (buf);
+          rv = GST_FLOW_ERROR;
+          break;
         }
       }
 
-      if (length < gst_buffer_get_size (buf)) {
-        target_buffer = gst_buffer_copy_region (buf, GST_BUFFER_COPY_MEMORY, 0,
-            length);
+      if (target_buffer != NULL) {
+        /* Rebuilt from a repair packet */
+      } else if (length < gst_buffer_get_size (buf)) {
+        /* Keeping the QUIC stream or datagram meta it arrived with */
+        target_buffer = gst_buffer_copy_region (buf,
+            GST_BUFFER_COPY_MEMORY | GST_BUFFER_COPY_METADATA, 0, length);
         gst_buffer_resize (buf, length, -1);
       } else {
         target_buffer = buf;
@@ -1136,12 +2101,16 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
     } else {
       GstMapInfo map;
       guint8 payload_type;
+      guint16 seq;
+      guint32 rtp_ts;
       guint32 ssrc;
       GstClockTime offset;
 
       gst_buffer_map (target_buffer, &map, GST_MAP_READ);
 
       payload_type = map.data[1];
+      seq = GST_READ_UINT16_BE (map.data + 2);
+      rtp_ts = GST_READ_UINT32_BE (map.data + 4);
       ssrc = ntohl ((map.data[8] << 24) + (map.data[9] << 16) +
           (map.data[10] << 8) + (map.data[11]));
 
@@ -1160,17 +2129,49 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
 
       if (!stream) {
         roqdemux->dg_offset = offset;
+
+        if (roqdemux->fec_flow_id != -1 && target_pad != NULL &&
+            flow_id == roqdemux->rtp_flow_id) {
+          rtp_quic_demux_fec_store (roqdemux, ssrc, payload_type,
+              target_buffer);
+        }
+
+        /* Packets rebuilt from FEC were lost on the network all the same */
+        if (target_pad != NULL && !recovered &&
+            flow_id == roqdemux->rtp_flow_id) {
+          rtp_quic_demux_flow_stats_update (roqdemux, target_pad, flow_id,
+              ssrc, seq, rtp_ts);
+        }
       }
     }
 
     if (G_UNLIKELY (!target_pad)) {
       GST_ERROR_OBJECT (roqdemux,
           "Couldn't map buffer for flow ID %ld to target pad", flow_id);
-      return GST_FLOW_ERROR;
+      gst_buffer_unref (target_buffer);
+      if (buf) {
+        gst_buffer_unref (buf);
+      }
+      rv = GST_FLOW_ERROR;
+      break;
     }
 
     g_assert (gst_pad_is_linked (target_pad));
 
+    /*
+     * Consecutive frames for the same source pad are collected into a list so
+     * that they can be pushed downstream in one go.
+     */
+    if (target_pad != out_pad) {
+      GstFlowReturn push_rv = rtp_quic_demux_push_pending (roqdemux, &out_pad,
+          &out);
+      if (rv == GST_FLOW_OK) {
+        rv = push_rv;
+      }
+      out_pad = target_pad;
+      out = gst_buffer_list_new ();
+    }
+
     segment_event = gst_pad_get_sticky_event (target_pad, GST_EVENT_SEGMENT, 0);
     if (segment_event == NULL) {
       GstSegment *segment = g_new0 (GstSegment, 1);
@@ -1181,7 +2182,7 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
       gst_event_unref (segment_event);
     }
 
-    GST_DEBUG_OBJECT (roqdemux, "Pushing buffer of size %lu bytes (consisting "
+    GST_DEBUG_OBJECT (roqdemux, "Queueing buffer of size %lu bytes (consisting "
         "of %u blocks of GstMemory and refcount %d) with PTS %" GST_TIME_FORMAT
         ", DTS %" GST_TIME_FORMAT " on pad %p",
         gst_buffer_get_size (target_buffer),
@@ -1190,13 +2191,23 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
         GST_TIME_ARGS (target_buffer->pts), GST_TIME_ARGS (target_buffer->dts),
         target_pad);
 
+    reorder_src = NULL;
+    if (roqdemux->reorder_latency > 0 || roqdemux->drop_duplicates) {
+      reorder_src = rtp_quic_demux_reorder_src (roqdemux,
+          (stream)?(stream->flow_id):(flow_id), target_buffer);
+    }
+
     if (stream && stream_meta->final) {
       g_hash_table_remove (roqdemux->quic_streams, &stream_meta->stream_id);
     }
 
-    rv = gst_pad_push (target_pad, target_buffer);
-
-    GST_DEBUG_OBJECT (roqdemux, "Push result: %d", rv);
+    if (reorder_src != NULL && reorder_src->src == target_pad) {
+      g_mutex_lock (&roqdemux->reorder_lock);
+      rtp_quic_demux_src_reorder (roqdemux, reorder_src, target_buffer, out);
+      g_mutex_unlock (&roqdemux->reorder_lock);
+    } else {
+      gst_buffer_list_add (out, target_buffer);
+    }
 
     if (stream_meta) {
       roqdemux->stream_frames_received++;
@@ -1205,6 +2216,14 @@ gst_rtp_quic_demux_chain (GstPad *pad, GstObject *parent, GstBuffer *buf)
     }
   }
 
+  if (out_pad) {
+    GstFlowReturn push_rv = rtp_quic_demux_push_pending (roqdemux, &out_pad,
+        &out);
+    if (rv == GST_FLOW_OK) {
+      rv = push_rv;
+    }
+  }
+
   return rv;
 }
 
@@ -1559,6 +2578,23 @@ void rtp_quic_demux_pad_unlinked (GstPad *self, GstPad *peer,
   GST_DEBUG_OBJECT (roqdemux, "Pad %p unlinked from peer %p", self, peer);
 }
 
+static guint
+rtp_quic_demux_flow_stats_hash (gconstpointer key)
+{
+  const RtpQuicDemuxFlowStats *stats = key;
+
+  return g_int64_hash (&stats->flow_id) ^ stats->ssrc;
+}
+
+static gboolean
+rtp_quic_demux_flow_stats_equal (gconstpointer a, gconstpointer b)
+{
+  const RtpQuicDemuxFlowStats *stats_a = a;
+  const RtpQuicDemuxFlowStats *stats_b = b;
+
+  return stats_a->flow_id == stats_b->flow_id && stats_a->ssrc == stats_b->ssrc;
+}
+
 void
 rtp_quic_demux_ssrc_hash_destroy (GHashTable *pts)
 {
@@ -1570,6 +2606,13 @@ rtp_quic_demux_pt_hash_destroy (RtpQuicDemuxSrc *src)
 {
   gst_element_remove_pad (GST_ELEMENT (gst_pad_get_parent (src->src)),
       src->src);
+  if (src->fec) {
+    gst_roq_fec_decoder_clear (src->fec);
+    g_free (src->fec);
+  }
+  if (src->reorder) {
+    rtp_quic_demux_reorder_free (src->reorder);
+  }
   g_free (src);
 }
 
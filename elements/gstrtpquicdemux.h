@@ -55,15 +55,89 @@
 
 G_BEGIN_DECLS
 
+/*
+ * Number of RTP sequence numbers that the reorder window spans. Packets
+ * further ahead than this flush the window instead of waiting in it.
+ */
+#define RTP_QUIC_DEMUX_REORDER_SLOTS 128
+#define RTP_QUIC_DEMUX_REORDER_MASK (RTP_QUIC_DEMUX_REORDER_SLOTS - 1)
+
+struct _RtpQuicDemuxReorderSlot
+{
+  GstBuffer *buf;
+  guint16 seq;
+  gint64 arrival;
+};
+
+typedef struct _RtpQuicDemuxReorderSlot RtpQuicDemuxReorderSlot;
+
+/*
+ * Puts the RTP packets of one SSRC and payload type back in sequence number
+ * order, and remembers which sequence numbers have gone downstream so that
+ * duplicates can be dropped. Arrival times are in monotonic microseconds.
+ * Windows that are holding packets are on the demux's reorder_waiting list.
+ */
+struct _RtpQuicDemuxReorder
+{
+  gboolean started;
+  guint16 next_seq;
+  guint held;
+  gboolean waiting;
+  RtpQuicDemuxReorderSlot slots[RTP_QUIC_DEMUX_REORDER_SLOTS];
+
+  /* Sequence numbers sent downstream, with bit 16 set. 0 for none */
+  guint32 delivered[RTP_QUIC_DEMUX_REORDER_SLOTS];
+};
+
+typedef struct _RtpQuicDemuxReorder RtpQuicDemuxReorder;
+
 struct _RtpQuicDemuxSrc
 {
   GstPad *src;
   GstClockTime offset;
   gboolean last_qos_overflow;
+
+  /* Packets received in datagrams, kept for FEC recovery */
+  struct _GstRoQFecDecoder *fec;
+
+  RtpQuicDemuxReorder *reorder;
 };
 
 typedef struct _RtpQuicDemuxSrc RtpQuicDemuxSrc;
 
+/*
+ * Burst loss lengths are counted in buckets of 1, 2, 3-4, 5-8, 9-16 and 17 or
+ * more missing sequence numbers.
+ */
+#define RTP_QUIC_DEMUX_BURST_BUCKETS 6
+
+/*
+ * Reception statistics for the RTP packets of one SSRC received in datagrams
+ * on one flow, kept as in RFC 3550 appendix A. The jitter is in RTP timestamp
+ * units, and is only measured once the clock rate is known.
+ */
+struct _RtpQuicDemuxFlowStats
+{
+  guint64 flow_id;
+  guint32 ssrc;
+
+  guint64 received;
+  guint16 base_seq;
+  guint16 max_seq;
+  guint32 cycles;
+
+  guint64 reordered;
+  guint16 max_reorder_depth;
+  guint64 bursts[RTP_QUIC_DEMUX_BURST_BUCKETS];
+
+  gint clock_rate;
+  gboolean have_transit;
+  gint32 last_transit;
+  gdouble jitter;
+};
+
+typedef struct _RtpQuicDemuxFlowStats RtpQuicDemuxFlowStats;
+
 #define RTPQUICDEMUX_TYPE_STREAM rtp_quic_demux_stream_get_type()
 G_DECLARE_FINAL_TYPE (RtpQuicDemuxStream, rtp_quic_demux_stream, RTPQUICDEMUX,
     STREAM, GObject)
@@ -98,6 +172,7 @@ struct _GstRtpQuicDemux
 
   gint64 rtp_flow_id;
   gint64 rtcp_flow_id;
+  gint64 fec_flow_id;
 
   /*
    * GHashTable <guint> { // SSRCs
@@ -122,6 +197,17 @@ struct _GstRtpQuicDemux
    */
   GHashTable *quic_streams;
 
+  /*
+   * GHashTable <RtpQuicDemuxFlowStats> { // Flow ID and SSRC
+   *    RtpQuicDemuxFlowStats;
+   * }
+   *
+   * Only added to by the streaming thread, with the object lock held.
+   */
+  GHashTable *flow_stats;
+  guint stats_interval;
+  gint64 stats_next_post;
+
   GList *pending_req_sinks;
 
   GstPad *datagram_sink;
@@ -130,8 +216,29 @@ struct _GstRtpQuicDemux
   guint64 uni_stream_type;
   gboolean match_uni_stream_type;
 
+  GstClockTime reorder_latency;
+  gboolean drop_duplicates;
+
+  /*
+   * Held packets are let go by a timer thread once they have waited
+   * reorder-latency, whether or not anything else arrives. The lock protects
+   * every source's reorder window, the list of sources that are holding
+   * packets and the monotonic time the thread will next wake at.
+   */
+  GMutex reorder_lock;
+  GCond reorder_cond;
+  GThread *reorder_thread;
+  gboolean reorder_running;
+  gint64 reorder_next_wake;
+  GList *reorder_waiting;
+
   guint64 stream_frames_received;
   guint64 datagrams_received;
+  guint64 fec_packets_received;
+  guint64 fec_packets_recovered;
+  guint64 packets_reordered;
+  guint64 duplicates_dropped;
+  guint64 reorder_gaps_skipped;
 };
 
 G_END_DECLS
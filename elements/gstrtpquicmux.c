@@ -78,6 +78,32 @@
  * When the stream-boundary property is set to "single", each unique payload
  * type and SSRC will be sent on a single stream.
  *
+ * When the stream-boundary property is set to "duration", the rtpquicmux
+ * element starts a new stream at the first frame boundary after the
+ * stream-duration property's worth of media running time has been sent on the
+ * current one. This bounds head-of-line blocking for long-GOP content while
+ * opening far fewer streams than a stream per frame.
+ *
+ * When the stream-boundary property is set to "auto", the rtpquicmux element
+ * starts out with a single stream, and every auto-interval asks quicmux for
+ * the connection statistics with a "roq-connection-stats" custom query. If the
+ * packet loss since the last check is above auto-loss-high, or above
+ * auto-loss-low with an RTT above auto-rtt-high, it moves one step from single
+ * to GOP to frame boundaries. If loss is below auto-loss-low and RTT below
+ * auto-rtt-high, it moves one step back. A step is only taken once auto-hold
+ * checks in a row have agreed. The boundary in use can be read from the
+ * auto-boundary property. quicmux doesn't answer the "roq-connection-stats"
+ * query yet, so until it does the auto mode stays with a single stream and
+ * warns once that it can't do any better.
+ *
+ * Whatever the stream boundary, the element also starts a new stream at a
+ * frame boundary if the next frame might otherwise take the stream past the
+ * peer's per-stream flow control limit, judging by the largest frame seen so
+ * far. The limit is asked of quicmux with a "roq-max-stream-data" custom query
+ * as streams are opened, at most once a second until it answers. Until then,
+ * the max-stream-bytes property is used instead. quicmux doesn't answer this
+ * query yet, so for now max-stream-bytes is the only limit applied.
+ *
  * It is recommended that when sending RTP over QUIC streams, that the RTP
  * payloader does not perform any segmenting of individual frames, and instead
  * payloads them as a single large RTP packet. This improves efficiency, as the
@@ -91,15 +117,162 @@
  * controls how many frames or GOPs are sent on each individual stream. It
  * effectively works as a multiplier.
  *
+ * Opening a new QUIC stream means adding, linking and activating a new source
+ * pad, which can be costly when a stream is opened for every frame. Setting the
+ * stream-pool-size property keeps that many stream pads opened and linked to
+ * the quicmux element ahead of time. New RoQ streams take a pad from this pool,
+ * which is then refilled in the background.
+ *
  * When configured to send RTP and RTCP packets over QUIC DATAGRAM frames, each
  * RTP and RTCP packet shall be mapped to exactly one QUIC DATAGRAM frame, and
- * prefaced with an RTP-over-QUIC flow identifier.
+ * prefaced with an RTP-over-QUIC flow identifier. The largest datagram payload
+ * the connection can carry is asked of quicmux with a
+ * "roq-max-datagram-payload" custom query, falling back to the datagram-mtu
+ * property if quicmux doesn't answer. The query is repeated at most once a
+ * second as datagrams are sent, as the answer can change while the connection
+ * settles, and the answer is forgotten when the datagram pad is linked again or
+ * the element goes back to READY. If the element upstream of a sink pad
+ * has an mtu property, such as an RTP payloader, that is too large, a warning
+ * is logged when the first packet is sent. If the fit-payloader-mtu property
+ * is set, the mtu is lowered to fit instead. Packets that still don't fit are
+ * dropped with a warning and counted by the datagrams-oversized property, as
+ * they would otherwise be lost without trace.
+ *
+ * Setting the fec-block-size property protects the RTP packets sent in
+ * datagrams with forward error correction. After every fec-block-size packets
+ * of an SSRC, and after the last packet of every frame, an XOR repair packet
+ * is sent in a datagram on the flow ID given by the fec-flow-id property, from
+ * which rtpquicdemux can rebuild any one packet of the block that was lost.
+ * The overhead is one packet in every fec-block-size, plus one per frame.
+ * Room for the repair packet's header is left when fitting the payloader's
+ * mtu, and fec-packets-sent counts the repair packets.
+ *
+ * Pushing each datagram to quicmux on its own leaves it no chance to coalesce
+ * them. Setting the datagram-batch-max-delay property holds back the RTP
+ * datagrams of each video frame, along with their FEC repair packets, until
+ * the packet with the marker bit set, and then pushes them as one buffer list.
+ * A batch is pushed early if a packet from the next frame turns up first, or
+ * if a packet arrives once it has been held for longer than
+ * datagram-batch-max-delay. There is no timer behind this: the delay is only
+ * checked as packets arrive, so if the last packet of a frame is lost
+ * upstream, the batch waits for the next packet or for EOS. Audio packets,
+ * and packets that are paced, are never held back. The datagram-batches
+ * property counts the lists pushed.
+ *
+ * When the header-headroom property is set, the element answers allocation
+ * queries from upstream with a memory prefix large enough for the RTP-over-QUIC
+ * headers. Buffers allocated with that prefix have their headers
+ * written in place, so they reach the quicmux element as a single memory.
+ * Headers for all other buffers are prepended as small memories taken from a
+ * recycling allocator. The header-pool-hits and header-pool-misses properties
+ * count how many of those were served from recycled chunks.
+ *
+ * If quicmux reports that a QUIC stream is blocked by flow control, the buffer
+ * is normally lost. Setting the send-queue-max-bytes property gives each RoQ
+ * stream a send queue of that size instead, which holds the blocked buffer and
+ * everything after it and retries them as new buffers arrive. When the queue
+ * is full, the send-queue-policy property decides whether to drop the oldest
+ * whole frame, drop the oldest frame that no others depend on, or block
+ * upstream until the QUIC stream takes more data. The send-queue-depth,
+ * send-queue-max-latency and send-queue-dropped properties report how the
+ * queues are coping.
+ *
+ * Setting the max-frame-age property makes the element drop any frame whose
+ * running time is already more than that far behind the pipeline clock when
+ * its first packet arrives, as it would be too late to be played out anyway.
+ * Frames are always dropped whole, up to and including the packet with the
+ * marker bit. The stale-frames-dropped and stale-bytes-dropped properties count
+ * what has been saved.
  *
  * If you want to send some RTP packets over QUIC streams and some over QUIC
  * DATAGRAM frames, you will need to have two instances of rtpquicmux - one
  * configured to send over QUIC streams ( use-datagram = false ) and another
  * configured to send over QUIC DATAGRAM frames ( use-datagram = true ).
  *
+ * Alternatively, setting the hybrid-mapping property on an instance sending
+ * over QUIC streams splits a single RTP stream by how important each packet
+ * is. Packets for frames that other frames depend on, and codec headers, are
+ * sent reliably on QUIC streams as usual. Packets for delta frames that fit
+ * within the datagram-mtu property along with their flow identifier are sent
+ * in QUIC DATAGRAM frames, so that losing one doesn't hold up the rest.
+ *
+ * When the receiver sends STOP_SENDING for a stream, the rest of the frame is
+ * cancelled and the next frame starts on a new stream. If the
+ * datagram-fallback-threshold property is set and that many STOP_SENDINGs
+ * arrive within datagram-fallback-window, the RoQ stream instead switches to
+ * sending its frames in QUIC DATAGRAM frames, so that a congested receiver gets
+ * the newest frames as quickly as possible. Packets that don't fit within
+ * datagram-mtu still go on a stream. Once datagram-fallback-quiet has passed,
+ * it switches back to QUIC streams at the next frame.
+ *
+ * The frames that follow a cancelled frame usually can't be decoded without
+ * it. Setting the request-keyframe property sends a GstForceKeyUnit event
+ * upstream whenever a frame is cancelled, at most once every
+ * keyframe-request-interval. Setting wait-for-keyframe as well drops every
+ * delta unit after the cancelled frame until a keyframe arrives, so that no
+ * bandwidth is spent on frames that can't be decoded.
+ *
+ * By default every QUIC stream is equal in the eyes of quicmux, so a large
+ * keyframe on one flow can hold up audio on another. Setting the priority-map
+ * property sends a sticky "roq-stream-priority" custom event down each new
+ * stream pad, carrying an "urgency" (0 to 7, lower is more urgent) and an
+ * "incremental" flag in the style of RFC 9218, along with the "flow-id". The
+ * urgency is looked up in the map by "flow-<flow id>", then by media type and
+ * frame type (such as "video-keyframe" or "video-delta"), then by media type
+ * alone, then by "default". The "incremental" field of the map applies to all
+ * streams. For example:
+ *
+ * |[
+ * priority-map="map, audio=(uint)1, video-keyframe=(uint)2, video-delta=(uint)4"
+ * ]|
+ *
+ * For codecs with temporal or spatial layers, such as VP9 or AV1 SVC and H.264
+ * with temporal scalability, setting the frame-marking-ext-id property to the
+ * ID of the frame marking RTP header extension (draft-ietf-avtext-framemarking)
+ * sends each enhancement layer on QUIC streams of its own. A STOP_SENDING on an
+ * enhancement layer stream then only cancels that layer's frame, never the base
+ * layer. Instead of asking for a keyframe, a cancelled enhancement layer picks
+ * up again at the next independent or base layer sync frame, if
+ * wait-for-keyframe is set. The end of frame bit is treated like the RTP
+ * marker, so spatial layers within a superframe each get their own frame. The
+ * priority-map is checked for "<media>-enhancement" before the frame type when
+ * opening a stream for an enhancement layer.
+ *
+ * A single rtpquicmux can carry several RTP sessions, all sharing the same
+ * quicmux and datagram pad. The session of a sink pad is the first number in
+ * its name, as in rtp_sink_<session_idx>_<ssrc>_<payload_type>. Session 0 is
+ * sent with the rtp-flow-id and rtcp-flow-id properties, and every other
+ * session gets its own flow IDs, either from the session-flow-map property or
+ * picked so as not to clash with any other flow. For example:
+ *
+ * |[
+ * session-flow-map="map, session-1=(gint64)4, session-1-rtcp=(gint64)5"
+ * ]|
+ *
+ * Sink pads whose caps carry the same session, SSRC and payload type feed the
+ * same RoQ stream, which is kept until the last of those pads is released.
+ *
+ * Setting the pacing property spreads the packets of each frame out over time,
+ * instead of pushing a large keyframe into quicmux as one burst. The packets of
+ * each RoQ stream are spaced at pacing-bitrate, or at the pacing rate that
+ * quicmux reports in its connection statistics if that is 0, but a frame is
+ * always out within pacing-frame-fraction of the frame interval. The buffers
+ * are pushed from a pacing thread driven by a timer wheel, so the streaming
+ * threads never sleep. Pacing and the send queue are exclusive: when
+ * send-queue-max-bytes is set, packets sent on QUIC streams go through the
+ * send queue and aren't paced. quicmux doesn't report a pacing rate yet, so
+ * without pacing-bitrate the packets aren't spread out at all, and the element
+ * warns about it.
+ *
+ * For packet-level visibility, the roqtracer tracer records every packet
+ * leaving rtpquicmux and rtpquicdemux into a ring buffer that is dumped by a
+ * separate thread, so that the streaming threads never decode packets for
+ * logging:
+ *
+ * |[
+ * GST_TRACERS="roqtracer(file=/tmp/roq.trace)" gst-launch-1.0 ...
+ * ]|
+ *
  * <refsect2>
  * <title>Example launch line</title>
  * |[
@@ -129,10 +302,14 @@
 
 #include "gstrtpquicmux.h"
 #include "gstroqflowidmanager.h"
+#include "gstroqheaderallocator.h"
+#include "gstroqpacer.h"
+#include "gstroqfec.h"
 #include <gstquiccommon.h>
 
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_rtp_quic_mux_debug);
 #define GST_CAT_DEFAULT gst_rtp_quic_mux_debug
@@ -145,6 +322,12 @@ gst_rtp_quic_mux_stream_boundary_get_type (void)
       {STREAM_BOUNDARY_FRAME, "All RTP packets for a frame on a stream", "frame"},
       {STREAM_BOUNDARY_GOP, "All RTP packets for a GOP on a stream", "gop"},
       {STREAM_BOUNDARY_SINGLE_STREAM, "All RTP packets on a single stream", "single"},
+      {STREAM_BOUNDARY_DURATION,
+          "All RTP packets for a fixed duration of frames on a stream",
+          "duration"},
+      {STREAM_BOUNDARY_AUTO,
+          "Choose between frame, GOP and single from connection statistics",
+          "auto"},
       {0, NULL, NULL}
   };
 
@@ -157,6 +340,30 @@ gst_rtp_quic_mux_stream_boundary_get_type (void)
   return type;
 }
 
+GType
+gst_rtp_quic_mux_send_queue_policy_get_type (void)
+{
+  static GType type = 0;
+  static const GEnumValue send_queue_policies[] = {
+      {SEND_QUEUE_POLICY_DROP_OLDEST_FRAME,
+          "Drop the oldest whole frame in the queue", "drop-oldest-frame"},
+      {SEND_QUEUE_POLICY_DROP_NON_REFERENCE,
+          "Drop the oldest frame that other frames don't depend on",
+          "drop-non-reference"},
+      {SEND_QUEUE_POLICY_BLOCK_UPSTREAM,
+          "Block upstream until the queue has room", "block-upstream"},
+      {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = g_enum_register_static ("GstRtpQuicMuxSendQueuePolicy",
+        send_queue_policies);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
 const gchar *
 _rtp_quic_mux_stream_boundary_as_string (GstRtpQuicMuxStreamBoundary sb)
 {
@@ -164,16 +371,48 @@ _rtp_quic_mux_stream_boundary_as_string (GstRtpQuicMuxStreamBoundary sb)
     case STREAM_BOUNDARY_FRAME: return "FRAME";
     case STREAM_BOUNDARY_GOP: return "GOP";
     case STREAM_BOUNDARY_SINGLE_STREAM: return "SINGLE STREAM";
+    case STREAM_BOUNDARY_DURATION: return "DURATION";
+    case STREAM_BOUNDARY_AUTO: return "AUTO";
   }
   return "UNKNOWN";
 }
 
+/*
+ * The stream boundary currently in effect, resolving the auto mode to
+ * whichever boundary it has most recently chosen.
+ */
+static inline GstRtpQuicMuxStreamBoundary
+rtp_quic_mux_boundary (GstRtpQuicMux *roqmux)
+{
+  if (roqmux->stream_boundary == STREAM_BOUNDARY_AUTO) {
+    return g_atomic_int_get ((gint *) &roqmux->auto_boundary);
+  }
+  return roqmux->stream_boundary;
+}
+
 enum
 {
   PROP_0,
   PROP_RTPQUICMUX_ENUMS,
   PROP_STREAM_FRAMES_SENT,
   PROP_DATAGRAMS_SENT,
+  PROP_HEADER_POOL_HITS,
+  PROP_HEADER_POOL_MISSES,
+  PROP_STREAM_POOL_HITS,
+  PROP_SEND_QUEUE_DEPTH,
+  PROP_SEND_QUEUE_MAX_LATENCY,
+  PROP_SEND_QUEUE_DROPPED,
+  PROP_STALE_FRAMES_DROPPED,
+  PROP_STALE_BYTES_DROPPED,
+  PROP_DATAGRAM_FALLBACKS,
+  PROP_KEYFRAME_REQUESTS,
+  PROP_PEER_MAX_STREAM_DATA,
+  PROP_BUDGET_ROLLOVERS,
+  PROP_AUTO_BOUNDARY,
+  PROP_PACED_BUFFERS,
+  PROP_DATAGRAMS_OVERSIZED,
+  PROP_FEC_PACKETS_SENT,
+  PROP_DATAGRAM_BATCHES,
   PROP_MAX
 };
 
@@ -181,7 +420,8 @@ enum
  * GstRtpQuicMux!rtp_sink_%u_%u_%u:
  *
  * Sink template for receiving RTP packets to send in a RoQ session, in the
- * form rtp_sink_<session_idx>_<ssrc>_<payload_type>
+ * form rtp_sink_<session_idx>_<ssrc>_<payload_type>. Each session is sent on
+ * a flow ID of its own.
  */
 static GstStaticPadTemplate rtp_sink_factory =
     GST_STATIC_PAD_TEMPLATE ("rtp_sink_%u_%u_%u",
@@ -194,7 +434,8 @@ static GstStaticPadTemplate rtp_sink_factory =
  * GstRtpQuicMux!rtcp_sink_%u_%u_%u:
  *
  * Sink template for receiving RTCP packets to send in a RoQ session, in the
- * form rtp_sink_<session_idx>_<ssrc>_<payload_type>
+ * form rtcp_sink_<session_idx>_<ssrc>_<payload_type>. Each session is sent on
+ * a flow ID of its own.
  */
 static GstStaticPadTemplate rtcp_sink_factory =
     GST_STATIC_PAD_TEMPLATE ("rtcp_sink_%u_%u_%u",
@@ -223,6 +464,7 @@ G_DEFINE_TYPE (GstRtpQuicMux, gst_rtp_quic_mux, GST_TYPE_ELEMENT);
 GST_ELEMENT_REGISTER_DEFINE (rtp_quic_mux, "rtpquicmux", GST_RANK_NONE,
     GST_TYPE_RTPQUICMUX);
 
+static void gst_rtp_quic_mux_dispose (GObject *object);
 static void gst_rtp_quic_mux_finalize (GObject *object);
 static void gst_rtp_quic_mux_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec);
@@ -231,16 +473,36 @@ static void gst_rtp_quic_mux_get_property (GObject * object,
 
 static gboolean gst_rtp_quic_mux_sink_event (GstPad * pad,
     GstObject * parent, GstEvent * event);
+static gboolean gst_rtp_quic_mux_sink_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
 static GstFlowReturn gst_rtp_quic_mux_rtp_chain (GstPad * pad,
     GstObject * parent, GstBuffer * buf);
+static GstFlowReturn gst_rtp_quic_mux_rtp_chain_list (GstPad * pad,
+    GstObject * parent, GstBufferList * list);
 static GstFlowReturn gst_rtp_quic_mux_rtcp_chain (GstPad * pad,
     GstObject * parent, GstBuffer * buf);
+static GstFlowReturn rtp_quic_mux_send_queue_drain (GstRtpQuicMux *roqmux,
+    GstPad *sinkpad, RtpQuicMuxStream *stream);
+static void rtp_quic_mux_sink_push_fec (GstRtpQuicMux *roqmux,
+    RtpQuicMuxSink *sink, GstPad *pad, RtpQuicMuxStream *stream);
+static GstFlowReturn rtp_quic_mux_sink_push_batch (GstRtpQuicMux *roqmux,
+    RtpQuicMuxSink *sink);
+static void rtp_quic_mux_send_queue_wake (GstRtpQuicMux *roqmux);
+static void rtp_quic_mux_send_queue_set_flushing (GstRtpQuicMux *roqmux,
+    gboolean flushing);
 
 static GstPad * gst_rtp_quic_mux_request_new_pad (GstElement *element,
     GstPadTemplate *templ, const gchar *name, const GstCaps *caps);
 static void gst_rtp_quic_mux_release_pad (GstElement *element, GstPad *pad);
-
-void rtp_quic_mux_hash_value_destroy (GHashTable *pts);
+static GstStateChangeReturn gst_rtp_quic_mux_change_state (
+    GstElement *element, GstStateChange transition);
+
+void rtp_quic_mux_stream_free (RtpQuicMuxStream *stream);
+static void rtp_quic_mux_release_stream (GstRtpQuicMux *roqmux,
+    RtpQuicMuxSink *sink);
+static void rtp_quic_mux_reset_max_datagram_payload (GstRtpQuicMux *roqmux);
+static void rtp_quic_mux_datagram_pad_linked_callback (GstPad *self,
+    GstPad *peer, gpointer user_data);
 void rtp_quic_mux_remove_rtcp_pad (GstPad *pad);
 
 void rtp_quic_mux_pad_added_callback (GstElement *self, GstPad *pad,
@@ -258,6 +520,7 @@ gst_rtp_quic_mux_class_init (GstRtpQuicMuxClass * klass)
   gobject_class = (GObjectClass *) klass;
   gstelement_class = (GstElementClass *) klass;
 
+  gobject_class->dispose = GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_dispose);
   gobject_class->finalize = GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_finalize);
   gobject_class->set_property =
       GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_set_property);
@@ -268,6 +531,8 @@ gst_rtp_quic_mux_class_init (GstRtpQuicMuxClass * klass)
       GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_request_new_pad);
   gstelement_class->release_pad =
       GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_release_pad);
+  gstelement_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_rtp_quic_mux_change_state);
 
   gst_rtp_quic_mux_install_properties_map (gobject_class);
 
@@ -281,6 +546,98 @@ gst_rtp_quic_mux_class_init (GstRtpQuicMuxClass * klass)
           "A counter for the number of DATAGRAMs sent for a RoQ stream",
           0, G_MAXUINT64, 0, G_PARAM_READABLE));
 
+  g_object_class_install_property (gobject_class, PROP_HEADER_POOL_HITS,
+      g_param_spec_uint64 ("header-pool-hits", "Header pool hits",
+          "A counter of the number of RoQ header memories that were served "
+          "from recycled chunks", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_HEADER_POOL_MISSES,
+      g_param_spec_uint64 ("header-pool-misses", "Header pool misses",
+          "A counter of the number of RoQ header memories that needed a new "
+          "allocation", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_POOL_HITS,
+      g_param_spec_uint64 ("stream-pool-hits", "Stream pool hits",
+          "A counter of the number of QUIC streams that were started on a pad "
+          "taken from the stream pool", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_SEND_QUEUE_DEPTH,
+      g_param_spec_uint64 ("send-queue-depth", "Send queue depth",
+          "The number of bytes currently held in the send queues waiting for "
+          "blocked QUIC streams", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_SEND_QUEUE_MAX_LATENCY,
+      g_param_spec_uint64 ("send-queue-max-latency",
+          "Send queue maximum latency", "The longest time in nanoseconds that "
+          "a buffer has spent in a send queue before being sent", 0,
+          G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_SEND_QUEUE_DROPPED,
+      g_param_spec_uint64 ("send-queue-dropped", "Send queue dropped buffers",
+          "A counter of the number of buffers dropped because a QUIC stream "
+          "was blocked and the send queue was full or disabled", 0,
+          G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STALE_FRAMES_DROPPED,
+      g_param_spec_uint64 ("stale-frames-dropped", "Stale frames dropped",
+          "A counter of the number of frames dropped for being older than "
+          "max-frame-age", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_STALE_BYTES_DROPPED,
+      g_param_spec_uint64 ("stale-bytes-dropped", "Stale bytes dropped",
+          "A counter of the number of RTP bytes not sent because their frame "
+          "was older than max-frame-age", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DATAGRAM_FALLBACKS,
+      g_param_spec_uint64 ("datagram-fallbacks", "Datagram fallbacks",
+          "A counter of the number of times a RoQ stream has fallen back to "
+          "datagrams after repeated STOP_SENDINGs", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_KEYFRAME_REQUESTS,
+      g_param_spec_uint64 ("keyframe-requests", "Keyframe requests",
+          "A counter of the number of keyframe requests sent upstream after "
+          "cancelled frames", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_PEER_MAX_STREAM_DATA,
+      g_param_spec_uint64 ("peer-max-stream-data", "Peer max stream data",
+          "The per-stream flow control limit reported by quicmux, or 0 if it "
+          "isn't known", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_BUDGET_ROLLOVERS,
+      g_param_spec_uint64 ("budget-rollovers", "Stream budget rollovers",
+          "A counter of the number of times a new stream was started early to "
+          "stay within the per-stream flow control limit", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_AUTO_BOUNDARY,
+      g_param_spec_enum ("auto-boundary", "Automatic stream boundary",
+          "The stream boundary currently chosen when stream-boundary is auto",
+          GST_RTP_QUIC_MUX_TYPE_STREAM_BOUNDARY, STREAM_BOUNDARY_SINGLE_STREAM,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PACED_BUFFERS,
+      g_param_spec_uint64 ("paced-buffers", "Paced buffers",
+          "A counter of the number of buffers sent by the pacing thread",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DATAGRAMS_OVERSIZED,
+      g_param_spec_uint64 ("datagrams-oversized", "Oversized datagrams",
+          "A counter of the number of RTP and RTCP packets dropped for being "
+          "too large for a QUIC datagram", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_FEC_PACKETS_SENT,
+      g_param_spec_uint64 ("fec-packets-sent", "FEC packets sent",
+          "A counter of the number of FEC repair packets sent in datagrams",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+  g_object_class_install_property (gobject_class, PROP_DATAGRAM_BATCHES,
+      g_param_spec_uint64 ("datagram-batches", "Datagram batches",
+          "A counter of the number of batches of datagrams pushed as a list",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
   gst_element_class_set_static_metadata (gstelement_class,
         "RTP-over-QUIC multiplexer", "Muxer/Network/Protocol",
         "Send data over the network via QUIC transport",
@@ -304,9 +661,6 @@ gst_rtp_quic_mux_class_init (GstRtpQuicMuxClass * klass)
 static void
 gst_rtp_quic_mux_init (GstRtpQuicMux * roqmux)
 {
-  roqmux->ssrcs = g_hash_table_new_full (g_int_hash, g_int_equal,
-      g_free, (GDestroyNotify) rtp_quic_mux_hash_value_destroy);
-  roqmux->src_pads = g_hash_table_new (g_direct_hash, g_direct_equal);
   roqmux->rtcp_pads = g_hash_table_new_full (g_direct_hash, g_direct_equal,
       NULL, (GDestroyNotify) rtp_quic_mux_remove_rtcp_pad);
 
@@ -318,12 +672,88 @@ gst_rtp_quic_mux_init (GstRtpQuicMux * roqmux)
   roqmux->rtcp_flow_id = -1;
   roqmux->stream_boundary = STREAM_BOUNDARY_SINGLE_STREAM;
   roqmux->stream_packing_ratio = 1;
+  roqmux->stream_duration = 500 * GST_MSECOND;
+  roqmux->max_stream_bytes = 0;
+  roqmux->auto_boundary = STREAM_BOUNDARY_SINGLE_STREAM;
+  roqmux->auto_interval = GST_SECOND;
+  roqmux->auto_loss_high = 0.02;
+  roqmux->auto_loss_low = 0.005;
+  roqmux->auto_rtt_high = 150 * GST_MSECOND;
+  roqmux->auto_hold = 3;
+  roqmux->auto_next_update = GST_CLOCK_TIME_NONE;
+  roqmux->auto_stats_warned = FALSE;
+  roqmux->max_stream_data_queried = FALSE;
+  roqmux->max_stream_data_next_query = GST_CLOCK_TIME_NONE;
   roqmux->use_datagrams = FALSE;
+  roqmux->header_headroom = FALSE;
+  roqmux->header_allocator = gst_roq_header_allocator_new (1024);
+  g_mutex_init (&roqmux->datagram_pad_lock);
   roqmux->datagram_pad = NULL;
   roqmux->pad_n = 0;
+  roqmux->stream_pool_size = 0;
+  roqmux->send_queue_max_bytes = 0;
+  roqmux->max_frame_age = 0;
+  roqmux->hybrid_mapping = FALSE;
+  roqmux->datagram_mtu = 1200;
+  roqmux->fit_payloader_mtu = FALSE;
+  roqmux->datagram_batch_max_delay = 0;
+  roqmux->max_datagram_payload = 0;
+  roqmux->max_datagram_payload_next_query = GST_CLOCK_TIME_NONE;
+  roqmux->datagram_fallback_threshold = 0;
+  roqmux->datagram_fallback_window = GST_SECOND;
+  roqmux->datagram_fallback_quiet = 5 * GST_SECOND;
+  roqmux->request_keyframe = FALSE;
+  roqmux->keyframe_request_interval = GST_SECOND;
+  roqmux->wait_for_keyframe = FALSE;
+  roqmux->priority_map = NULL;
+  roqmux->frame_marking_ext_id = 0;
+  roqmux->sessions = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, g_free);
+  roqmux->session_flow_map = NULL;
+  roqmux->pacing = FALSE;
+  roqmux->pacing_bitrate = 0;
+  roqmux->pacing_frame_fraction = 0.5;
+  roqmux->pacer = gst_roq_pacer_new ();
+  roqmux->transport_pacing_rate = 0;
+  roqmux->pacing_rate_warned = FALSE;
+  roqmux->pacing_next_update = GST_CLOCK_TIME_NONE;
+  roqmux->fec_block_size = 0;
+  roqmux->fec_flow_id = -1;
+  roqmux->send_queue_policy = SEND_QUEUE_POLICY_DROP_OLDEST_FRAME;
+  g_mutex_init (&roqmux->send_queue_lock);
+  g_cond_init (&roqmux->send_queue_cond);
+  roqmux->send_queue_flushing = FALSE;
+  g_queue_init (&roqmux->stream_pad_pool);
+
+}
+
+static void
+gst_rtp_quic_mux_dispose (GObject *object)
+{
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (object);
+  RtpQuicMuxStreamSlot *streams;
+  guint capacity, i;
+
+  /*
+   * Free the streams while their stream pads are still ours to remove, before
+   * the parent class drops its references to them.
+   */
+  GST_OBJECT_LOCK (roqmux);
+  streams = roqmux->streams;
+  capacity = roqmux->streams_capacity;
+  roqmux->streams = NULL;
+  roqmux->streams_capacity = 0;
+  roqmux->streams_count = 0;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  for (i = 0; i < capacity; i++) {
+    if (streams[i].stream != NULL) {
+      rtp_quic_mux_stream_free (streams[i].stream);
+    }
+  }
+  g_free (streams);
 
-  g_rec_mutex_init (&roqmux->mutex);
-  g_cond_init (&roqmux->cond);
+  G_OBJECT_CLASS (parent_class)->dispose (object);
 }
 
 static void
@@ -331,10 +761,76 @@ gst_rtp_quic_mux_finalize (GObject *object)
 {
   GstRtpQuicMux *roqmux = GST_RTPQUICMUX (object);
 
+  /* Stops the pacing thread, if it is still running */
+  if (roqmux->pacer) {
+    gst_object_unref (roqmux->pacer);
+    roqmux->pacer = NULL;
+  }
+
   if (roqmux->quicmux) {
     gst_object_unref (roqmux->quicmux);
     roqmux->quicmux = 0;
   }
+
+  if (roqmux->header_allocator) {
+    gst_object_unref (roqmux->header_allocator);
+    roqmux->header_allocator = NULL;
+  }
+
+  /* The pads themselves are owned by the element */
+  g_queue_clear (&roqmux->stream_pad_pool);
+
+  if (roqmux->priority_map) {
+    gst_structure_free (roqmux->priority_map);
+    roqmux->priority_map = NULL;
+  }
+
+  if (roqmux->sessions) {
+    GHashTableIter iter;
+    RtpQuicMuxSession *session;
+
+    g_hash_table_iter_init (&iter, roqmux->sessions);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &session)) {
+      gst_roq_flow_id_manager_retire_flow_id ((guint64) session->rtp_flow_id);
+      if (session->rtcp_flow_id != -1) {
+        gst_roq_flow_id_manager_retire_flow_id (
+            (guint64) session->rtcp_flow_id);
+      }
+    }
+
+    g_hash_table_destroy (roqmux->sessions);
+    roqmux->sessions = NULL;
+  }
+
+  if (roqmux->session_flow_map) {
+    gst_structure_free (roqmux->session_flow_map);
+    roqmux->session_flow_map = NULL;
+  }
+
+  if (roqmux->fec_flow_id != -1) {
+    gst_roq_flow_id_manager_retire_flow_id ((guint64) roqmux->fec_flow_id);
+  }
+
+  g_cond_clear (&roqmux->send_queue_cond);
+  g_mutex_clear (&roqmux->send_queue_lock);
+  g_mutex_clear (&roqmux->datagram_pad_lock);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/*
+ * Take an unused flow ID for FEC repair packets.
+ */
+static void
+rtp_quic_mux_pick_fec_flow_id (GstRtpQuicMux *roqmux)
+{
+  gint64 flow_id;
+
+  do {
+    flow_id = (gint64) g_random_int_range (0, 2147483647);
+  } while (!gst_roq_flow_id_manager_new_flow_id ((guint64) flow_id));
+
+  roqmux->fec_flow_id = flow_id;
 }
 
 static void
@@ -398,11 +894,32 @@ gst_rtp_quic_mux_set_property (GObject * object, guint prop_id,
     case PROP_STREAM_BOUNDARY:
       roqmux->stream_boundary = g_value_get_enum (value);
       g_assert ((roqmux->stream_boundary >= STREAM_BOUNDARY_FRAME) &&
-          (roqmux->stream_boundary <= STREAM_BOUNDARY_SINGLE_STREAM));
+          (roqmux->stream_boundary <= STREAM_BOUNDARY_AUTO));
       break;
     case PROP_STREAM_PACKING:
       roqmux->stream_packing_ratio = g_value_get_uint (value);
       break;
+    case PROP_STREAM_DURATION:
+      roqmux->stream_duration = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_MAX_STREAM_BYTES:
+      roqmux->max_stream_bytes = g_value_get_uint64 (value);
+      break;
+    case PROP_AUTO_INTERVAL:
+      roqmux->auto_interval = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_AUTO_LOSS_HIGH:
+      roqmux->auto_loss_high = g_value_get_double (value);
+      break;
+    case PROP_AUTO_LOSS_LOW:
+      roqmux->auto_loss_low = g_value_get_double (value);
+      break;
+    case PROP_AUTO_RTT_HIGH:
+      roqmux->auto_rtt_high = g_value_get_uint (value) * GST_MSECOND;
+      break;
+    case PROP_AUTO_HOLD:
+      roqmux->auto_hold = g_value_get_uint (value);
+      break;
     case PROP_UNI_STREAM_TYPE:
       roqmux->uni_stream_type = g_value_get_uint64 (value);
       break;
@@ -420,6 +937,121 @@ gst_rtp_quic_mux_set_property (GObject * object, guint prop_id,
         roqmux->add_uni_stream_header = g_value_get_boolean (value);
       }
       break;
+    case PROP_HEADER_HEADROOM:
+      roqmux->header_headroom = g_value_get_boolean (value);
+      break;
+    case PROP_SEND_QUEUE_MAX_BYTES:
+      roqmux->send_queue_max_bytes = g_value_get_uint (value);
+      break;
+    case PROP_SEND_QUEUE_POLICY:
+      roqmux->send_queue_policy = g_value_get_enum (value);
+      break;
+    case PROP_MAX_FRAME_AGE:
+      roqmux->max_frame_age = g_value_get_uint64 (value);
+      break;
+    case PROP_HYBRID_MAPPING:
+      roqmux->hybrid_mapping = g_value_get_boolean (value);
+      break;
+    case PROP_DATAGRAM_MTU:
+      roqmux->datagram_mtu = g_value_get_uint (value);
+      break;
+    case PROP_FIT_PAYLOADER_MTU:
+      roqmux->fit_payloader_mtu = g_value_get_boolean (value);
+      break;
+    case PROP_DATAGRAM_BATCH_MAX_DELAY:
+      roqmux->datagram_batch_max_delay = g_value_get_uint64 (value);
+      break;
+    case PROP_DATAGRAM_FALLBACK_THRESHOLD:
+      roqmux->datagram_fallback_threshold = g_value_get_uint (value);
+      break;
+    case PROP_DATAGRAM_FALLBACK_WINDOW:
+      roqmux->datagram_fallback_window = g_value_get_uint64 (value);
+      break;
+    case PROP_DATAGRAM_FALLBACK_QUIET:
+      roqmux->datagram_fallback_quiet = g_value_get_uint64 (value);
+      break;
+    case PROP_REQUEST_KEYFRAME:
+      roqmux->request_keyframe = g_value_get_boolean (value);
+      break;
+    case PROP_KEYFRAME_REQUEST_INTERVAL:
+      roqmux->keyframe_request_interval = g_value_get_uint64 (value);
+      break;
+    case PROP_WAIT_FOR_KEYFRAME:
+      roqmux->wait_for_keyframe = g_value_get_boolean (value);
+      break;
+    case PROP_PRIORITY_MAP:
+    {
+      const GstStructure *map = gst_value_get_structure (value);
+
+      GST_OBJECT_LOCK (roqmux);
+      if (roqmux->priority_map) {
+        gst_structure_free (roqmux->priority_map);
+      }
+      roqmux->priority_map = (map)?(gst_structure_copy (map)):(NULL);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    }
+    case PROP_FRAME_MARKING_EXT_ID:
+      roqmux->frame_marking_ext_id = g_value_get_uint (value);
+      break;
+    case PROP_SESSION_FLOW_MAP:
+    {
+      const GstStructure *map = gst_value_get_structure (value);
+
+      GST_OBJECT_LOCK (roqmux);
+      if (roqmux->session_flow_map) {
+        gst_structure_free (roqmux->session_flow_map);
+      }
+      roqmux->session_flow_map = (map)?(gst_structure_copy (map)):(NULL);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    }
+    case PROP_PACING:
+      roqmux->pacing = g_value_get_boolean (value);
+      break;
+    case PROP_PACING_BITRATE:
+      roqmux->pacing_bitrate = g_value_get_uint64 (value);
+      break;
+    case PROP_PACING_FRAME_FRACTION:
+      roqmux->pacing_frame_fraction = g_value_get_double (value);
+      break;
+    case PROP_FEC_BLOCK_SIZE:
+      roqmux->fec_block_size = g_value_get_uint (value);
+      if (roqmux->fec_block_size > 0 && roqmux->fec_flow_id == -1) {
+        rtp_quic_mux_pick_fec_flow_id (roqmux);
+      }
+      break;
+    case PROP_FEC_FLOW_ID:
+    {
+      gint64 flow_id = g_value_get_int64 (value);
+
+      if (flow_id == roqmux->fec_flow_id) {
+        break;
+      }
+
+      if (flow_id != -1 &&
+          !gst_roq_flow_id_manager_new_flow_id ((guint64) flow_id)) {
+        GST_ERROR_OBJECT (roqmux, "Couldn't set FEC Flow ID to %ld as this is "
+            "already in use elsewhere!", flow_id);
+        break;
+      }
+
+      if (roqmux->fec_flow_id != -1) {
+        gst_roq_flow_id_manager_retire_flow_id ((guint64) roqmux->fec_flow_id);
+      }
+
+      roqmux->fec_flow_id = flow_id;
+
+      if (flow_id == -1 && roqmux->fec_block_size > 0) {
+        rtp_quic_mux_pick_fec_flow_id (roqmux);
+      }
+      break;
+    }
+    case PROP_STREAM_POOL_SIZE:
+      GST_OBJECT_LOCK (roqmux);
+      roqmux->stream_pool_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -445,6 +1077,57 @@ gst_rtp_quic_mux_get_property (GObject * object, guint prop_id,
     case PROP_STREAM_PACKING:
       g_value_set_uint (value, roqmux->stream_packing_ratio);
       break;
+    case PROP_STREAM_DURATION:
+      g_value_set_uint (value, roqmux->stream_duration / GST_MSECOND);
+      break;
+    case PROP_MAX_STREAM_BYTES:
+      g_value_set_uint64 (value, roqmux->max_stream_bytes);
+      break;
+    case PROP_AUTO_INTERVAL:
+      g_value_set_uint (value, roqmux->auto_interval / GST_MSECOND);
+      break;
+    case PROP_AUTO_LOSS_HIGH:
+      g_value_set_double (value, roqmux->auto_loss_high);
+      break;
+    case PROP_AUTO_LOSS_LOW:
+      g_value_set_double (value, roqmux->auto_loss_low);
+      break;
+    case PROP_AUTO_RTT_HIGH:
+      g_value_set_uint (value, roqmux->auto_rtt_high / GST_MSECOND);
+      break;
+    case PROP_AUTO_HOLD:
+      g_value_set_uint (value, roqmux->auto_hold);
+      break;
+    case PROP_AUTO_BOUNDARY:
+      GST_OBJECT_LOCK (roqmux);
+      g_value_set_enum (value, roqmux->auto_boundary);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    case PROP_PEER_MAX_STREAM_DATA:
+      GST_OBJECT_LOCK (roqmux);
+      g_value_set_uint64 (value, roqmux->peer_max_stream_data);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    case PROP_BUDGET_ROLLOVERS:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->budget_rollovers));
+      break;
+    case PROP_PACED_BUFFERS:
+      g_value_set_uint64 (value,
+          gst_roq_pacer_get_buffers_paced (roqmux->pacer));
+      break;
+    case PROP_DATAGRAMS_OVERSIZED:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->datagrams_oversized));
+      break;
+    case PROP_FEC_PACKETS_SENT:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->fec_packets_sent));
+      break;
+    case PROP_DATAGRAM_BATCHES:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->datagram_batches));
+      break;
     case PROP_UNI_STREAM_TYPE:
       g_value_set_uint64 (value, roqmux->uni_stream_type);
       break;
@@ -454,12 +1137,136 @@ gst_rtp_quic_mux_get_property (GObject * object, guint prop_id,
     case PROP_USE_UNI_STREAM_HEADER:
       g_value_set_boolean (value, roqmux->add_uni_stream_header);
       break;
+    case PROP_HEADER_HEADROOM:
+      g_value_set_boolean (value, roqmux->header_headroom);
+      break;
+    case PROP_STREAM_POOL_SIZE:
+      g_value_set_uint (value, roqmux->stream_pool_size);
+      break;
+    case PROP_STREAM_POOL_HITS:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->stream_pool_hits));
+      break;
+    case PROP_SEND_QUEUE_MAX_BYTES:
+      g_value_set_uint (value, roqmux->send_queue_max_bytes);
+      break;
+    case PROP_SEND_QUEUE_POLICY:
+      g_value_set_enum (value, roqmux->send_queue_policy);
+      break;
+    case PROP_SEND_QUEUE_DEPTH:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->send_queue_depth));
+      break;
+    case PROP_SEND_QUEUE_MAX_LATENCY:
+      GST_OBJECT_LOCK (roqmux);
+      g_value_set_uint64 (value, roqmux->send_queue_max_latency);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    case PROP_SEND_QUEUE_DROPPED:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->send_queue_dropped));
+      break;
+    case PROP_MAX_FRAME_AGE:
+      g_value_set_uint64 (value, roqmux->max_frame_age);
+      break;
+    case PROP_HYBRID_MAPPING:
+      g_value_set_boolean (value, roqmux->hybrid_mapping);
+      break;
+    case PROP_DATAGRAM_MTU:
+      g_value_set_uint (value, roqmux->datagram_mtu);
+      break;
+    case PROP_FIT_PAYLOADER_MTU:
+      g_value_set_boolean (value, roqmux->fit_payloader_mtu);
+      break;
+    case PROP_DATAGRAM_BATCH_MAX_DELAY:
+      g_value_set_uint64 (value, roqmux->datagram_batch_max_delay);
+      break;
+    case PROP_DATAGRAM_FALLBACK_THRESHOLD:
+      g_value_set_uint (value, roqmux->datagram_fallback_threshold);
+      break;
+    case PROP_DATAGRAM_FALLBACK_WINDOW:
+      g_value_set_uint64 (value, roqmux->datagram_fallback_window);
+      break;
+    case PROP_DATAGRAM_FALLBACK_QUIET:
+      g_value_set_uint64 (value, roqmux->datagram_fallback_quiet);
+      break;
+    case PROP_DATAGRAM_FALLBACKS:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->datagram_fallbacks));
+      break;
+    case PROP_REQUEST_KEYFRAME:
+      g_value_set_boolean (value, roqmux->request_keyframe);
+      break;
+    case PROP_KEYFRAME_REQUEST_INTERVAL:
+      g_value_set_uint64 (value, roqmux->keyframe_request_interval);
+      break;
+    case PROP_WAIT_FOR_KEYFRAME:
+      g_value_set_boolean (value, roqmux->wait_for_keyframe);
+      break;
+    case PROP_PRIORITY_MAP:
+      GST_OBJECT_LOCK (roqmux);
+      gst_value_set_structure (value, roqmux->priority_map);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    case PROP_FRAME_MARKING_EXT_ID:
+      g_value_set_uint (value, roqmux->frame_marking_ext_id);
+      break;
+    case PROP_SESSION_FLOW_MAP:
+      GST_OBJECT_LOCK (roqmux);
+      gst_value_set_structure (value, roqmux->session_flow_map);
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    case PROP_PACING:
+      g_value_set_boolean (value, roqmux->pacing);
+      break;
+    case PROP_PACING_BITRATE:
+      g_value_set_uint64 (value, roqmux->pacing_bitrate);
+      break;
+    case PROP_PACING_FRAME_FRACTION:
+      g_value_set_double (value, roqmux->pacing_frame_fraction);
+      break;
+    case PROP_FEC_BLOCK_SIZE:
+      g_value_set_uint (value, roqmux->fec_block_size);
+      break;
+    case PROP_FEC_FLOW_ID:
+      g_value_set_int64 (value, roqmux->fec_flow_id);
+      break;
+    case PROP_KEYFRAME_REQUESTS:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->keyframe_requests));
+      break;
+    case PROP_STALE_FRAMES_DROPPED:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->stale_frames_dropped));
+      break;
+    case PROP_STALE_BYTES_DROPPED:
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->stale_bytes_dropped));
+      break;
     case PROP_STREAM_FRAMES_SENT:
-      g_value_set_uint64 (value, roqmux->stream_frames_sent);
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->stream_frames_sent));
       break;
     case PROP_DATAGRAMS_SENT:
-      g_value_set_uint64 (value, roqmux->datagrams_sent);
+      g_value_set_uint64 (value,
+          RTP_QUIC_MUX_COUNTER_GET (roqmux->datagrams_sent));
+      break;
+    case PROP_HEADER_POOL_HITS:
+    {
+      guint64 hits;
+      gst_roq_header_allocator_get_stats (
+          GST_ROQ_HEADER_ALLOCATOR (roqmux->header_allocator), &hits, NULL);
+      g_value_set_uint64 (value, hits);
       break;
+    }
+    case PROP_HEADER_POOL_MISSES:
+    {
+      guint64 misses;
+      gst_roq_header_allocator_get_stats (
+          GST_ROQ_HEADER_ALLOCATOR (roqmux->header_allocator), NULL, &misses);
+      g_value_set_uint64 (value, misses);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -516,6 +1323,139 @@ _rtp_quic_mux_count_pads (GstElement *element, GstPad *pad, gpointer user_data)
   return TRUE;
 }
 
+/*
+ * Work out which session a sink pad belongs to from the first number in its
+ * name, as in rtp_sink_<session_idx>_<ssrc>_<payload_type>. Pads that aren't
+ * named that way belong to session 0.
+ */
+static guint
+rtp_quic_mux_pad_name_session (const gchar *name)
+{
+  const gchar *idx;
+
+  if (name == NULL) {
+    return 0;
+  }
+
+  if (g_str_has_prefix (name, "rtp_sink_")) {
+    idx = name + strlen ("rtp_sink_");
+  } else if (g_str_has_prefix (name, "rtcp_sink_")) {
+    idx = name + strlen ("rtcp_sink_");
+  } else {
+    return 0;
+  }
+
+  return (guint) g_ascii_strtoull (idx, NULL, 10);
+}
+
+/*
+ * Make sure there are flow IDs for a session other than session 0, taking them
+ * from the session-flow-map if they are there and picking unused ones if not.
+ * Returns FALSE if the flow IDs in the map are already in use.
+ */
+static gboolean
+rtp_quic_mux_add_session (GstRtpQuicMux *roqmux, guint session_id)
+{
+  RtpQuicMuxSession *session;
+  gint64 rtp_flow_id = -1, rtcp_flow_id = -1;
+  gchar *key;
+
+  if (session_id == 0) {
+    return TRUE;
+  }
+
+  GST_OBJECT_LOCK (roqmux);
+  if (g_hash_table_contains (roqmux->sessions,
+      GUINT_TO_POINTER (session_id))) {
+    GST_OBJECT_UNLOCK (roqmux);
+    return TRUE;
+  }
+  if (roqmux->session_flow_map) {
+    key = g_strdup_printf ("session-%u", session_id);
+    gst_structure_get_int64 (roqmux->session_flow_map, key, &rtp_flow_id);
+    g_free (key);
+    key = g_strdup_printf ("session-%u-rtcp", session_id);
+    gst_structure_get_int64 (roqmux->session_flow_map, key, &rtcp_flow_id);
+    g_free (key);
+  }
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (rtp_flow_id == -1) {
+    do {
+      rtp_flow_id = (gint64) g_random_int_range (0, 2147483647);
+    } while (!gst_roq_flow_id_manager_new_flow_id ((guint64) rtp_flow_id));
+  } else if (!gst_roq_flow_id_manager_new_flow_id ((guint64) rtp_flow_id)) {
+    GST_ERROR_OBJECT (roqmux, "Couldn't use RTP Flow ID %ld for session %u "
+        "as this is already in use elsewhere!", rtp_flow_id, session_id);
+    return FALSE;
+  }
+
+  if (rtcp_flow_id != -1 &&
+      !gst_roq_flow_id_manager_new_flow_id ((guint64) rtcp_flow_id)) {
+    GST_ERROR_OBJECT (roqmux, "Couldn't use RTCP Flow ID %ld for session %u "
+        "as this is already in use elsewhere!", rtcp_flow_id, session_id);
+    gst_roq_flow_id_manager_retire_flow_id ((guint64) rtp_flow_id);
+    return FALSE;
+  }
+
+  session = g_new0 (RtpQuicMuxSession, 1);
+  session->session_id = session_id;
+  session->rtp_flow_id = rtp_flow_id;
+  session->rtcp_flow_id = rtcp_flow_id;
+
+  GST_OBJECT_LOCK (roqmux);
+  if (g_hash_table_contains (roqmux->sessions,
+      GUINT_TO_POINTER (session_id))) {
+    /* Another pad for the same session got there first */
+    GST_OBJECT_UNLOCK (roqmux);
+    gst_roq_flow_id_manager_retire_flow_id ((guint64) rtp_flow_id);
+    if (rtcp_flow_id != -1) {
+      gst_roq_flow_id_manager_retire_flow_id ((guint64) rtcp_flow_id);
+    }
+    g_free (session);
+    return TRUE;
+  }
+  g_hash_table_insert (roqmux->sessions, GUINT_TO_POINTER (session_id),
+      session);
+  GST_OBJECT_UNLOCK (roqmux);
+
+  GST_DEBUG_OBJECT (roqmux, "Session %u has RTP flow ID %ld and RTCP flow ID "
+      "%ld", session_id, rtp_flow_id,
+      (rtcp_flow_id == -1)?(rtp_flow_id + 1):(rtcp_flow_id));
+
+  return TRUE;
+}
+
+/*
+ * Resolve the flow IDs of a sink pad's session. Session 0 follows the
+ * rtp-flow-id and rtcp-flow-id properties, and for any session the RTCP flow
+ * ID is the RTP flow ID plus one unless it has been set otherwise.
+ */
+static void
+rtp_quic_mux_sink_resolve_flow_ids (GstRtpQuicMux *roqmux,
+    RtpQuicMuxSink *sink)
+{
+  RtpQuicMuxSession *session = NULL;
+
+  sink->rtp_flow_id = roqmux->rtp_flow_id;
+  sink->rtcp_flow_id = roqmux->rtcp_flow_id;
+
+  if (sink->session_id > 0) {
+    GST_OBJECT_LOCK (roqmux);
+    session = g_hash_table_lookup (roqmux->sessions,
+        GUINT_TO_POINTER (sink->session_id));
+    if (session) {
+      sink->rtp_flow_id = session->rtp_flow_id;
+      sink->rtcp_flow_id = session->rtcp_flow_id;
+    }
+    GST_OBJECT_UNLOCK (roqmux);
+  }
+
+  if (sink->rtcp_flow_id == -1) {
+    sink->rtcp_flow_id = sink->rtp_flow_id + 1;
+  }
+}
+
 static GstPad *
 gst_rtp_quic_mux_request_new_pad (GstElement *element, GstPadTemplate *templ,
     const gchar *name, const GstCaps *caps)
@@ -524,7 +1464,9 @@ gst_rtp_quic_mux_request_new_pad (GstElement *element, GstPadTemplate *templ,
   gchar *padname = NULL;
   GstPadChainFunction chainfunc;
   GstPad *pad;
+  RtpQuicMuxSink *sink;
   guint padcount = 0;
+  guint session_id = rtp_quic_mux_pad_name_session (name);
 
   switch (rtp_quic_mux_get_caps_type (templ->caps)) {
   case CAPS_RTP:
@@ -554,13 +1496,34 @@ gst_rtp_quic_mux_request_new_pad (GstElement *element, GstPadTemplate *templ,
     return NULL;
   }
 
+  if (!rtp_quic_mux_add_session (roqmux, session_id)) {
+    g_free (padname);
+    return NULL;
+  }
+
   GST_DEBUG_OBJECT (roqmux, "Creaing new pad with name %s and caps %"
       GST_PTR_FORMAT, padname, templ->caps);
 
   pad = gst_pad_new_from_template (templ, padname);
 
+  g_free (padname);
+
+  sink = g_new0 (RtpQuicMuxSink, 1);
+  sink->sink = pad;
+  sink->rtcp = (chainfunc == gst_rtp_quic_mux_rtcp_chain);
+  sink->session_id = session_id;
+  sink->frame_start = TRUE;
+  gst_segment_init (&sink->segment, GST_FORMAT_TIME);
+  rtp_quic_mux_sink_resolve_flow_ids (roqmux, sink);
+  gst_pad_set_element_private (pad, sink);
+
+  if (!sink->rtcp) {
+    gst_pad_set_chain_list_function (pad, gst_rtp_quic_mux_rtp_chain_list);
+  }
+
   gst_pad_set_chain_function (pad, chainfunc);
   gst_pad_set_event_function (pad, gst_rtp_quic_mux_sink_event);
+  gst_pad_set_query_function (pad, gst_rtp_quic_mux_sink_query);
 
   gst_element_add_pad (element, pad);
 
@@ -572,19 +1535,313 @@ gst_rtp_quic_mux_request_new_pad (GstElement *element, GstPadTemplate *templ,
 static void
 gst_rtp_quic_mux_release_pad (GstElement *element, GstPad *pad)
 {
+  RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
+
   GST_DEBUG_OBJECT (GST_RTPQUICMUX (element), "Removing pad %p", pad);
 
   gst_element_remove_pad (element, pad);
+
+  if (sink) {
+    rtp_quic_mux_release_stream (GST_RTPQUICMUX (element), sink);
+    if (sink->fec) {
+      gst_roq_fec_encoder_clear (sink->fec);
+      g_free (sink->fec);
+    }
+    if (sink->dgram_batch) {
+      gst_buffer_list_unref (sink->dgram_batch);
+    }
+    g_free (sink);
+  }
 }
 
-/* this function handles sink events */
-static gboolean
-gst_rtp_quic_mux_sink_event (GstPad * pad, GstObject * parent,
-    GstEvent * event)
+static GstStateChangeReturn
+gst_rtp_quic_mux_change_state (GstElement *element, GstStateChange transition)
 {
-  GstRtpQuicMux *roqmux;
-  gboolean ret = FALSE;
-
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (element);
+  GstStateChangeReturn rv;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      rtp_quic_mux_send_queue_set_flushing (roqmux, FALSE);
+      if (roqmux->pacing && roqmux->send_queue_max_bytes > 0) {
+        GST_WARNING_OBJECT (roqmux, "Pacing and send-queue-max-bytes are "
+            "exclusive, packets sent on QUIC streams won't be paced");
+      }
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /*
+       * Deactivating the sink pads waits for their streaming threads, so any
+       * that are blocked on a send queue have to be let go first.
+       */
+      rtp_quic_mux_send_queue_set_flushing (roqmux, TRUE);
+      break;
+    default:
+      break;
+  }
+
+  rv = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    /* The pads are flushing now, so there's nothing left worth pacing out */
+    gst_roq_pacer_stop (roqmux->pacer);
+
+    /* The next connection may well carry datagrams of a different size */
+    rtp_quic_mux_reset_max_datagram_payload (roqmux);
+  }
+
+  return rv;
+}
+
+static RtpQuicMuxStream *
+rtp_quic_mux_stream_new (void)
+{
+  RtpQuicMuxStream *stream = g_new0 (RtpQuicMuxStream, 1);
+  g_assert (stream);
+
+  stream->frame_start = TRUE;
+  stream->last_keyframe_request = GST_CLOCK_TIME_NONE;
+  stream->pace_deadline = G_MAXINT64;
+  stream->pace_frame_start = GST_CLOCK_TIME_NONE;
+  stream->pace_frame_interval = GST_CLOCK_TIME_NONE;
+
+  return stream;
+}
+
+#define RTP_QUIC_MUX_STREAM_KEY(session, ssrc, pt) \
+  ((((guint64) (session) & 0xffffff) << 40) | ((guint64) (ssrc) << 8) | \
+      ((guint64) (pt) & 0xff))
+
+#define RTP_QUIC_MUX_STREAM_TABLE_MIN_CAPACITY 16
+
+static inline guint
+rtp_quic_mux_stream_table_slot (guint64 key, guint mask)
+{
+  /* Fibonacci hashing, so that neighbouring SSRCs don't cluster */
+  return (guint) ((key * G_GUINT64_CONSTANT (0x9E3779B97F4A7C15)) >> 32) &
+      mask;
+}
+
+/*
+ * Must be called with the object lock held.
+ */
+static RtpQuicMuxStream *
+rtp_quic_mux_stream_table_lookup (GstRtpQuicMux *roqmux, guint64 key)
+{
+  guint mask = roqmux->streams_capacity - 1;
+  guint i;
+
+  if (roqmux->streams == NULL) {
+    return NULL;
+  }
+
+  for (i = rtp_quic_mux_stream_table_slot (key, mask);
+      roqmux->streams[i].stream != NULL; i = (i + 1) & mask) {
+    if (roqmux->streams[i].key == key) {
+      return roqmux->streams[i].stream;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Add a stream that isn't already in the table, doubling the table whenever it
+ * would become more than three quarters full. Must be called with the object
+ * lock held.
+ */
+static void
+rtp_quic_mux_stream_table_insert (GstRtpQuicMux *roqmux, guint64 key,
+    RtpQuicMuxStream *stream)
+{
+  guint mask, i;
+
+  if ((roqmux->streams_count + 1) * 4 > roqmux->streams_capacity * 3) {
+    RtpQuicMuxStreamSlot *old = roqmux->streams;
+    guint old_capacity = roqmux->streams_capacity;
+
+    roqmux->streams_capacity = MAX (old_capacity * 2,
+        RTP_QUIC_MUX_STREAM_TABLE_MIN_CAPACITY);
+    roqmux->streams = g_new0 (RtpQuicMuxStreamSlot, roqmux->streams_capacity);
+    roqmux->streams_count = 0;
+
+    for (i = 0; i < old_capacity; i++) {
+      if (old[i].stream != NULL) {
+        rtp_quic_mux_stream_table_insert (roqmux, old[i].key, old[i].stream);
+      }
+    }
+
+    g_free (old);
+  }
+
+  mask = roqmux->streams_capacity - 1;
+  for (i = rtp_quic_mux_stream_table_slot (key, mask);
+      roqmux->streams[i].stream != NULL; i = (i + 1) & mask);
+
+  roqmux->streams[i].key = key;
+  roqmux->streams[i].stream = stream;
+  roqmux->streams_count++;
+}
+
+/*
+ * Remove a stream from the table if it is there, shifting back any streams
+ * that had probed past it so that lookups still find them. Returns TRUE if the
+ * stream was found. Must be called with the object lock held.
+ */
+static gboolean
+rtp_quic_mux_stream_table_remove (GstRtpQuicMux *roqmux, guint64 key,
+    RtpQuicMuxStream *stream)
+{
+  guint mask = roqmux->streams_capacity - 1;
+  guint i, j;
+
+  if (roqmux->streams == NULL) {
+    return FALSE;
+  }
+
+  for (i = rtp_quic_mux_stream_table_slot (key, mask);
+      roqmux->streams[i].stream != NULL; i = (i + 1) & mask) {
+    if (roqmux->streams[i].key == key) {
+      break;
+    }
+  }
+
+  if (roqmux->streams[i].stream != stream) {
+    return FALSE;
+  }
+
+  roqmux->streams[i].stream = NULL;
+  roqmux->streams_count--;
+
+  for (j = (i + 1) & mask; roqmux->streams[j].stream != NULL;
+      j = (j + 1) & mask) {
+    guint home = rtp_quic_mux_stream_table_slot (roqmux->streams[j].key, mask);
+
+    /* Move the stream into the gap if the gap lies between home and j */
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      roqmux->streams[i] = roqmux->streams[j];
+      roqmux->streams[j].stream = NULL;
+      i = j;
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * Find the stream object for a given session, SSRC and payload type, creating
+ * it if it doesn't already exist, and take a sink pad reference on it.
+ */
+static RtpQuicMuxStream *
+rtp_quic_mux_get_stream (GstRtpQuicMux *roqmux, guint session_id,
+    guint32 ssrc, gint32 payload_type)
+{
+  guint64 key = RTP_QUIC_MUX_STREAM_KEY (session_id, ssrc, payload_type);
+  RtpQuicMuxStream *stream;
+  gboolean created = FALSE;
+
+  GST_OBJECT_LOCK (roqmux);
+  stream = rtp_quic_mux_stream_table_lookup (roqmux, key);
+  if (stream == NULL) {
+    stream = rtp_quic_mux_stream_new ();
+    rtp_quic_mux_stream_table_insert (roqmux, key, stream);
+    created = TRUE;
+  }
+  stream->sink_refs++;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (created) {
+    GST_TRACE_OBJECT (roqmux, "New stream for session %u, SSRC %u and "
+        "payload type %u", session_id, ssrc, payload_type);
+  }
+
+  return stream;
+}
+
+/*
+ * Drop a sink pad's reference on the stream it feeds, freeing the stream if no
+ * other sink pad feeds it.
+ */
+static void
+rtp_quic_mux_release_stream (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink)
+{
+  RtpQuicMuxStream *stream = sink->stream;
+  guint64 key;
+  gboolean removed = FALSE;
+
+  if (stream == NULL) {
+    return;
+  }
+  sink->stream = NULL;
+
+  key = RTP_QUIC_MUX_STREAM_KEY (sink->session_id, sink->ssrc,
+      sink->payload_type);
+
+  GST_OBJECT_LOCK (roqmux);
+  if (--stream->sink_refs == 0) {
+    removed = rtp_quic_mux_stream_table_remove (roqmux, key, stream);
+  } else if (stream->sink_pad == sink->sink) {
+    /* Keyframe requests can't go to a pad that's on its way out */
+    stream->sink_pad = NULL;
+  }
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (removed) {
+    rtp_quic_mux_stream_free (stream);
+  }
+}
+
+static gboolean
+rtp_quic_mux_sink_setcaps (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    GstCaps *caps)
+{
+  GstStructure *s;
+  gint payload_type;
+  guint ssrc;
+
+  GST_DEBUG_OBJECT (roqmux, "Caps on pad %" GST_PTR_FORMAT ": %"
+      GST_PTR_FORMAT, sink->sink, caps);
+
+  s = gst_caps_get_structure (caps, 0);
+
+  sink->dgram_batchable = g_strcmp0 (gst_structure_get_string (s, "media"),
+      "audio") != 0;
+
+  if (!gst_structure_get_int (s, "payload", &payload_type) ||
+      !gst_structure_get_uint (s, "ssrc", &ssrc)) {
+    GST_WARNING_OBJECT (roqmux, "Caps %" GST_PTR_FORMAT " on pad %"
+        GST_PTR_FORMAT " are missing the payload type and/or SSRC", caps,
+        sink->sink);
+    rtp_quic_mux_release_stream (roqmux, sink);
+    return FALSE;
+  }
+
+  /* Renegotiating to the same stream keeps the reference already held */
+  if (payload_type != sink->payload_type || ssrc != sink->ssrc) {
+    rtp_quic_mux_release_stream (roqmux, sink);
+    sink->payload_type = payload_type;
+    sink->ssrc = ssrc;
+  }
+
+  if (sink->stream == NULL) {
+    sink->stream = rtp_quic_mux_get_stream (roqmux, sink->session_id,
+        sink->ssrc, sink->payload_type);
+  }
+  sink->stream->sink_pad = sink->sink;
+  sink->stream->flow_id = sink->rtp_flow_id;
+  sink->stream->media = g_intern_string (gst_structure_get_string (s,
+        "media"));
+
+  return TRUE;
+}
+
+/* this function handles sink events */
+static gboolean
+gst_rtp_quic_mux_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstRtpQuicMux *roqmux;
+  gboolean ret = FALSE;
+
   roqmux = GST_RTPQUICMUX (parent);
 
   GST_LOG_OBJECT (roqmux, "Received %s event: %" GST_PTR_FORMAT,
@@ -593,17 +1850,89 @@ gst_rtp_quic_mux_sink_event (GstPad * pad, GstObject * parent,
   switch (GST_EVENT_TYPE (event)) {
     case GST_EVENT_CAPS:
     {
-      /* Purposefully do nothing? */
+      RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
+
+      if (sink) {
+        GstCaps *caps;
+
+        gst_event_parse_caps (event, &caps);
+
+        /* Pick up any change to the session 0 flow ID properties */
+        rtp_quic_mux_sink_resolve_flow_ids (roqmux, sink);
+
+        /*
+         * Datagrams don't need the SSRC and payload type, so don't refuse the
+         * caps if they aren't there. The chain function checks for a stream.
+         */
+        if (!sink->rtcp) {
+          rtp_quic_mux_sink_setcaps (roqmux, sink, caps);
+        }
+      }
+
+      gst_event_unref (event);
       ret = TRUE;
 
       break;
     }
+    case GST_EVENT_SEGMENT:
+    {
+      RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
+
+      if (sink) {
+        gst_event_copy_segment (event, &sink->segment);
+      }
+
+      ret = gst_pad_event_default (pad, parent, event);
+      break;
+    }
     case GST_EVENT_EOS:
-      g_rec_mutex_lock (&roqmux->mutex);
-      if (roqmux->quicmux) {
-        ret = gst_element_send_event (roqmux->quicmux, event);
+    {
+      RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
+      GstElement *quicmux;
+
+      /* Protect whatever was sent since the last repair packet */
+      if (sink && sink->fec) {
+        rtp_quic_mux_sink_push_fec (roqmux, sink, pad, sink->stream);
+      }
+
+      if (sink && sink->dgram_batch) {
+        rtp_quic_mux_sink_push_batch (roqmux, sink);
+      }
+
+      if (sink && sink->stream) {
+        GList *streams = NULL, *it;
+
+        if (sink->stream->layers) {
+          streams = g_hash_table_get_values (sink->stream->layers);
+        }
+        streams = g_list_prepend (streams, sink->stream);
+
+        for (it = streams; it != NULL; it = it->next) {
+          RtpQuicMuxStream *stream = it->data;
+
+          /* Last chance to get anything still queued out */
+          if (roqmux->send_queue_max_bytes > 0) {
+            rtp_quic_mux_send_queue_drain (roqmux, pad, stream);
+          }
+
+          /* And to let the pacer finish before EOS overtakes it */
+          if (stream->pacer_flow) {
+            gst_roq_pacer_flow_drain (roqmux->pacer, stream->pacer_flow);
+          }
+        }
+        g_list_free (streams);
+      }
+
+      quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+      if (quicmux) {
+        ret = gst_element_send_event (quicmux, event);
       }
-      g_rec_mutex_unlock (&roqmux->mutex);
+      break;
+    }
+    case GST_EVENT_FLUSH_START:
+      /* The pad is already flushing, make sure a blocked chain sees it */
+      rtp_quic_mux_send_queue_wake (roqmux);
+      ret = gst_pad_event_default (pad, parent, event);
       break;
     default:
       ret = gst_pad_event_default (pad, parent, event);
@@ -613,14 +1942,77 @@ gst_rtp_quic_mux_sink_event (GstPad * pad, GstObject * parent,
   return ret;
 }
 
+static gboolean
+gst_rtp_quic_mux_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_ALLOCATION:
+    {
+      GstAllocationParams params;
+
+      if (!roqmux->header_headroom) {
+        break;
+      }
+
+      /*
+       * Ask upstream to leave enough space in front of each buffer for the
+       * largest RoQ header we could write, so rtp_quic_mux_write_payload_header
+       * can grow the buffer into the prefix instead of prepending a memory.
+       */
+      gst_allocation_params_init (&params);
+      params.prefix = RTP_QUIC_MUX_MAX_HEADER_LEN;
+
+      gst_query_add_allocation_param (query, NULL, &params);
+
+      GST_DEBUG_OBJECT (roqmux, "Proposed allocation with %u byte prefix on "
+          "pad %" GST_PTR_FORMAT, RTP_QUIC_MUX_MAX_HEADER_LEN, pad);
+
+      return TRUE;
+    }
+    default:
+      break;
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static void
+rtp_quic_mux_queued_buffer_free (RtpQuicMuxQueuedBuffer *qb)
+{
+  gst_buffer_unref (qb->buf);
+  g_slice_free (RtpQuicMuxQueuedBuffer, qb);
+}
+
 void
-rtp_quic_mux_pt_hash_destroy (RtpQuicMuxStream *stream)
+rtp_quic_mux_stream_free (RtpQuicMuxStream *stream)
 {
-  GstElement *parent = GST_ELEMENT (gst_pad_get_parent (stream->stream_pad));
-  g_mutex_lock (&stream->mutex);
-  g_hash_table_remove (GST_RTPQUICMUX (parent)->src_pads, stream->stream_pad);
-  gst_element_remove_pad (parent, stream->stream_pad);
-  g_mutex_unlock (&stream->mutex);
+  if (stream->layers) {
+    g_hash_table_unref (stream->layers);
+  }
+
+  if (stream->pacer_flow) {
+    gst_roq_pacer_flow_free (stream->pacer, stream->pacer_flow);
+    gst_object_unref (stream->pacer);
+  }
+
+  if (stream->stream_pad) {
+    GstElement *parent = GST_ELEMENT (gst_pad_get_parent (stream->stream_pad));
+
+    gst_pad_set_element_private (stream->stream_pad, NULL);
+    if (parent) {
+      gst_element_remove_pad (parent, stream->stream_pad);
+      gst_object_unref (parent);
+    }
+  }
+  if (stream->blocked_buf) {
+    gst_buffer_unref (stream->blocked_buf);
+    gst_object_unref (stream->blocked_pad);
+  }
+  g_queue_clear_full (&stream->send_queue,
+      (GDestroyNotify) rtp_quic_mux_queued_buffer_free);
   g_free (stream);
 }
 
@@ -657,42 +2049,77 @@ rtp_quic_mux_foreach_sticky_event (GstPad *pad, GstEvent **event,
   ((uint64_t)(ntohl((uint32_t)(N))) << 32 | ntohl((uint32_t)((N) >> 32)))
 #endif /* !WORDS_BIGENDIAN */
 
-gboolean
-rtp_quic_mux_write_payload_header (GstBuffer **buf, gint64 stream_type,
-    gint64 flow_id, gboolean length)
+/*
+ * Write the RoQ header varints to data, or just work out how long they would
+ * be if data is NULL.
+ */
+static gsize
+rtp_quic_mux_write_varints (guint8 *data, gint64 stream_type, gint64 flow_id,
+    gboolean length, gsize buf_len)
 {
-  gsize buf_len, varlen_len = 0;
-  GstMemory *mem;
-  GstMapInfo map;
-
-  buf_len = gst_buffer_get_size (*buf);
+  gsize varlen_len = 0;
 
   if (stream_type >= 0) {
-    varlen_len += gst_quiclib_set_varint ((guint64) stream_type, NULL);
+    varlen_len += gst_quiclib_set_varint ((guint64) stream_type, data);
   }
   if (flow_id >= 0) {
-    varlen_len += gst_quiclib_set_varint ((guint64) flow_id, NULL);
+    varlen_len += gst_quiclib_set_varint ((guint64) flow_id,
+        (data == NULL)?(NULL):(data + varlen_len));
   }
   if (length) {
-    varlen_len += gst_quiclib_set_varint (buf_len, NULL);
+    varlen_len += gst_quiclib_set_varint (buf_len,
+        (data == NULL)?(NULL):(data + varlen_len));
   }
 
-  mem = gst_allocator_alloc (NULL, varlen_len, NULL);
-  gst_memory_map (mem, &map, GST_MAP_WRITE);
+  return varlen_len;
+}
+
+gboolean
+rtp_quic_mux_write_payload_header (GstRtpQuicMux *roqmux, GstBuffer **buf,
+    gint64 stream_type, gint64 flow_id, gboolean length)
+{
+  gsize buf_len, varlen_len, prefix = 0;
+  GstMemory *mem;
+  GstMapInfo map;
 
-  varlen_len = 0;
+  buf_len = gst_buffer_get_sizes (*buf, &prefix, NULL);
 
-  if (stream_type >=0) {
-    varlen_len += gst_quiclib_set_varint ((guint64) stream_type, map.data);
-  }
-  if (flow_id >= 0) {
-    varlen_len += gst_quiclib_set_varint ((guint64) flow_id,
-        map.data + varlen_len);
-  }
-  if (length) {
-    varlen_len += gst_quiclib_set_varint (buf_len, map.data + varlen_len);
+  varlen_len = rtp_quic_mux_write_varints (NULL, stream_type, flow_id, length,
+      buf_len);
+
+  /*
+   * If upstream honoured the allocation prefix we asked for, grow the first
+   * memory back over the prefix and write the header in place. Only memory
+   * that we handed out the prefix for is trusted with this: a sub-memory may
+   * have someone else's data in front of it, and is read-only besides.
+   */
+  if (roqmux->header_headroom && prefix >= varlen_len) {
+    *buf = gst_buffer_make_writable (*buf);
+    mem = gst_buffer_peek_memory (*buf, 0);
+
+    if (mem->parent == NULL &&
+        gst_buffer_is_memory_range_writable (*buf, 0, 1) &&
+        gst_memory_map (mem, &map, GST_MAP_WRITE)) {
+      gst_memory_unmap (mem, &map);
+      gst_buffer_resize (*buf, -(gssize) varlen_len, buf_len + varlen_len);
+
+      if (gst_memory_map (mem, &map, GST_MAP_WRITE)) {
+        rtp_quic_mux_write_varints (map.data, stream_type, flow_id, length,
+            buf_len);
+        gst_memory_unmap (mem, &map);
+
+        return TRUE;
+      }
+
+      gst_buffer_resize (*buf, (gssize) varlen_len, buf_len);
+    }
   }
 
+  mem = gst_allocator_alloc (roqmux->header_allocator, varlen_len, NULL);
+  gst_memory_map (mem, &map, GST_MAP_WRITE);
+
+  rtp_quic_mux_write_varints (map.data, stream_type, flow_id, length, buf_len);
+
   gst_memory_unmap (mem, &map);
 
   *buf = gst_buffer_make_writable (*buf);
@@ -702,37 +2129,17 @@ rtp_quic_mux_write_payload_header (GstBuffer **buf, gint64 stream_type,
   return TRUE;
 }
 
-gboolean
-rtp_quic_mux_pts_hash_table_find (gpointer key, gpointer value,
-    gpointer user_data)
-{
-  gboolean rv;
-  RtpQuicMuxStream *stream = (RtpQuicMuxStream *) value;
-  g_mutex_lock (&stream->mutex);
-  rv = stream->stream_pad == (GstPad *) user_data;
-  g_mutex_unlock (&stream->mutex);
-  return rv;
-}
-
-gboolean
-rtp_quic_mux_ssrc_hash_table_find (gpointer key, gpointer value,
-    gpointer user_data)
-{
-  GHashTable *pts_ht = (GHashTable *) value;
-
-  return (g_hash_table_find (pts_ht, rtp_quic_mux_pts_hash_table_find,
-      user_data) != NULL);
-}
-
 void
 rtp_quic_mux_pad_linked_callback (GstPad *self, GstPad *peer,
     gpointer user_data)
 {
   GstRtpQuicMux *roqmux = GST_RTPQUICMUX (user_data);
+  GstElement *quicmux = gst_pad_get_parent_element (peer);
 
-  g_rec_mutex_lock (&roqmux->mutex);
-  roqmux->quicmux = gst_pad_get_parent_element (peer);
-  g_rec_mutex_unlock (&roqmux->mutex);
+  if (!g_atomic_pointer_compare_and_exchange (&roqmux->quicmux, NULL,
+        quicmux)) {
+    gst_object_unref (quicmux);
+  }
 }
 
 void
@@ -745,27 +2152,45 @@ rtp_quic_mux_pad_unlinked_callback (GstPad * self, GstPad * peer,
   GST_TRACE_OBJECT (roqmux, "Pad %" GST_PTR_FORMAT " unlinked from peer pad %"
       GST_PTR_FORMAT, self, peer);
 
-  if (!g_hash_table_lookup_extended (roqmux->src_pads, (gpointer) self, NULL,
-      (gpointer *) &stream)) {
-    GST_DEBUG_OBJECT (roqmux, "Couldn't find stream object for pad %"
-        GST_PTR_FORMAT ", already closed?", self);
+  stream = gst_pad_get_element_private (self);
+
+  if (stream == NULL) {
+    gboolean pooled;
+
+    GST_OBJECT_LOCK (roqmux);
+    pooled = g_queue_remove (&roqmux->stream_pad_pool, self);
+    GST_OBJECT_UNLOCK (roqmux);
+
+    if (pooled) {
+      GST_DEBUG_OBJECT (roqmux, "Pooled pad %" GST_PTR_FORMAT " unlinked, "
+          "dropping it from the pool", self);
+      gst_element_remove_pad (GST_ELEMENT (roqmux), self);
+    } else {
+      GST_DEBUG_OBJECT (roqmux, "Couldn't find stream object for pad %"
+          GST_PTR_FORMAT ", already closed?", self);
+    }
   } else {
-    g_mutex_lock (&stream->mutex);
-    gst_element_remove_pad (GST_ELEMENT (roqmux), stream->stream_pad);
-    g_hash_table_remove (roqmux->src_pads, (gpointer) stream->stream_pad);
-    stream->stream_pad = NULL;
-    g_mutex_unlock (&stream->mutex);
+    /*
+     * The stream belongs to its sink pad's streaming thread, so leave it to
+     * that thread to close the pad when it next maps a buffer. Only the
+     * address is compared, in case the stream has moved on since.
+     */
+    g_atomic_pointer_set (&stream->unlinked_pad, self);
   }
 }
 
-GstPad *
-rtp_quic_mux_new_uni_src_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
+/*
+ * Create a new source pad for a unidirectional stream and link it to the
+ * quicmux element.
+ */
+static GstPad *
+rtp_quic_mux_open_uni_src_pad (GstRtpQuicMux *roqmux)
 {
   GstPad *rv;
   gchar *padname;
 
   padname = g_strdup_printf (quic_stream_src_factory.name_template,
-      roqmux->pad_n++);
+      (guint) g_atomic_int_add ((gint *) &roqmux->pad_n, 1));
 
   GST_TRACE_OBJECT (roqmux,
       "Requesting new unidirectional stream pad with name %s", padname);
@@ -776,9 +2201,7 @@ rtp_quic_mux_new_uni_src_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
 
   g_free (padname);
 
-  g_rec_mutex_lock (&roqmux->mutex);
-
-  if (roqmux->quicmux == NULL) {
+  if (g_atomic_pointer_get (&roqmux->quicmux) == NULL) {
     g_signal_connect (rv, "linked",
           (GCallback) rtp_quic_mux_pad_linked_callback, (gpointer) roqmux);
   }
@@ -790,21 +2213,22 @@ rtp_quic_mux_new_uni_src_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
     GstPadTemplate *req_pad_templ, *quicmux_pad_templ;
     GstPad *remote;
     GstPadLinkReturn link_rv;
-    g_assert (roqmux->quicmux != NULL);
+    GstElement *quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+    g_assert (quicmux != NULL);
 
     req_pad_templ = gst_static_pad_template_get (&quic_stream_src_factory);
     quicmux_pad_templ = gst_element_get_compatible_pad_template (
-      roqmux->quicmux, req_pad_templ);
+      quicmux, req_pad_templ);
 
     if (quicmux_pad_templ == NULL) {
       GST_ERROR_OBJECT (roqmux, "Couldn't get compatible pad template from "
           "quicmux %p with local pad template %" GST_PTR_FORMAT,
-          roqmux->quicmux, req_pad_templ);
-      gst_object_unref (rv);
+          quicmux, req_pad_templ);
+      gst_element_remove_pad (GST_ELEMENT (roqmux), rv);
       return NULL;
     }
 
-    remote = gst_element_request_pad (roqmux->quicmux, quicmux_pad_templ, NULL,
+    remote = gst_element_request_pad (quicmux, quicmux_pad_templ, NULL,
       NULL);
 
     link_rv = gst_pad_link (rv, remote);
@@ -831,113 +2255,2015 @@ rtp_quic_mux_new_uni_src_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
           break;
       }
 
-      gst_object_unref (rv);
+      gst_element_remove_pad (GST_ELEMENT (roqmux), rv);
       gst_object_unref (remote);
-      rv = NULL;
       return NULL;
     }
   }
 
-  g_rec_mutex_unlock (&roqmux->mutex);
-
   g_signal_connect (rv, "unlinked", 
       (GCallback) rtp_quic_mux_pad_unlinked_callback, (gpointer) roqmux);
 
-  gst_pad_sticky_events_foreach (sinkpad, rtp_quic_mux_foreach_sticky_event,
-      (gpointer) rv);
-
-  GST_TRACE_OBJECT (roqmux, "Opened new stream with pad %" GST_PTR_FORMAT 
-      " linked to pad %" GST_PTR_FORMAT, rv, GST_PAD_PEER (rv));
-
   return rv;
 }
 
-void
-rtp_quic_mux_pad_added_callback (GstElement *self, GstPad *pad,
-    gpointer user_data)
+/*
+ * Top the pool of pre-opened stream pads back up to stream-pool-size. Called
+ * from the element's async call thread so that the streaming thread never
+ * waits for a link.
+ */
+static void
+rtp_quic_mux_refill_stream_pool (GstElement *element, gpointer user_data)
 {
-  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (self);
-
-  g_rec_mutex_lock (&roqmux->mutex);
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (element);
 
-  if (!gst_pad_is_linked (pad)) {
-    g_assert (roqmux->quicmux != NULL);
+  while (TRUE) {
+    GstPad *pad;
+    guint len;
 
-    if (!gst_element_link_pads (self, GST_PAD_NAME (pad), roqmux->quicmux, NULL)) {
-      GST_WARNING_OBJECT (roqmux, "Couldn't link new pad %s to QuicMux %p!",
-          GST_PAD_NAME (pad), roqmux->quicmux);
+    GST_OBJECT_LOCK (roqmux);
+    len = g_queue_get_length (&roqmux->stream_pad_pool);
+    if (len >= roqmux->stream_pool_size) {
+      roqmux->stream_pool_refilling = FALSE;
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
     }
-  } else if (roqmux->quicmux == NULL) {
-    roqmux->quicmux = gst_pad_get_parent_element (gst_pad_get_peer (pad));
-    g_assert (roqmux->quicmux != NULL);
+    GST_OBJECT_UNLOCK (roqmux);
+
+    pad = rtp_quic_mux_open_uni_src_pad (roqmux);
+    if (pad == NULL) {
+      GST_WARNING_OBJECT (roqmux, "Couldn't open stream pad for the pool");
+      GST_OBJECT_LOCK (roqmux);
+      roqmux->stream_pool_refilling = FALSE;
+      GST_OBJECT_UNLOCK (roqmux);
+      break;
+    }
+
+    GST_TRACE_OBJECT (roqmux, "Adding pad %" GST_PTR_FORMAT " to stream pool "
+        "of %u pads", pad, len + 1);
+
+    GST_OBJECT_LOCK (roqmux);
+    g_queue_push_tail (&roqmux->stream_pad_pool, pad);
+    GST_OBJECT_UNLOCK (roqmux);
+  }
+}
+
+GstPad *
+rtp_quic_mux_new_uni_src_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
+{
+  GstPad *rv;
+
+  GST_OBJECT_LOCK (roqmux);
+  rv = (GstPad *) g_queue_pop_head (&roqmux->stream_pad_pool);
+  if (roqmux->stream_pool_size > 0 &&
+      g_atomic_pointer_get (&roqmux->quicmux) != NULL &&
+      !roqmux->stream_pool_refilling) {
+    roqmux->stream_pool_refilling = TRUE;
+    gst_element_call_async (GST_ELEMENT (roqmux),
+        rtp_quic_mux_refill_stream_pool, NULL, NULL);
+  }
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (rv) {
+    GST_TRACE_OBJECT (roqmux, "Took pad %" GST_PTR_FORMAT " from stream pool",
+        rv);
+    RTP_QUIC_MUX_COUNT (roqmux->stream_pool_hits, 1);
+  } else {
+    rv = rtp_quic_mux_open_uni_src_pad (roqmux);
+    if (rv == NULL) {
+      return NULL;
+    }
+  }
+
+  gst_pad_sticky_events_foreach (sinkpad, rtp_quic_mux_foreach_sticky_event,
+      (gpointer) rv);
+
+  GST_TRACE_OBJECT (roqmux, "Opened new stream with pad %" GST_PTR_FORMAT 
+      " linked to pad %" GST_PTR_FORMAT, rv, GST_PAD_PEER (rv));
+
+  return rv;
+}
+
+void
+rtp_quic_mux_pad_added_callback (GstElement *self, GstPad *pad,
+    gpointer user_data)
+{
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (self);
+  GstElement *quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+
+  if (!gst_pad_is_linked (pad)) {
+    g_assert (quicmux != NULL);
+
+    if (!gst_element_link_pads (self, GST_PAD_NAME (pad), quicmux, NULL)) {
+      GST_WARNING_OBJECT (roqmux, "Couldn't link new pad %s to QuicMux %p!",
+          GST_PAD_NAME (pad), quicmux);
+    }
+  } else if (quicmux == NULL) {
+    quicmux = gst_pad_get_parent_element (gst_pad_get_peer (pad));
+    g_assert (quicmux != NULL);
+
+    if (g_atomic_pointer_compare_and_exchange (&roqmux->quicmux, NULL,
+          quicmux)) {
+      GST_TRACE_OBJECT (roqmux, "Stored downstream QuicMux element %p",
+          quicmux);
+    } else {
+      gst_object_unref (quicmux);
+    }
+  }
+}
+
+const gchar *
+rtp_quic_mux_flow_return_as_string (GstFlowReturn fr)
+{
+  if (fr >= GST_FLOW_CUSTOM_SUCCESS) {
+    return "Flow Custom Success";
+  }
+  if (fr <= GST_FLOW_CUSTOM_ERROR) {
+    return "Flow Custom Error";
+  }
+  switch (fr) {
+  case GST_FLOW_OK:
+    return "OK";
+  case GST_FLOW_NOT_LINKED:
+    return "Not Linked";
+  case GST_FLOW_FLUSHING:
+    return "Flushing";
+  case GST_FLOW_EOS:
+    return "End Of Stream";
+  case GST_FLOW_NOT_NEGOTIATED:
+    return "Not negotiated";
+  case GST_FLOW_ERROR:
+    return "Fatal Error";
+  case GST_FLOW_NOT_SUPPORTED:
+    return "Operation Not Supported";
+  default:
+    /* Fall through */
+  }
+  return "Unknown Flow Return!";
+}
+
+static gboolean
+_rtp_quic_mux_open_datagram_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
+{
+  GstPad *pad;
+  gchar *padname;
+  gboolean rv;
+
+  /* Every sink pad shares the one datagram pad, so only open it once */
+  g_mutex_lock (&roqmux->datagram_pad_lock);
+
+  if (g_atomic_pointer_get (&roqmux->datagram_pad) != NULL) {
+    g_mutex_unlock (&roqmux->datagram_pad_lock);
+    return TRUE;
+  }
+
+  padname = g_strdup_printf (quic_datagram_src_factory.name_template,
+      0);
+
+  pad = gst_pad_new_from_static_template (&quic_datagram_src_factory,
+      padname);
+
+  g_assert (pad);
+
+  g_free (padname);
+
+  g_signal_connect (pad, "linked",
+      (GCallback) rtp_quic_mux_datagram_pad_linked_callback, (gpointer) roqmux);
+
+  gst_pad_set_active (pad, TRUE);
+  rv = gst_element_add_pad (GST_ELEMENT (roqmux), pad);
+
+  if (!rv) {
+    g_mutex_unlock (&roqmux->datagram_pad_lock);
+    return FALSE;
+  }
+
+  if (g_atomic_pointer_get (&roqmux->quicmux) == NULL) {
+    GstElement *quicmux = gst_pad_get_parent_element (GST_PAD_PEER (pad));
+
+    if (quicmux != NULL && !g_atomic_pointer_compare_and_exchange (
+          &roqmux->quicmux, NULL, quicmux)) {
+      gst_object_unref (quicmux);
+    }
+  }
+
+  gst_pad_sticky_events_foreach (sinkpad, rtp_quic_mux_foreach_sticky_event,
+      (gpointer) pad);
+
+  g_atomic_pointer_set (&roqmux->datagram_pad, pad);
+
+  g_mutex_unlock (&roqmux->datagram_pad_lock);
+
+  return rv;
+}
+
+/*
+ * Close the current QUIC stream for this RoQ stream, if there is one.
+ */
+static void
+rtp_quic_mux_stream_close_pad (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream)
+{
+  if (stream->stream_pad && stream->pacer_flow) {
+    /* Buffers for the pad may still be waiting to be paced out */
+    gst_pad_set_element_private (stream->stream_pad, NULL);
+    gst_roq_pacer_push (roqmux->pacer, stream->pacer_flow,
+        gst_object_ref (stream->stream_pad), NULL, stream->pace_next);
+    stream->stream_pad = NULL;
+  } else if (stream->stream_pad) {
+    gst_pad_set_active (stream->stream_pad, FALSE);
+    /* Unhook the stream first so the unlinked callback leaves it alone */
+    gst_pad_set_element_private (stream->stream_pad, NULL);
+    gst_element_remove_pad (GST_ELEMENT (roqmux), stream->stream_pad);
+    stream->stream_pad = NULL;
+  }
+  stream->stream_offset = 0;
+  stream->mid_frame = FALSE;
+}
+
+static GstClockTime
+rtp_quic_mux_buffer_running_time (GstPad *sinkpad, GstBuffer *buf)
+{
+  RtpQuicMuxSink *sink = gst_pad_get_element_private (sinkpad);
+
+  if (sink == NULL) {
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  return gst_segment_to_running_time (&sink->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buf));
+}
+
+/*
+ * How often quicmux is asked again for the peer's per-stream flow control
+ * limit while it hasn't answered.
+ */
+#define RTP_QUIC_MUX_MAX_STREAM_DATA_RETRY GST_SECOND
+
+/*
+ * Ask quicmux how much data the peer allows on each unidirectional stream, so
+ * that streams can be rolled over before they hit stream flow control. Asked
+ * as streams are opened until quicmux answers, but not more than once every
+ * RTP_QUIC_MUX_MAX_STREAM_DATA_RETRY.
+ */
+static void
+rtp_quic_mux_query_max_stream_data (GstRtpQuicMux *roqmux)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstElement *quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+  GstQuery *query;
+
+  if (quicmux == NULL) {
+    return;
+  }
+
+  GST_OBJECT_LOCK (roqmux);
+  if (roqmux->max_stream_data_queried ||
+      (GST_CLOCK_TIME_IS_VALID (roqmux->max_stream_data_next_query) &&
+          now < roqmux->max_stream_data_next_query)) {
+    GST_OBJECT_UNLOCK (roqmux);
+    return;
+  }
+  roqmux->max_stream_data_next_query =
+      now + RTP_QUIC_MUX_MAX_STREAM_DATA_RETRY;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  gst_object_ref (quicmux);
+
+  query = gst_query_new_custom (GST_QUERY_CUSTOM,
+      gst_structure_new_empty (RTP_QUIC_MUX_MAX_STREAM_DATA_QUERY));
+
+  if (gst_element_query (quicmux, query)) {
+    const GstStructure *s = gst_query_get_structure (query);
+    guint64 max_stream_data;
+
+    if (gst_structure_get_uint64 (s, "max-stream-data", &max_stream_data)) {
+      GST_DEBUG_OBJECT (roqmux, "Peer allows %lu bytes per stream",
+          max_stream_data);
+      GST_OBJECT_LOCK (roqmux);
+      roqmux->peer_max_stream_data = max_stream_data;
+      roqmux->max_stream_data_queried = TRUE;
+      GST_OBJECT_UNLOCK (roqmux);
+    }
+  } else {
+    GST_DEBUG_OBJECT (roqmux, "quicmux didn't answer max stream data query, "
+        "using max-stream-bytes of %lu", roqmux->max_stream_bytes);
+  }
+
+  gst_query_unref (query);
+  gst_object_unref (quicmux);
+}
+
+/*
+ * How often quicmux is asked again for the largest datagram payload. It's
+ * asked even once it has answered, as the answer can grow while the handshake
+ * and path MTU discovery settle.
+ */
+#define RTP_QUIC_MUX_MAX_DATAGRAM_PAYLOAD_RETRY GST_SECOND
+
+/*
+ * Ask quicmux for the largest datagram payload the connection can carry, if
+ * it hasn't been asked in the last RTP_QUIC_MUX_MAX_DATAGRAM_PAYLOAD_RETRY.
+ * Only counts as asked once quicmux is known.
+ */
+static void
+rtp_quic_mux_query_max_datagram_payload (GstRtpQuicMux *roqmux)
+{
+  GstClockTime now;
+  GstElement *quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+  GstQuery *query;
+
+  if (quicmux == NULL) {
+    return;
+  }
+
+  /* Only the first thread to get here each time asks */
+  now = gst_util_get_timestamp ();
+  GST_OBJECT_LOCK (roqmux);
+  if (GST_CLOCK_TIME_IS_VALID (roqmux->max_datagram_payload_next_query) &&
+      now < roqmux->max_datagram_payload_next_query) {
+    GST_OBJECT_UNLOCK (roqmux);
+    return;
+  }
+  roqmux->max_datagram_payload_next_query =
+      now + RTP_QUIC_MUX_MAX_DATAGRAM_PAYLOAD_RETRY;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  gst_object_ref (quicmux);
+
+  query = gst_query_new_custom (GST_QUERY_CUSTOM,
+      gst_structure_new_empty (RTP_QUIC_MUX_MAX_DATAGRAM_PAYLOAD_QUERY));
+
+  if (gst_element_query (quicmux, query)) {
+    const GstStructure *s = gst_query_get_structure (query);
+    guint64 max_payload;
+
+    if (gst_structure_get_uint64 (s, "max-datagram-payload", &max_payload) &&
+        max_payload > 0) {
+      GST_DEBUG_OBJECT (roqmux, "Connection carries datagram payloads of up "
+          "to %lu bytes", max_payload);
+      g_atomic_pointer_set (&roqmux->max_datagram_payload,
+          (gsize) max_payload);
+    }
+  } else {
+    GST_DEBUG_OBJECT (roqmux, "quicmux didn't answer max datagram payload "
+        "query, using datagram-mtu of %u", roqmux->datagram_mtu);
+  }
+
+  gst_query_unref (query);
+  gst_object_unref (quicmux);
+}
+
+/*
+ * Forget the largest datagram payload quicmux gave, and ask again when the
+ * next datagram is sent.
+ */
+static void
+rtp_quic_mux_reset_max_datagram_payload (GstRtpQuicMux *roqmux)
+{
+  GST_OBJECT_LOCK (roqmux);
+  roqmux->max_datagram_payload_next_query = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  g_atomic_pointer_set (&roqmux->max_datagram_payload, 0);
+}
+
+/* A newly linked datagram pad may well lead to a different connection */
+static void
+rtp_quic_mux_datagram_pad_linked_callback (GstPad *self, GstPad *peer,
+    gpointer user_data)
+{
+  rtp_quic_mux_reset_max_datagram_payload (GST_RTPQUICMUX (user_data));
+}
+
+/*
+ * The largest RoQ datagram payload, flow identifier included, that can be sent.
+ */
+static guint64
+rtp_quic_mux_datagram_limit (GstRtpQuicMux *roqmux)
+{
+  gsize max_payload;
+
+  rtp_quic_mux_query_max_datagram_payload (roqmux);
+
+  max_payload = (gsize) g_atomic_pointer_get (&roqmux->max_datagram_payload);
+  if (max_payload > 0) {
+    return max_payload;
+  }
+
+  return roqmux->datagram_mtu;
+}
+
+/*
+ * Returns TRUE if buf fits in a QUIC datagram along with its flow identifier.
+ * Otherwise counts it as oversized, as it would only be lost if it were sent.
+ */
+static gboolean
+rtp_quic_mux_datagram_fits (GstRtpQuicMux *roqmux, GstBuffer *buf,
+    gint64 flow_id)
+{
+  gsize size = gst_buffer_get_size (buf) +
+      gst_quiclib_set_varint (flow_id, NULL);
+  guint64 limit = rtp_quic_mux_datagram_limit (roqmux);
+
+  if (G_LIKELY (size <= limit)) {
+    return TRUE;
+  }
+
+  if (g_atomic_pointer_add (&roqmux->datagrams_oversized, 1) == 0) {
+    GST_WARNING_OBJECT (roqmux, "Dropping packet of %lu bytes with its RoQ "
+        "header, QUIC datagrams can only carry %lu bytes. Set the mtu of the "
+        "RTP payloader to %lu or less", size, limit,
+        limit - gst_quiclib_set_varint (flow_id, NULL));
+  } else {
+    GST_DEBUG_OBJECT (roqmux, "Dropping packet of %lu bytes, datagram limit "
+        "%lu bytes", size, limit);
+  }
+
+  return FALSE;
+}
+
+/*
+ * With every packet going in a datagram, check the mtu property of the element
+ * upstream of a sink pad, normally an RTP payloader, against what fits. It is
+ * only lowered if fit-payloader-mtu is set, as that reaches into another
+ * element. Looks through ghost pads, such as those of roqsinkbin.
+ */
+static void
+rtp_quic_mux_sink_fit_payloader (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink)
+{
+  GstPad *peer = gst_pad_get_peer (sink->sink);
+  GstElement *payloader;
+  GParamSpec *pspec;
+  guint64 limit, overhead;
+  guint mtu, fit;
+
+  sink->payloader_checked = TRUE;
+
+  while (peer != NULL && GST_IS_PROXY_PAD (peer)) {
+    GstPad *next;
+
+    if (GST_IS_GHOST_PAD (peer)) {
+      /* The outside of a bin, so go in to the ghost pad's target */
+      next = gst_ghost_pad_get_target (GST_GHOST_PAD (peer));
+    } else {
+      /* The inside of a ghost pad, so carry on from the ghost pad's peer */
+      GstPad *ghost = GST_PAD (gst_proxy_pad_get_internal (
+            GST_PROXY_PAD (peer)));
+
+      next = (ghost)?(gst_pad_get_peer (ghost)):(NULL);
+      if (ghost) {
+        gst_object_unref (ghost);
+      }
+    }
+
+    gst_object_unref (peer);
+    peer = next;
+  }
+
+  if (peer == NULL) {
+    return;
+  }
+
+  payloader = gst_pad_get_parent_element (peer);
+  gst_object_unref (peer);
+
+  if (payloader == NULL) {
+    return;
+  }
+
+  pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (payloader),
+      "mtu");
+  if (pspec == NULL || pspec->value_type != G_TYPE_UINT ||
+      !(pspec->flags & G_PARAM_WRITABLE)) {
+    GST_DEBUG_OBJECT (roqmux, "%" GST_PTR_FORMAT " has no mtu property to "
+        "fit to datagrams", payloader);
+    gst_object_unref (payloader);
+    return;
+  }
+
+  limit = rtp_quic_mux_datagram_limit (roqmux);
+  overhead = gst_quiclib_set_varint (sink->rtp_flow_id, NULL);
+
+  if (roqmux->fec_block_size > 0) {
+    /* Repair packets are as long as the longest packet they protect */
+    overhead += GST_ROQ_FEC_HEADER_LEN +
+        gst_quiclib_set_varint (roqmux->fec_flow_id, NULL);
+  }
+
+  if (limit <= overhead) {
+    GST_WARNING_OBJECT (roqmux, "Datagrams of %lu bytes leave no room for "
+        "RTP packets after %lu bytes of RoQ headers", limit, overhead);
+    gst_object_unref (payloader);
+    return;
+  }
+  fit = (guint) MIN (limit - overhead, G_MAXUINT);
+
+  g_object_get (payloader, "mtu", &mtu, NULL);
+  if (mtu > fit && roqmux->fit_payloader_mtu) {
+    GST_INFO_OBJECT (roqmux, "Lowering mtu of %" GST_PTR_FORMAT " from %u to "
+        "%u so that its packets fit in QUIC datagrams", payloader, mtu, fit);
+    g_object_set (payloader, "mtu", fit, NULL);
+  } else if (mtu > fit) {
+    GST_WARNING_OBJECT (roqmux, "The mtu of %" GST_PTR_FORMAT " is %u, but "
+        "only packets of up to %u bytes fit in QUIC datagrams. Lower it, or "
+        "set fit-payloader-mtu", payloader, mtu, fit);
+  }
+
+  gst_object_unref (payloader);
+}
+
+/*
+ * Returns TRUE if the next frame might not fit on the current QUIC stream
+ * without going over the per-stream flow control limit, judging by the largest
+ * frame seen so far.
+ */
+static gboolean
+rtp_quic_mux_stream_over_budget (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, GstBuffer *buf)
+{
+  guint64 limit = roqmux->peer_max_stream_data;
+  guint64 next;
+
+  if (limit == 0) {
+    limit = roqmux->max_stream_bytes;
+  }
+
+  if (limit == 0 || stream->mid_frame || stream->stream_offset == 0) {
+    return FALSE;
+  }
+
+  next = MAX (stream->max_frame_bytes,
+      gst_buffer_get_size (buf) + RTP_QUIC_MUX_MAX_HEADER_LEN);
+
+  return stream->stream_offset + next > limit;
+}
+
+/*
+ * Ask quicmux for the connection statistics. Returns a copy of the answer to
+ * be freed by the caller, or NULL if quicmux isn't known yet or can't answer.
+ */
+static GstStructure *
+rtp_quic_mux_query_connection_stats (GstRtpQuicMux *roqmux)
+{
+  GstElement *quicmux = NULL;
+  GstQuery *query;
+  GstStructure *stats = NULL;
+
+  quicmux = g_atomic_pointer_get (&roqmux->quicmux);
+  if (quicmux) {
+    gst_object_ref (quicmux);
+  }
+
+  if (quicmux == NULL) {
+    return NULL;
+  }
+
+  query = gst_query_new_custom (GST_QUERY_CUSTOM,
+      gst_structure_new_empty (RTP_QUIC_MUX_CONNECTION_STATS_QUERY));
+
+  if (gst_element_query (quicmux, query)) {
+    stats = gst_structure_copy (gst_query_get_structure (query));
+  } else {
+    GST_LOG_OBJECT (roqmux, "No connection statistics available");
+  }
+
+  gst_query_unref (query);
+  gst_object_unref (quicmux);
+
+  return stats;
+}
+
+/*
+ * Step the boundary chosen by the auto mode one place towards more streams
+ * (single, GOP, frame) when the connection looks lossy, or back towards fewer
+ * when it looks clean. A step is only taken after auto-hold evaluations in a
+ * row have agreed, so that the mapping doesn't flap.
+ */
+static void
+rtp_quic_mux_auto_boundary_update (GstRtpQuicMux *roqmux)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstStructure *stats;
+  guint64 rtt = 0, sent = 0, lost = 0, cwnd = 0;
+  gdouble loss = 0.0;
+  gint direction = 0;
+  GstRtpQuicMuxStreamBoundary prev, next;
+
+  GST_OBJECT_LOCK (roqmux);
+  if (GST_CLOCK_TIME_IS_VALID (roqmux->auto_next_update) &&
+      now < roqmux->auto_next_update) {
+    GST_OBJECT_UNLOCK (roqmux);
+    return;
+  }
+  roqmux->auto_next_update = now + roqmux->auto_interval;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  stats = rtp_quic_mux_query_connection_stats (roqmux);
+  if (stats == NULL) {
+    gboolean warn;
+
+    GST_OBJECT_LOCK (roqmux);
+    warn = !roqmux->auto_stats_warned;
+    roqmux->auto_stats_warned = TRUE;
+    GST_OBJECT_UNLOCK (roqmux);
+
+    if (warn) {
+      GST_WARNING_OBJECT (roqmux, "quicmux didn't answer connection "
+          "statistics query, auto stream boundary stays at %s",
+          _rtp_quic_mux_stream_boundary_as_string (
+              rtp_quic_mux_boundary (roqmux)));
+    }
+    return;
+  }
+
+  gst_structure_get_uint64 (stats, "rtt", &rtt);
+  gst_structure_get_uint64 (stats, "packets-sent", &sent);
+  gst_structure_get_uint64 (stats, "packets-lost", &lost);
+  gst_structure_get_uint64 (stats, "cwnd", &cwnd);
+
+  gst_structure_free (stats);
+
+  GST_OBJECT_LOCK (roqmux);
+  if (sent > roqmux->auto_packets_sent) {
+    loss = (gdouble) (lost - MIN (lost, roqmux->auto_packets_lost)) /
+        (gdouble) (sent - roqmux->auto_packets_sent);
+  }
+  roqmux->auto_packets_sent = sent;
+  roqmux->auto_packets_lost = lost;
+
+  if (loss > roqmux->auto_loss_high ||
+      (rtt > roqmux->auto_rtt_high && loss > roqmux->auto_loss_low)) {
+    direction = 1;
+  } else if (loss < roqmux->auto_loss_low && rtt < roqmux->auto_rtt_high) {
+    direction = -1;
+  }
+
+  if (direction == 0 || direction != roqmux->auto_direction) {
+    roqmux->auto_direction = direction;
+    roqmux->auto_votes = (direction != 0)?(1):(0);
+  } else {
+    roqmux->auto_votes++;
+  }
+
+  prev = next = roqmux->auto_boundary;
+
+  if (roqmux->auto_votes >= roqmux->auto_hold) {
+    if (direction > 0) {
+      if (next == STREAM_BOUNDARY_SINGLE_STREAM) {
+        next = STREAM_BOUNDARY_GOP;
+      } else if (next == STREAM_BOUNDARY_GOP) {
+        next = STREAM_BOUNDARY_FRAME;
+      }
+    } else {
+      if (next == STREAM_BOUNDARY_FRAME) {
+        next = STREAM_BOUNDARY_GOP;
+      } else if (next == STREAM_BOUNDARY_GOP) {
+        next = STREAM_BOUNDARY_SINGLE_STREAM;
+      }
+    }
+
+    g_atomic_int_set ((gint *) &roqmux->auto_boundary, next);
+    roqmux->auto_votes = 0;
+  }
+  GST_OBJECT_UNLOCK (roqmux);
+
+  GST_LOG_OBJECT (roqmux, "Connection RTT %" GST_TIME_FORMAT ", loss %.4f, "
+      "cwnd %lu bytes", GST_TIME_ARGS (rtt), loss, cwnd);
+
+  if (next != prev) {
+    GST_INFO_OBJECT (roqmux, "Connection RTT %" GST_TIME_FORMAT ", loss "
+        "%.4f, cwnd %lu bytes: switching stream boundary from %s to %s",
+        GST_TIME_ARGS (rtt), loss, cwnd,
+        _rtp_quic_mux_stream_boundary_as_string (prev),
+        _rtp_quic_mux_stream_boundary_as_string (next));
+  }
+}
+
+/*
+ * Returns TRUE if sending buf will cause the stream to move onto a new QUIC
+ * stream before buf is sent.
+ */
+static gboolean
+rtp_quic_mux_stream_needs_rollover (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstBuffer *buf)
+{
+  if (stream->stream_pad == NULL) {
+    return FALSE;
+  }
+
+  if (rtp_quic_mux_stream_over_budget (roqmux, stream, buf)) {
+    return TRUE;
+  }
+
+  switch (rtp_quic_mux_boundary (roqmux)) {
+    case STREAM_BOUNDARY_GOP:
+      /* Start of a new GOP, and the current stream already has enough */
+      return !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) &&
+          stream->counter >= roqmux->stream_packing_ratio;
+    case STREAM_BOUNDARY_DURATION:
+    {
+      GstClockTime running_time;
+
+      /* Only ever cut between frames */
+      if (stream->mid_frame ||
+          !GST_CLOCK_TIME_IS_VALID (stream->stream_start_time)) {
+        return FALSE;
+      }
+
+      running_time = rtp_quic_mux_buffer_running_time (sinkpad, buf);
+
+      return GST_CLOCK_TIME_IS_VALID (running_time) &&
+          running_time >= stream->stream_start_time + roqmux->stream_duration;
+    }
+    default:
+      break;
+  }
+
+  return FALSE;
+}
+
+/*
+ * Returns TRUE if rtp_quic_mux_stream_prepare might map buf onto a different
+ * QUIC stream from the one the last buffer went on: because that pad has been
+ * unlinked or closed, because the stream needs rolling over, or because the
+ * auto boundary is about to be looked at again.
+ */
+static gboolean
+rtp_quic_mux_stream_may_switch_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstBuffer *buf)
+{
+  if (stream->stream_pad == NULL ||
+      g_atomic_pointer_get (&stream->unlinked_pad) == stream->stream_pad) {
+    return TRUE;
+  }
+
+  if (roqmux->stream_boundary == STREAM_BOUNDARY_AUTO && !stream->mid_frame) {
+    return TRUE;
+  }
+
+  return rtp_quic_mux_stream_needs_rollover (roqmux, sinkpad, stream, buf);
+}
+
+/*
+ * Returns TRUE if the buffer just prepared by rtp_quic_mux_stream_prepare
+ * completes the current QUIC stream.
+ */
+static gboolean
+rtp_quic_mux_stream_is_complete (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, gboolean marker)
+{
+  return rtp_quic_mux_boundary (roqmux) == STREAM_BOUNDARY_FRAME && marker &&
+      stream->counter >= roqmux->stream_packing_ratio;
+}
+
+/*
+ * Look up the priority for a new QUIC stream in the priority-map, by flow
+ * identifier, then enhancement layer, then media type and frame type, then
+ * media type, then default.
+ * Must be called with the object lock held.
+ */
+static void
+rtp_quic_mux_lookup_priority (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstBuffer *buf, guint *urgency, gboolean *incremental)
+{
+  const GstStructure *map = roqmux->priority_map;
+  gchar *key;
+  gboolean found;
+
+  *urgency = RTP_QUIC_MUX_DEFAULT_URGENCY;
+  *incremental = FALSE;
+
+  gst_structure_get_boolean (map, "incremental", incremental);
+
+  key = g_strdup_printf ("flow-%ld", stream->flow_id);
+  found = gst_structure_get_uint (map, key, urgency);
+  g_free (key);
+  if (found) {
+    return;
+  }
+
+  if (stream->media && stream->layer > 0) {
+    key = g_strdup_printf ("%s-enhancement", stream->media);
+    found = gst_structure_get_uint (map, key, urgency);
+    g_free (key);
+    if (found) {
+      return;
+    }
+  }
+
+  if (stream->media) {
+    key = g_strdup_printf ("%s-%s", stream->media,
+        GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) ?
+        "delta" : "keyframe");
+    found = gst_structure_get_uint (map, key, urgency);
+    g_free (key);
+    if (found || gst_structure_get_uint (map, stream->media, urgency)) {
+      return;
+    }
+  }
+
+  gst_structure_get_uint (map, "default", urgency);
+}
+
+/*
+ * Tell quicmux how urgent a newly opened QUIC stream is, using a sticky
+ * "roq-stream-priority" event carrying RFC 9218 style urgency and incremental
+ * parameters. Does nothing if no priority-map has been set.
+ */
+static void
+rtp_quic_mux_stream_send_priority (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, GstBuffer *buf)
+{
+  guint urgency;
+  gboolean incremental;
+  GstEvent *event;
+
+  GST_OBJECT_LOCK (roqmux);
+  if (roqmux->priority_map == NULL) {
+    GST_OBJECT_UNLOCK (roqmux);
+    return;
+  }
+  rtp_quic_mux_lookup_priority (roqmux, stream, buf, &urgency, &incremental);
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (urgency > RTP_QUIC_MUX_MAX_URGENCY) {
+    urgency = RTP_QUIC_MUX_MAX_URGENCY;
+  }
+
+  GST_DEBUG_OBJECT (roqmux, "New stream on pad %" GST_PTR_FORMAT " has "
+      "urgency %u%s", stream->stream_pad, urgency,
+      (incremental)?(", incremental"):(""));
+
+  event = gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM_STICKY,
+      gst_structure_new (RTP_QUIC_MUX_PRIORITY_EVENT,
+          "urgency", G_TYPE_UINT, urgency,
+          "incremental", G_TYPE_BOOLEAN, incremental,
+          "flow-id", G_TYPE_UINT64, (guint64) stream->flow_id, NULL));
+
+  gst_pad_push_event (stream->stream_pad, event);
+}
+
+/*
+ * Map an RTP buffer onto the QUIC stream for the given RoQ stream, opening a
+ * new QUIC stream if the stream boundary requires it, and write the RoQ header.
+ *
+ * On return, target_pad holds a reference to the pad to push buf on, or is
+ * NULL if buf was dropped because the frame it is part of was cancelled.
+ */
+static GstFlowReturn
+rtp_quic_mux_stream_prepare (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstBuffer **buf, GstPad **target_pad)
+{
+  *target_pad = NULL;
+
+  if (stream->wait_for_keyframe) {
+    if (GST_BUFFER_FLAG_IS_SET (*buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+      gst_buffer_unref (*buf);
+      *buf = NULL;
+      return GST_FLOW_OK;
+    }
+
+    GST_DEBUG_OBJECT (roqmux, "Keyframe arrived, sending again");
+    stream->wait_for_keyframe = FALSE;
+    stream->frame_cancelled = FALSE;
+  }
+
+  if (stream->frame_cancelled) {
+    if (GST_BUFFER_FLAGS (*buf) & GST_BUFFER_FLAG_MARKER) {
+      /* Start of a new frame, so start sending again */
+      GST_DEBUG_OBJECT (roqmux, "New frame started, sending again");
+      stream->frame_cancelled = FALSE;
+    } else {
+      gst_buffer_unref (*buf);
+      *buf = NULL;
+      return GST_FLOW_OK;
+    }
+  }
+
+  if (roqmux->stream_boundary == STREAM_BOUNDARY_AUTO && !stream->mid_frame) {
+    rtp_quic_mux_auto_boundary_update (roqmux);
+  }
+
+  GST_TRACE_OBJECT (roqmux, "Stream boundary %s, stream packing ratio %u, "
+      "stream counter %u, stream offset %lu, buffer flag marker %s, "
+      "buffer flag delta unit %s",
+      _rtp_quic_mux_stream_boundary_as_string (
+          rtp_quic_mux_boundary (roqmux)),
+       roqmux->stream_packing_ratio, stream->counter, stream->stream_offset,
+      (GST_BUFFER_FLAGS (*buf) & GST_BUFFER_FLAG_MARKER)?("set"):("not set"),
+      (GST_BUFFER_FLAGS (*buf) & GST_BUFFER_FLAG_DELTA_UNIT)?("set"):
+          ("not set"));
+
+  if (stream->stream_pad != NULL &&
+      g_atomic_pointer_get (&stream->unlinked_pad) == stream->stream_pad) {
+    GST_DEBUG_OBJECT (roqmux, "Pad %" GST_PTR_FORMAT " was unlinked, moving "
+        "on to a new stream", stream->stream_pad);
+    rtp_quic_mux_stream_close_pad (roqmux, stream);
+    stream->counter = 0;
+  }
+
+  if (rtp_quic_mux_stream_needs_rollover (roqmux, sinkpad, stream, *buf)) {
+    if (rtp_quic_mux_stream_over_budget (roqmux, stream, *buf)) {
+      GST_DEBUG_OBJECT (roqmux, "Next frame could take stream offset %lu "
+          "past the per-stream limit", stream->stream_offset);
+      RTP_QUIC_MUX_COUNT (roqmux->budget_rollovers, 1);
+    } else {
+      GST_DEBUG_OBJECT (roqmux, "Start of new %s, stream is full",
+          (rtp_quic_mux_boundary (roqmux) == STREAM_BOUNDARY_GOP)?
+              ("GOP"):("frame"));
+    }
+    rtp_quic_mux_stream_close_pad (roqmux, stream);
+    stream->counter = 0;
+  }
+
+  if (stream->stream_pad == NULL) {
+    stream->stream_pad = rtp_quic_mux_new_uni_src_pad (roqmux, sinkpad);
+    if (stream->stream_pad == NULL) {
+      GST_ERROR_OBJECT (roqmux, "Couldn't open new unidirectional stream");
+      gst_buffer_unref (*buf);
+      *buf = NULL;
+      return GST_FLOW_NOT_LINKED;
+    }
+    gst_pad_set_element_private (stream->stream_pad, stream);
+    stream->stream_offset = 0;
+    stream->stream_start_time =
+        rtp_quic_mux_buffer_running_time (sinkpad, *buf);
+
+    rtp_quic_mux_query_max_stream_data (roqmux);
+
+    rtp_quic_mux_stream_send_priority (roqmux, stream, *buf);
+  }
+
+  if ((rtp_quic_mux_boundary (roqmux) == STREAM_BOUNDARY_FRAME &&
+        GST_BUFFER_FLAG_IS_SET (*buf, GST_BUFFER_FLAG_MARKER)) ||
+      (rtp_quic_mux_boundary (roqmux) == STREAM_BOUNDARY_GOP &&
+        !GST_BUFFER_FLAG_IS_SET (*buf, GST_BUFFER_FLAG_DELTA_UNIT))) {
+    stream->counter++;
+  }
+
+  if (stream->stream_offset == 0) {
+    rtp_quic_mux_write_payload_header (roqmux, buf,
+        (roqmux->add_uni_stream_header)?(roqmux->uni_stream_type):(-1),
+        stream->flow_id, TRUE);
+  } else {
+    rtp_quic_mux_write_payload_header (roqmux, buf, -1, -1, TRUE);
+  }
+
+  (*buf)->offset = stream->stream_offset;
+  stream->stream_offset += gst_buffer_get_size (*buf);
+  stream->mid_frame = !GST_BUFFER_FLAG_IS_SET (*buf, GST_BUFFER_FLAG_MARKER);
+
+  stream->frame_bytes += gst_buffer_get_size (*buf);
+  if (!stream->mid_frame) {
+    stream->max_frame_bytes = MAX (stream->max_frame_bytes,
+        stream->frame_bytes);
+    stream->frame_bytes = 0;
+  }
+
+  *target_pad = gst_object_ref (stream->stream_pad);
+
+  RTP_QUIC_MUX_COUNT (roqmux->stream_frames_sent, 1);
+
+  return GST_FLOW_OK;
+}
+
+/*
+ * Ask upstream for a new keyframe after a frame has been cancelled, no more
+ * often than keyframe-request-interval.
+ */
+static void
+rtp_quic_mux_stream_request_keyframe (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstEvent *event;
+  GstPad *sink_pad;
+
+  if (GST_CLOCK_TIME_IS_VALID (stream->last_keyframe_request) &&
+      now - stream->last_keyframe_request <
+      roqmux->keyframe_request_interval) {
+    GST_LOG_OBJECT (roqmux, "Keyframe requested too recently, not asking "
+        "again");
+    return;
+  }
+  stream->last_keyframe_request = now;
+  sink_pad = stream->sink_pad;
+
+  if (sink_pad == NULL) {
+    return;
+  }
+
+  /*
+   * Equivalent to gst_video_event_new_upstream_force_key_unit (), without
+   * having to link against gst-plugins-base just for that.
+   */
+  event = gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM,
+      gst_structure_new ("GstForceKeyUnit",
+          "running-time", GST_TYPE_CLOCK_TIME, GST_CLOCK_TIME_NONE,
+          "all-headers", G_TYPE_BOOLEAN, TRUE,
+          "count", G_TYPE_UINT, 0, NULL));
+
+  GST_DEBUG_OBJECT (roqmux, "Requesting keyframe upstream of pad %"
+      GST_PTR_FORMAT, sink_pad);
+
+  if (gst_pad_push_event (sink_pad, event)) {
+    RTP_QUIC_MUX_COUNT (roqmux->keyframe_requests, 1);
+  } else {
+    GST_DEBUG_OBJECT (roqmux, "Keyframe request wasn't handled upstream");
+  }
+}
+
+/*
+ * Deal with the flow return from pushing one or more buffers on a QUIC stream.
+ */
+static GstFlowReturn
+rtp_quic_mux_stream_handle_flow_return (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, GstFlowReturn rv)
+{
+  if (rv == GST_FLOW_QUIC_STREAM_CLOSED) {
+    /*
+     * According to rtp-over-quic-09:
+     *
+     ** STOP_SENDING is not a request to the sender to stop sending RTP media,
+     ** only an indication that a RoQ receiver stopped reading the QUIC stream
+     ** being used. This can mean that the RoQ receiver is unable to make use of
+     ** the media frames being received because they are "too old" to be used. A
+     ** sender with additional media frames to send can continue sending them on
+     ** another QUIC stream. Alternatively, new media frames can be sent as QUIC
+     ** datagrams (see Section 5.3). In either case, a RoQ sender resuming 
+     ** operation after receiving STOP_SENDING can continue starting with the
+     ** newest media frames available for sending. This allows a RoQ receiver to
+     ** "fast forward" to media frames that are "new enough" to be used.
+     **
+     ** Any media frame that has already been sent on the QUIC stream that
+     ** received the STOP_SENDING frame, MUST NOT be sent again on the new QUIC
+     ** stream(s) or DATAGRAMs.
+     */
+
+    g_assert (!roqmux->use_datagrams);
+
+    GST_DEBUG_OBJECT (roqmux, "Stream closed, cancelling frame");
+
+    if (roqmux->datagram_fallback_threshold > 0) {
+      GstClockTime now = gst_util_get_timestamp ();
+
+      if (now - stream->stop_sending_window_start >
+          roqmux->datagram_fallback_window) {
+        stream->stop_sending_window_start = now;
+        stream->stop_sending_count = 0;
+      }
+
+      if (++stream->stop_sending_count >= roqmux->datagram_fallback_threshold
+          && !stream->datagram_fallback) {
+        GST_INFO_OBJECT (roqmux, "%u STOP_SENDINGs within %" GST_TIME_FORMAT
+            ", falling back to datagrams", stream->stop_sending_count,
+            GST_TIME_ARGS (roqmux->datagram_fallback_window));
+        stream->datagram_fallback = TRUE;
+        stream->datagram_fallback_at = now;
+        stream->stop_sending_count = 0;
+        RTP_QUIC_MUX_COUNT (roqmux->datagram_fallbacks, 1);
+      }
+    }
+    stream->frame_cancelled = TRUE;
+    stream->wait_for_keyframe = roqmux->wait_for_keyframe;
+    rtp_quic_mux_stream_close_pad (roqmux, stream);
+    stream->counter = 0;
+
+    /*
+     * An enhancement layer recovers by itself at the next layer sync point,
+     * there's no need to disturb the base layer with a keyframe.
+     */
+    if (roqmux->request_keyframe && stream->layer == 0) {
+      rtp_quic_mux_stream_request_keyframe (roqmux, stream);
+    }
+
+    rv = GST_FLOW_OK;
+  } else if (rv == GST_FLOW_QUIC_BLOCKED) {
+    GST_DEBUG_OBJECT (roqmux, "QUIC stream blocked and send queue disabled, "
+        "data has been dropped");
+    RTP_QUIC_MUX_COUNT (roqmux->send_queue_dropped, 1);
+  }
+
+  return rv;
+}
+
+/*
+ * Close the QUIC stream if the buffer that has just been pushed on it ended
+ * the last frame that the stream boundary and packing allows for.
+ */
+static void
+rtp_quic_mux_stream_sent (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    gboolean marker)
+{
+  if (rtp_quic_mux_stream_is_complete (roqmux, stream, marker)) {
+    GST_DEBUG_OBJECT (roqmux,
+        "End of frame, exceeding limit of %d, closing stream",
+        roqmux->stream_packing_ratio);
+    rtp_quic_mux_stream_close_pad (roqmux, stream);
+    stream->counter = 0;
+  }
+}
+
+/*
+ * How long a chain function blocked by the block-upstream send queue policy
+ * waits before retrying a blocked QUIC stream. quicmux doesn't tell us when a
+ * stream has credit again, so this is how soon we notice.
+ */
+#define RTP_QUIC_MUX_SEND_QUEUE_RETRY_US 5000
+
+/*
+ * Wake any chain functions waiting for their send queue to drain, so that
+ * they notice their pad flushing.
+ */
+static void
+rtp_quic_mux_send_queue_wake (GstRtpQuicMux *roqmux)
+{
+  g_mutex_lock (&roqmux->send_queue_lock);
+  g_cond_broadcast (&roqmux->send_queue_cond);
+  g_mutex_unlock (&roqmux->send_queue_lock);
+}
+
+/*
+ * Make every chain function waiting for its send queue to drain give up, and
+ * keep any more from waiting, until this is called again with FALSE.
+ */
+static void
+rtp_quic_mux_send_queue_set_flushing (GstRtpQuicMux *roqmux,
+    gboolean flushing)
+{
+  g_mutex_lock (&roqmux->send_queue_lock);
+  roqmux->send_queue_flushing = flushing;
+  g_cond_broadcast (&roqmux->send_queue_cond);
+  g_mutex_unlock (&roqmux->send_queue_lock);
+}
+
+/*
+ * Wait until a blocked QUIC stream is worth retrying. Returns FALSE if the
+ * sink pad started flushing instead.
+ */
+static gboolean
+rtp_quic_mux_send_queue_wait (GstRtpQuicMux *roqmux, GstPad *sinkpad)
+{
+  gint64 end_time = g_get_monotonic_time () + RTP_QUIC_MUX_SEND_QUEUE_RETRY_US;
+  gboolean flushing;
+
+  g_mutex_lock (&roqmux->send_queue_lock);
+  while (!(flushing = roqmux->send_queue_flushing ||
+          GST_PAD_IS_FLUSHING (sinkpad))) {
+    if (!g_cond_wait_until (&roqmux->send_queue_cond,
+            &roqmux->send_queue_lock, end_time)) {
+      break;
+    }
+  }
+  g_mutex_unlock (&roqmux->send_queue_lock);
+
+  return !flushing;
+}
+
+static inline gboolean
+rtp_quic_mux_queued_is_marker (GList *l)
+{
+  return GST_BUFFER_FLAG_IS_SET (((RtpQuicMuxQueuedBuffer *) l->data)->buf,
+      GST_BUFFER_FLAG_MARKER);
+}
+
+/*
+ * Remove the buffer at the head of the send queue.
+ */
+static GstBuffer *
+rtp_quic_mux_send_queue_pop (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstClockTime *queued_at)
+{
+  RtpQuicMuxQueuedBuffer *qb = g_queue_pop_head (&stream->send_queue);
+  GstBuffer *buf;
+  gsize size;
+
+  if (qb == NULL) {
+    return NULL;
+  }
+
+  buf = qb->buf;
+  size = gst_buffer_get_size (buf);
+  stream->send_queue_bytes -= size;
+  RTP_QUIC_MUX_COUNT (roqmux->send_queue_depth, -(gssize) size);
+  *queued_at = qb->queued_at;
+
+  g_slice_free (RtpQuicMuxQueuedBuffer, qb);
+
+  return buf;
+}
+
+/*
+ * Drop the oldest whole frame in the send queue, or the oldest whole frame that
+ * isn't referenced by others if delta_only is set. The rest of a frame that
+ * has already been partly written to the QUIC stream is never dropped.
+ * Returns FALSE if there was nothing to drop.
+ */
+static gboolean
+rtp_quic_mux_send_queue_drop_frame (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, gboolean delta_only)
+{
+  GList *l = stream->send_queue.head;
+
+  if (stream->mid_frame) {
+    while (l && !rtp_quic_mux_queued_is_marker (l)) {
+      l = l->next;
+    }
+    if (l) {
+      l = l->next;
+    }
+  }
+
+  while (l) {
+    GList *end = l;
+
+    while (end->next && !rtp_quic_mux_queued_is_marker (end)) {
+      end = end->next;
+    }
+
+    if (!delta_only || GST_BUFFER_FLAG_IS_SET (
+          ((RtpQuicMuxQueuedBuffer *) l->data)->buf,
+          GST_BUFFER_FLAG_DELTA_UNIT)) {
+      GList *stop = end->next;
+
+      if (!rtp_quic_mux_queued_is_marker (end)) {
+        /* The end of this frame hasn't arrived yet, drop that too */
+        stream->drop_until_marker = TRUE;
+      }
+
+      while (l != stop) {
+        GList *next = l->next;
+        RtpQuicMuxQueuedBuffer *qb = l->data;
+        gsize size = gst_buffer_get_size (qb->buf);
+
+        stream->send_queue_bytes -= size;
+        RTP_QUIC_MUX_COUNT (roqmux->send_queue_depth, -(gssize) size);
+        RTP_QUIC_MUX_COUNT (roqmux->send_queue_dropped, 1);
+
+        g_queue_delete_link (&stream->send_queue, l);
+        rtp_quic_mux_queued_buffer_free (qb);
+
+        l = next;
+      }
+
+      return TRUE;
+    }
+
+    l = end->next;
+  }
+
+  return FALSE;
+}
+
+/*
+ * Add an RTP buffer to the back of the send queue, and apply the overflow
+ * policy if that takes the queue over send-queue-max-bytes.
+ */
+static void
+rtp_quic_mux_send_queue_push (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstBuffer *buf)
+{
+  RtpQuicMuxQueuedBuffer *qb;
+  gsize size = gst_buffer_get_size (buf);
+
+  if (stream->drop_until_marker) {
+    if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER)) {
+      stream->drop_until_marker = FALSE;
+    }
+    RTP_QUIC_MUX_COUNT (roqmux->send_queue_dropped, 1);
+    gst_buffer_unref (buf);
+    return;
+  }
+
+  qb = g_slice_new (RtpQuicMuxQueuedBuffer);
+  qb->buf = buf;
+  qb->queued_at = gst_util_get_timestamp ();
+  g_queue_push_tail (&stream->send_queue, qb);
+  stream->send_queue_bytes += size;
+  RTP_QUIC_MUX_COUNT (roqmux->send_queue_depth, size);
+
+  if (roqmux->send_queue_policy == SEND_QUEUE_POLICY_BLOCK_UPSTREAM) {
+    return;
+  }
+
+  while (stream->send_queue_bytes > roqmux->send_queue_max_bytes) {
+    if (roqmux->send_queue_policy == SEND_QUEUE_POLICY_DROP_NON_REFERENCE &&
+        rtp_quic_mux_send_queue_drop_frame (roqmux, stream, TRUE)) {
+      continue;
+    }
+    if (!rtp_quic_mux_send_queue_drop_frame (roqmux, stream, FALSE)) {
+      GST_DEBUG_OBJECT (roqmux, "Send queue of %lu bytes is over its limit "
+          "but only holds the frame in progress", stream->send_queue_bytes);
+      break;
+    }
+  }
+}
+
+/*
+ * Push a buffer that has been mapped onto a QUIC stream. If the stream is
+ * blocked and the send queue is enabled, the buffer is kept to be retried
+ * before anything else on this RoQ stream. Takes ownership of buf and
+ * target_pad.
+ */
+static GstFlowReturn
+rtp_quic_mux_stream_push (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstPad *target_pad, GstBuffer *buf, GstClockTime queued_at)
+{
+  gboolean marker = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+  gboolean queue = roqmux->send_queue_max_bytes > 0;
+  GstFlowReturn rv;
+
+  GST_INFO_OBJECT (roqmux, "Pushing buffer %p (size %lu) on pad %"
+      GST_PTR_FORMAT, buf, gst_buffer_get_size (buf), target_pad);
+
+  if (queue) {
+    gst_buffer_ref (buf);
+  }
+
+  rv = gst_pad_push (target_pad, buf);
+
+  if (rv == GST_FLOW_QUIC_BLOCKED && queue) {
+    gsize size = gst_buffer_get_size (buf);
+
+    GST_DEBUG_OBJECT (roqmux, "QUIC stream blocked, holding buffer of %lu "
+        "bytes to retry", size);
+
+    stream->blocked_buf = buf;
+    stream->blocked_pad = target_pad;
+    stream->blocked_at = GST_CLOCK_TIME_IS_VALID (queued_at) ?
+        queued_at : gst_util_get_timestamp ();
+    stream->send_queue_bytes += size;
+    RTP_QUIC_MUX_COUNT (roqmux->send_queue_depth, size);
+
+    return GST_FLOW_OK;
+  }
+
+  if (queue) {
+    gst_buffer_unref (buf);
+  }
+  gst_object_unref (target_pad);
+
+  if (rv == GST_FLOW_OK && GST_CLOCK_TIME_IS_VALID (queued_at)) {
+    GstClockTime latency = gst_util_get_timestamp () - queued_at;
+
+    GST_OBJECT_LOCK (roqmux);
+    if (latency > roqmux->send_queue_max_latency) {
+      roqmux->send_queue_max_latency = latency;
+    }
+    GST_OBJECT_UNLOCK (roqmux);
+  }
+
+  rtp_quic_mux_stream_sent (roqmux, stream, marker);
+
+  return rtp_quic_mux_stream_handle_flow_return (roqmux, stream, rv);
+}
+
+/*
+ * How often the pacing rate reported by the QUIC transport is read again.
+ */
+#define RTP_QUIC_MUX_PACING_RATE_INTERVAL (100 * GST_MSECOND)
+
+/*
+ * The rate in bits per second to pace a stream at, either pacing-bitrate or
+ * the last pacing rate quicmux reported. 0 means no rate is known.
+ */
+static guint64
+rtp_quic_mux_pacing_rate (GstRtpQuicMux *roqmux)
+{
+  GstClockTime now;
+  GstStructure *stats;
+  guint64 rate;
+  gboolean update = FALSE;
+
+  if (roqmux->pacing_bitrate > 0) {
+    return roqmux->pacing_bitrate;
+  }
+
+  now = gst_util_get_timestamp ();
+
+  GST_OBJECT_LOCK (roqmux);
+  if (!GST_CLOCK_TIME_IS_VALID (roqmux->pacing_next_update) ||
+      now >= roqmux->pacing_next_update) {
+    roqmux->pacing_next_update = now + RTP_QUIC_MUX_PACING_RATE_INTERVAL;
+    update = TRUE;
+  }
+  rate = roqmux->transport_pacing_rate;
+  GST_OBJECT_UNLOCK (roqmux);
+
+  if (!update) {
+    return rate;
+  }
+
+  stats = rtp_quic_mux_query_connection_stats (roqmux);
+  if (stats != NULL) {
+    if (gst_structure_get_uint64 (stats, "pacing-rate", &rate)) {
+      GST_OBJECT_LOCK (roqmux);
+      roqmux->transport_pacing_rate = rate;
+      GST_OBJECT_UNLOCK (roqmux);
+
+      GST_LOG_OBJECT (roqmux, "Transport pacing rate %lu bps", rate);
+    }
+    gst_structure_free (stats);
+  }
+
+  if (rate == 0 && g_atomic_int_compare_and_exchange (
+          &roqmux->pacing_rate_warned, FALSE, TRUE)) {
+    GST_WARNING_OBJECT (roqmux, "Pacing is enabled, but pacing-bitrate isn't "
+        "set and quicmux doesn't report a pacing rate, so packets won't be "
+        "spread out");
+  }
+
+  return rate;
+}
+
+/*
+ * Work out when a buffer should leave, in monotonic microseconds. The packets
+ * of a frame are spaced out at the pacing rate, but the whole frame is always
+ * out within pacing-frame-fraction of the frame interval, so a frame that is
+ * too big for the rate goes out faster rather than falling behind.
+ */
+static gint64
+rtp_quic_mux_stream_pace (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstBuffer *buf, gboolean frame_start)
+{
+  gint64 release = MAX (g_get_monotonic_time (), stream->pace_next);
+
+  if (frame_start) {
+    GstClockTime rt = rtp_quic_mux_buffer_running_time (sinkpad, buf);
+
+    if (GST_CLOCK_TIME_IS_VALID (rt) &&
+        GST_CLOCK_TIME_IS_VALID (stream->pace_frame_start) &&
+        rt > stream->pace_frame_start) {
+      GstClockTime interval = rt - stream->pace_frame_start;
+
+      stream->pace_frame_interval =
+          GST_CLOCK_TIME_IS_VALID (stream->pace_frame_interval) ?
+          (stream->pace_frame_interval * 7 + interval) / 8 : interval;
+    }
+    stream->pace_frame_start = rt;
+
+    stream->pace_deadline = G_MAXINT64;
+    if (GST_CLOCK_TIME_IS_VALID (stream->pace_frame_interval)) {
+      stream->pace_deadline = release + (gint64) (roqmux->pacing_frame_fraction
+          * GST_TIME_AS_USECONDS (stream->pace_frame_interval));
+    }
+
+    stream->pace_rate = rtp_quic_mux_pacing_rate (roqmux);
+  }
+
+  stream->pace_next = release;
+  if (stream->pace_rate > 0) {
+    stream->pace_next += (gint64) gst_util_uint64_scale (
+        gst_buffer_get_size (buf) * 8, G_USEC_PER_SEC, stream->pace_rate);
+    stream->pace_next = MAX (release, MIN (stream->pace_next,
+        stream->pace_deadline));
+  }
+
+  return release;
+}
+
+/*
+ * Pick up anything the pacer has reported back for a stream since its last
+ * buffer, such as a STOP_SENDING on a QUIC stream that a paced buffer found.
+ */
+static void
+rtp_quic_mux_stream_pacer_feedback (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream)
+{
+  GstFlowReturn rv;
+
+  if (stream->pacer_flow == NULL) {
+    return;
+  }
+
+  rv = gst_roq_pacer_flow_take_return (stream->pacer_flow);
+  if (G_UNLIKELY (rv != GST_FLOW_OK)) {
+    GST_DEBUG_OBJECT (roqmux, "Pacer reported %s",
+        rtp_quic_mux_flow_return_as_string (rv));
+    rtp_quic_mux_stream_handle_flow_return (roqmux, stream, rv);
+  }
+}
+
+/*
+ * Hand a buffer to the pacing thread to push on target_pad when its time
+ * comes, instead of pushing it now. Takes the reference to target_pad.
+ */
+static void
+rtp_quic_mux_stream_push_paced (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstPad *target_pad, GstBuffer *buf,
+    gboolean frame_start)
+{
+  gint64 release;
+
+  if (stream->pacer_flow == NULL) {
+    stream->pacer = gst_object_ref (roqmux->pacer);
+    stream->pacer_flow = gst_roq_pacer_flow_new (roqmux->pacer);
+  }
+
+  release = rtp_quic_mux_stream_pace (roqmux, sinkpad, stream, buf,
+      frame_start);
+
+  GST_LOG_OBJECT (roqmux, "Pacing buffer %p (size %lu) on pad %"
+      GST_PTR_FORMAT " for release at %ld", buf, gst_buffer_get_size (buf),
+      target_pad, release);
+
+  gst_roq_pacer_push (roqmux->pacer, stream->pacer_flow, target_pad, buf,
+      release);
+}
+
+/*
+ * Send as much of the send queue for a stream as the QUIC stream will take,
+ * starting with any buffer it previously refused.
+ */
+static GstFlowReturn
+rtp_quic_mux_send_queue_drain (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream)
+{
+  GstFlowReturn rv = GST_FLOW_OK;
+
+  while (rv == GST_FLOW_OK) {
+    GstBuffer *buf;
+    GstPad *target_pad;
+    GstClockTime queued_at;
+
+    if (stream->blocked_buf) {
+      buf = stream->blocked_buf;
+      target_pad = stream->blocked_pad;
+      queued_at = stream->blocked_at;
+      stream->blocked_buf = NULL;
+      stream->blocked_pad = NULL;
+      stream->send_queue_bytes -= gst_buffer_get_size (buf);
+      RTP_QUIC_MUX_COUNT (roqmux->send_queue_depth,
+          -(gssize) gst_buffer_get_size (buf));
+    } else {
+      buf = rtp_quic_mux_send_queue_pop (roqmux, stream, &queued_at);
+      if (buf == NULL) {
+        break;
+      }
+
+      rv = rtp_quic_mux_stream_prepare (roqmux, sinkpad, stream, &buf,
+          &target_pad);
+      if (target_pad == NULL) {
+        continue;
+      }
+    }
+
+    rv = rtp_quic_mux_stream_push (roqmux, stream, target_pad, buf, queued_at);
+
+    if (stream->blocked_buf) {
+      /* Still blocked, try again later */
+      break;
+    }
+  }
+
+  return rv;
+}
+
+/*
+ * Send an RTP buffer through the send queue. With the block-upstream policy,
+ * this doesn't return until the send queue has dropped back under
+ * send-queue-max-bytes.
+ */
+static GstFlowReturn
+rtp_quic_mux_stream_send_queued (GstRtpQuicMux *roqmux, GstPad *sinkpad,
+    RtpQuicMuxStream *stream, GstBuffer *buf)
+{
+  GstFlowReturn rv;
+
+  rtp_quic_mux_send_queue_push (roqmux, stream, buf);
+
+  rv = rtp_quic_mux_send_queue_drain (roqmux, sinkpad, stream);
+
+  while (rv == GST_FLOW_OK &&
+      roqmux->send_queue_policy == SEND_QUEUE_POLICY_BLOCK_UPSTREAM) {
+    if (stream->send_queue_bytes <= roqmux->send_queue_max_bytes) {
+      break;
+    }
+
+    if (!rtp_quic_mux_send_queue_wait (roqmux, sinkpad)) {
+      return GST_FLOW_FLUSHING;
+    }
+
+    rv = rtp_quic_mux_send_queue_drain (roqmux, sinkpad, stream);
+  }
+
+  return rv;
+}
+
+/*
+ * Returns TRUE if an RTP buffer is the first of a frame on the RoQ stream it
+ * was mapped to, or on its sink pad if there is no stream. Must be called
+ * once per buffer, after any layer mapping has set the marker flag.
+ */
+static gboolean
+rtp_quic_mux_frame_start (RtpQuicMuxSink *sink, RtpQuicMuxStream *stream,
+    GstBuffer *buf)
+{
+  gboolean *next = stream ? &stream->frame_start : &sink->frame_start;
+  gboolean frame_start = *next;
+
+  *next = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+
+  return frame_start;
+}
+
+/*
+ * Decide whether an RTP buffer belongs to a frame that is already older than
+ * max-frame-age and so should be dropped. The decision is made on the first
+ * buffer of each frame and applied to every buffer up to and including the
+ * one with the marker bit, so frames are only ever dropped whole.
+ */
+static gboolean
+rtp_quic_mux_sink_drop_stale (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    RtpQuicMuxStream *stream, GstBuffer *buf, gboolean frame_start)
+{
+  gboolean marker = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+  gboolean *dropping = stream ? &stream->dropping_stale : &sink->dropping_stale;
+  gboolean drop;
+
+  if (frame_start) {
+    GstClockTime running_time;
+    GstClockTime now;
+
+    *dropping = FALSE;
+
+    running_time = gst_segment_to_running_time (&sink->segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buf));
+    now = gst_element_get_current_running_time (GST_ELEMENT (roqmux));
+
+    if (GST_CLOCK_TIME_IS_VALID (running_time) &&
+        GST_CLOCK_TIME_IS_VALID (now) && now > running_time &&
+        now - running_time > roqmux->max_frame_age) {
+      GST_DEBUG_OBJECT (roqmux, "Frame with running time %" GST_TIME_FORMAT
+          " is %" GST_TIME_FORMAT " old, dropping it",
+          GST_TIME_ARGS (running_time), GST_TIME_ARGS (now - running_time));
+      *dropping = TRUE;
+    }
+  }
+
+  drop = *dropping;
+
+  if (drop) {
+    RTP_QUIC_MUX_COUNT (roqmux->stale_bytes_dropped,
+        gst_buffer_get_size (buf));
+    if (marker) {
+      RTP_QUIC_MUX_COUNT (roqmux->stale_frames_dropped, 1);
+    }
+  }
+
+  return drop;
+}
+
+/*
+ * Returns TRUE if this RoQ stream has fallen back to datagrams after too many
+ * STOP_SENDINGs. The decision is only changed at the start of a frame, and is
+ * switched back once the quiet period has passed.
+ */
+static gboolean
+rtp_quic_mux_stream_datagram_fallback (GstRtpQuicMux *roqmux,
+    RtpQuicMuxStream *stream, gboolean frame_start)
+{
+  gboolean rv;
+
+  if (roqmux->datagram_fallback_threshold == 0 || stream == NULL) {
+    return FALSE;
+  }
+
+  if (frame_start) {
+    if (stream->datagram_fallback && gst_util_get_timestamp () -
+        stream->datagram_fallback_at >= roqmux->datagram_fallback_quiet) {
+      GST_INFO_OBJECT (roqmux, "No STOP_SENDING for %" GST_TIME_FORMAT
+          ", switching back to QUIC streams",
+          GST_TIME_ARGS (roqmux->datagram_fallback_quiet));
+      stream->datagram_fallback = FALSE;
+    }
+    stream->frame_on_datagram = stream->datagram_fallback;
+  }
+  rv = stream->frame_on_datagram;
+
+  return rv;
+}
+
+/*
+ * Find the frame marking RTP header extension in an RTP packet, copying up to
+ * the first three bytes of it into fm. Returns how many bytes were copied, or 0
+ * if the packet doesn't carry the extension.
+ */
+static gsize
+rtp_quic_mux_read_frame_marking (GstRtpQuicMux *roqmux, GstBuffer *buf,
+    guint8 fm[3])
+{
+  GstMapInfo map;
+  gsize offset, end, rv = 0;
+  guint16 profile;
+
+  /* The RTP header and its extensions are always in the first memory */
+  if (!gst_buffer_map_range (buf, 0, 1, &map, GST_MAP_READ)) {
+    return 0;
+  }
+
+  if (map.size < 12 || !(map.data[0] & 0x10)) {
+    goto out;
+  }
+
+  offset = 12 + (map.data[0] & 0x0f) * 4;
+  if (offset + 4 > map.size) {
+    goto out;
+  }
+
+  profile = GST_READ_UINT16_BE (map.data + offset);
+  end = offset + 4 + GST_READ_UINT16_BE (map.data + offset + 2) * 4;
+  offset += 4;
+  if (end > map.size) {
+    goto out;
+  }
+
+  while (offset < end) {
+    guint id;
+    gsize len, i;
+
+    if (profile == 0xBEDE) {
+      /* RFC 8285 one-byte header */
+      id = map.data[offset] >> 4;
+      len = (map.data[offset] & 0x0f) + 1;
+      if (id == 0) {
+        offset++;
+        continue;
+      } else if (id == 15) {
+        break;
+      }
+      offset++;
+    } else if ((profile & 0xfff0) == 0x1000) {
+      /* RFC 8285 two-byte header */
+      id = map.data[offset];
+      if (id == 0) {
+        offset++;
+        continue;
+      }
+      if (offset + 2 > end) {
+        break;
+      }
+      len = map.data[offset + 1];
+      offset += 2;
+    } else {
+      break;
+    }
+
+    if (offset + len > end) {
+      break;
+    }
+
+    if (id == roqmux->frame_marking_ext_id) {
+      rv = MIN (len, 3);
+      for (i = 0; i < rv; i++) {
+        fm[i] = map.data[offset + i];
+      }
+      break;
+    }
+
+    offset += len;
+  }
+
+out:
+  gst_buffer_unmap (buf, &map);
+
+  return rv;
+}
+
+/*
+ * Find the RoQ stream for the temporal/spatial layer an RTP packet belongs to,
+ * going by its frame marking header extension. The base layer stays on the
+ * stream for the SSRC and payload type, while each enhancement layer gets a
+ * child stream of its own, so that a frame cancelled on an enhancement layer
+ * never touches the base layer.
+ *
+ * Spatial layers of the same superframe share an RTP marker, so the end of
+ * frame bit in the extension is copied onto the buffer marker flag.
+ */
+static RtpQuicMuxStream *
+rtp_quic_mux_stream_for_layer (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstBuffer **buf)
+{
+  RtpQuicMuxStream *child;
+  guint8 fm[3];
+  gsize fm_len;
+  guint layer;
+
+  fm_len = rtp_quic_mux_read_frame_marking (roqmux, *buf, fm);
+  if (fm_len == 0) {
+    return stream;
+  }
+
+  if ((fm[0] & 0x40) &&
+      !GST_BUFFER_FLAG_IS_SET (*buf, GST_BUFFER_FLAG_MARKER)) {
+    *buf = gst_buffer_make_writable (*buf);
+    GST_BUFFER_FLAG_SET (*buf, GST_BUFFER_FLAG_MARKER);
+  }
+
+  layer = fm[0] & 0x07;
+  if (fm_len > 1) {
+    layer |= fm[1] << 3;
+  }
+
+  if (layer == 0) {
+    return stream;
+  }
 
-    GST_TRACE_OBJECT (roqmux, "Stored downstream QuicMux element %p",
-        roqmux->quicmux);
+  if (stream->layers == NULL) {
+    stream->layers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) rtp_quic_mux_stream_free);
   }
 
-  g_rec_mutex_unlock (&roqmux->mutex);
+  child = g_hash_table_lookup (stream->layers, GUINT_TO_POINTER (layer));
+  if (child == NULL) {
+    GST_DEBUG_OBJECT (roqmux, "New stream for temporal layer %u, spatial "
+        "layer %u", layer & 0x07, layer >> 3);
+
+    child = rtp_quic_mux_stream_new ();
+    child->layer = layer;
+    child->sink_pad = stream->sink_pad;
+    child->media = stream->media;
+    child->flow_id = stream->flow_id;
+    g_hash_table_insert (stream->layers, GUINT_TO_POINTER (layer), child);
+  }
+
+  /* Start of an independent or base layer sync frame */
+  if ((fm[0] & 0x80) && (fm[0] & (0x20 | 0x08))) {
+    if (child->wait_for_keyframe) {
+      GST_DEBUG_OBJECT (roqmux, "Layer sync frame arrived, sending layer %u "
+          "again", layer);
+      child->wait_for_keyframe = FALSE;
+      child->frame_cancelled = FALSE;
+    }
+  }
+
+  return child;
 }
 
-const gchar *
-rtp_quic_mux_flow_return_as_string (GstFlowReturn fr)
+/*
+ * Push the datagrams held back for the sink's current frame as one list.
+ */
+static GstFlowReturn
+rtp_quic_mux_sink_push_batch (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink)
 {
-  if (fr >= GST_FLOW_CUSTOM_SUCCESS) {
-    return "Flow Custom Success";
+  GstBufferList *batch = sink->dgram_batch;
+
+  if (batch == NULL) {
+    return GST_FLOW_OK;
   }
-  if (fr <= GST_FLOW_CUSTOM_ERROR) {
-    return "Flow Custom Error";
+
+  sink->dgram_batch = NULL;
+  RTP_QUIC_MUX_COUNT (roqmux->datagram_batches, 1);
+
+  GST_LOG_OBJECT (roqmux, "Pushing batch of %u datagrams",
+      gst_buffer_list_length (batch));
+
+  return gst_pad_push_list (roqmux->datagram_pad, batch);
+}
+
+/*
+ * Hold a datagram back to go with the rest of its frame. If it belongs to a
+ * later frame than the batch being held, that batch is pushed first. Sets
+ * push to TRUE if the batch should be pushed once buf has been added, because
+ * it ends the frame or the batch has been held for long enough. This is the
+ * only place the delay is checked, so a batch is never pushed on a timer.
+ */
+static GstFlowReturn
+rtp_quic_mux_sink_batch_datagram (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    GstBuffer *buf, gboolean *push)
+{
+  GstFlowReturn rv = GST_FLOW_OK;
+  gint64 now = g_get_monotonic_time ();
+
+  if (sink->dgram_batch != NULL &&
+      GST_BUFFER_PTS (buf) != sink->dgram_batch_pts) {
+    /* The end of the last frame must have been lost or dropped */
+    rv = rtp_quic_mux_sink_push_batch (roqmux, sink);
   }
-  switch (fr) {
-  case GST_FLOW_OK:
-    return "OK";
-  case GST_FLOW_NOT_LINKED:
-    return "Not Linked";
-  case GST_FLOW_FLUSHING:
-    return "Flushing";
-  case GST_FLOW_EOS:
-    return "End Of Stream";
-  case GST_FLOW_NOT_NEGOTIATED:
-    return "Not negotiated";
-  case GST_FLOW_ERROR:
-    return "Fatal Error";
-  case GST_FLOW_NOT_SUPPORTED:
-    return "Operation Not Supported";
-  default:
-    /* Fall through */
+
+  if (sink->dgram_batch == NULL) {
+    sink->dgram_batch = gst_buffer_list_new ();
+    sink->dgram_batch_pts = GST_BUFFER_PTS (buf);
+    sink->dgram_batch_start = now;
+  }
+
+  *push = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER) ||
+      (GstClockTime) (now - sink->dgram_batch_start) * GST_USECOND >=
+      roqmux->datagram_batch_max_delay;
+
+  gst_buffer_list_add (sink->dgram_batch, buf);
+
+  return rv;
+}
+
+/*
+ * Finish the sink's FEC block and send its repair packet in a datagram, after
+ * the packets that it protects.
+ */
+static void
+rtp_quic_mux_sink_push_fec (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    GstPad *pad, RtpQuicMuxStream *stream)
+{
+  GstBuffer *repair;
+  GstFlowReturn rv;
+
+  if (sink->fec == NULL ||
+      g_atomic_pointer_get (&roqmux->datagram_pad) == NULL) {
+    return;
+  }
+
+  repair = gst_roq_fec_encoder_finish (sink->fec,
+      (guint64) sink->rtp_flow_id);
+  if (repair == NULL) {
+    return;
+  }
+
+  if (!rtp_quic_mux_datagram_fits (roqmux, repair, roqmux->fec_flow_id)) {
+    gst_buffer_unref (repair);
+    return;
+  }
+
+  rtp_quic_mux_write_payload_header (roqmux, &repair, -1, roqmux->fec_flow_id,
+      FALSE);
+
+  RTP_QUIC_MUX_COUNT (roqmux->fec_packets_sent, 1);
+
+  if (sink->dgram_batch != NULL) {
+    gst_buffer_list_add (sink->dgram_batch, repair);
+    return;
+  }
+
+  if (roqmux->pacing && stream != NULL) {
+    rtp_quic_mux_stream_push_paced (roqmux, pad, stream,
+        gst_object_ref (roqmux->datagram_pad), repair, FALSE);
+    return;
+  }
+
+  GST_LOG_OBJECT (roqmux, "Pushing FEC repair packet of length %lu",
+      gst_buffer_get_size (repair));
+
+  rv = gst_pad_push (roqmux->datagram_pad, repair);
+  if (rv != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (roqmux, "Pushing FEC repair packet returned %s",
+        rtp_quic_mux_flow_return_as_string (rv));
   }
-  return "Unknown Flow Return!";
 }
 
+/*
+ * Add an RTP packet that is about to be sent in a datagram to the sink's FEC
+ * block. If the packet can't join the block, the block's repair packet is sent
+ * first. Returns TRUE if the block is complete once the packet has been sent.
+ */
 static gboolean
-_rtp_quic_mux_open_datagram_pad (GstRtpQuicMux *roqmux, GstPad *sinkpad)
+rtp_quic_mux_sink_fec_protect (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    GstPad *pad, RtpQuicMuxStream *stream, GstBuffer *buf)
 {
-  gchar *padname;
-  gboolean rv;
+  if (G_UNLIKELY (sink->fec == NULL)) {
+    sink->fec = g_new (GstRoQFecEncoder, 1);
+    gst_roq_fec_encoder_init (sink->fec);
+  }
 
-  padname = g_strdup_printf (quic_datagram_src_factory.name_template,
-      0);
+  if (!gst_roq_fec_encoder_accepts (sink->fec, buf)) {
+    rtp_quic_mux_sink_push_fec (roqmux, sink, pad, stream);
+  }
 
-  roqmux->datagram_pad = gst_pad_new_from_static_template (
-      &quic_datagram_src_factory, padname);
+  gst_roq_fec_encoder_add (sink->fec, buf);
 
-  g_assert (roqmux->datagram_pad);
+  return sink->fec->count >= roqmux->fec_block_size ||
+      GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+}
 
-  g_free (padname);
+/*
+ * Returns TRUE if an RTP buffer should be sent in a QUIC DATAGRAM rather than
+ * on a stream. With hybrid-mapping, that is any delta unit that isn't a codec
+ * header and fits in datagram-mtu along with its RoQ header. After falling
+ * back from streams, that is anything that fits in datagram-mtu.
+ */
+static gboolean
+rtp_quic_mux_send_as_datagram (GstRtpQuicMux *roqmux, RtpQuicMuxSink *sink,
+    RtpQuicMuxStream *stream, GstBuffer *buf, gboolean frame_start)
+{
+  gboolean fits;
 
-  gst_pad_set_active (roqmux->datagram_pad, TRUE);
-  rv = gst_element_add_pad (GST_ELEMENT (roqmux), roqmux->datagram_pad);
+  if (roqmux->use_datagrams) {
+    return TRUE;
+  }
 
-  if (!rv) return FALSE;
+  fits = gst_buffer_get_size (buf) +
+      gst_quiclib_set_varint (sink->rtp_flow_id, NULL) <=
+      rtp_quic_mux_datagram_limit (roqmux);
 
-  if (roqmux->quicmux == NULL) {
-    roqmux->quicmux = gst_pad_get_parent_element (
-      GST_PAD_PEER (roqmux->datagram_pad));
+  if (rtp_quic_mux_stream_datagram_fallback (roqmux, stream, frame_start)) {
+    return fits;
   }
 
-  gst_pad_sticky_events_foreach (sinkpad, rtp_quic_mux_foreach_sticky_event,
-      (gpointer) roqmux->datagram_pad);
+  if (!roqmux->hybrid_mapping ||
+      !GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT) ||
+      GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_HEADER)) {
+    return FALSE;
+  }
 
-  return rv;
+  return fits;
 }
 
 static GstFlowReturn
@@ -947,303 +4273,362 @@ gst_rtp_quic_mux_rtp_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
   gsize rtp_frame_len;
   GstFlowReturn rv;
   GstPad *target_pad = NULL;
-  guint32 ssrc;
-  gint32 payload_type; /* Needs to be for the hash table */
-  GHashTable *pts = NULL;
+  RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
   RtpQuicMuxStream *stream = NULL;
+  gboolean frame_start;
+  gboolean fec_block_done = FALSE;
+  gboolean push_batch = FALSE;
 
   rtp_frame_len = gst_buffer_get_size (buf);
 
   GST_DEBUG_OBJECT (roqmux, "Received buffer of length %lu bytes",
       rtp_frame_len);
 
-  if (!roqmux->use_datagrams) {
-    GstCaps *padcaps;
-    gchar *padcapsdbg;
+  stream = sink->stream;
 
-    padcaps = gst_pad_get_current_caps (pad);
+  if (stream != NULL && roqmux->frame_marking_ext_id > 0) {
+    stream = rtp_quic_mux_stream_for_layer (roqmux, stream, &buf);
+  }
 
-    padcapsdbg = gst_caps_to_string (padcaps);
-    GST_DEBUG_OBJECT (roqmux, "Caps: %s", padcapsdbg);
-    g_free (padcapsdbg);
+  frame_start = rtp_quic_mux_frame_start (sink, stream, buf);
 
-    g_warn_if_fail (gst_structure_get_int (
-        gst_caps_get_structure (padcaps, 0), "payload", &payload_type));
-    g_warn_if_fail (gst_structure_get_uint (
-        gst_caps_get_structure (padcaps, 0), "ssrc", &ssrc));
+  if (roqmux->max_frame_age > 0 &&
+      rtp_quic_mux_sink_drop_stale (roqmux, sink, stream, buf, frame_start)) {
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
+  }
 
-    gst_caps_unref (padcaps);
+  if (stream != NULL) {
+    rtp_quic_mux_stream_pacer_feedback (roqmux, stream);
+  }
 
-    if (g_hash_table_lookup_extended (roqmux->ssrcs, &ssrc, NULL,
-        (gpointer *) &pts)) {
-      stream = g_hash_table_lookup (pts, &payload_type);
+  if (!rtp_quic_mux_send_as_datagram (roqmux, sink, stream, buf,
+      frame_start)) {
+    if (G_UNLIKELY (stream == NULL)) {
+      GST_ERROR_OBJECT (roqmux, "No SSRC and payload type known for pad %"
+          GST_PTR_FORMAT ", cannot map buffer to a stream", pad);
+      gst_buffer_unref (buf);
+      return GST_FLOW_NOT_NEGOTIATED;
     }
 
-    if (stream == NULL) {
-      guint32 *ssrc_ptr = g_malloc (sizeof (guint32));
-      gint32 *pt_ptr = g_malloc (sizeof (gint32));
+    if (roqmux->send_queue_max_bytes > 0) {
+      rv = rtp_quic_mux_stream_send_queued (roqmux, pad, stream, buf);
+      goto done;
+    }
 
-      *ssrc_ptr = ssrc;
-      *pt_ptr = payload_type;
+    rv = rtp_quic_mux_stream_prepare (roqmux, pad, stream, &buf, &target_pad);
 
-      /* Create QuicMuxStream object */
-      stream = g_new0 (RtpQuicMuxStream, 1);
-      g_assert (stream);
+    if (target_pad == NULL) {
+      return rv;
+    }
 
-      g_mutex_init (&stream->mutex);
-      g_cond_init (&stream->wait);
+    if (roqmux->pacing) {
+      gboolean marker = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
 
-      GST_TRACE_OBJECT (roqmux, "New stream for SSRC %u and payload type %u",
-          ssrc, payload_type);
+      rtp_quic_mux_stream_push_paced (roqmux, pad, stream, target_pad, buf,
+          frame_start);
+      rtp_quic_mux_stream_sent (roqmux, stream, marker);
+      rv = GST_FLOW_OK;
+      goto done;
+    }
 
-      if (g_hash_table_lookup_extended (roqmux->ssrcs, &ssrc, NULL,
-          (gpointer *) &pts) == FALSE) {
-        pts = g_hash_table_new_full (g_int_hash, g_int_equal,
-              g_free, (GDestroyNotify) rtp_quic_mux_pt_hash_destroy);
-        g_assert (g_hash_table_insert (roqmux->ssrcs, ssrc_ptr, pts));
-      }
+    GST_DEBUG_OBJECT (roqmux,
+        "Pushing buffer of length %lu bytes on unidirectional stream",
+        gst_buffer_get_size (buf));
 
-      g_assert (g_hash_table_insert (pts, pt_ptr, stream));
+    rv = rtp_quic_mux_stream_push (roqmux, stream, target_pad, buf,
+        GST_CLOCK_TIME_NONE);
+    goto done;
+  } else {
+    if (g_atomic_pointer_get (&roqmux->datagram_pad) == NULL) {
+      _rtp_quic_mux_open_datagram_pad (roqmux, pad);
     }
 
-    g_mutex_lock (&stream->mutex);
+    if (roqmux->use_datagrams && !sink->payloader_checked) {
+      rtp_quic_mux_sink_fit_payloader (roqmux, sink);
+    }
 
-    if (stream->frame_cancelled) {
-      if (GST_BUFFER_FLAGS (buf) & GST_BUFFER_FLAG_MARKER) {
-        /* Start of a new frame, so start sending again */
-        GST_DEBUG_OBJECT (roqmux, "New frame started, sending again");
-        stream->frame_cancelled = FALSE;
-      } else {
-        g_mutex_unlock (&stream->mutex);
-        return GST_FLOW_OK;
-      }
+    if (!rtp_quic_mux_datagram_fits (roqmux, buf, sink->rtp_flow_id)) {
+      gst_buffer_unref (buf);
+      return GST_FLOW_OK;
     }
 
-    if (stream->stream_pad == NULL) {
-      stream->stream_pad = rtp_quic_mux_new_uni_src_pad (roqmux, pad);
-      g_hash_table_insert (roqmux->src_pads, (gpointer) stream->stream_pad,
-          (gpointer) stream);
-      stream->stream_offset = 0;
-    }
-
-    GST_TRACE_OBJECT (roqmux, "Stream boundary %s, stream packing ratio %u, "
-        "stream counter %u, stream offset %lu, buffer flag marker %s, "
-        "buffer flag delta unit %s",
-        _rtp_quic_mux_stream_boundary_as_string (roqmux->stream_boundary),
-         roqmux->stream_packing_ratio, stream->counter, stream->stream_offset,
-        (GST_BUFFER_FLAGS (buf) & GST_BUFFER_FLAG_MARKER)?("set"):("not set"),
-        (GST_BUFFER_FLAGS (buf) & GST_BUFFER_FLAG_DELTA_UNIT)?("set"):("not set"));
-
-    if ((roqmux->stream_boundary == STREAM_BOUNDARY_FRAME) &&
-        (GST_BUFFER_FLAGS (buf) & GST_BUFFER_FLAG_MARKER)) {
-     stream->counter++;
-    } else if ((roqmux->stream_boundary == STREAM_BOUNDARY_GOP) &&
-        !(GST_BUFFER_FLAGS (buf) & GST_BUFFER_FLAG_DELTA_UNIT)) {
-      /* Start of a new GOP */
-      if (++stream->counter > roqmux->stream_packing_ratio) {
-        GST_DEBUG_OBJECT (roqmux, "Start of new GOP, exceeding limit of %d",
-            roqmux->stream_packing_ratio);
-        g_hash_table_remove (roqmux->src_pads, (gpointer) stream->stream_pad);
-        gst_element_remove_pad (GST_ELEMENT (roqmux), stream->stream_pad);
-        stream->stream_pad = rtp_quic_mux_new_uni_src_pad (roqmux, pad);
-        g_hash_table_insert (roqmux->src_pads, (gpointer) stream->stream_pad,
-            (gpointer) stream);
-        stream->stream_offset = 0;
-        stream->counter = 0;
-      }
+    if (roqmux->fec_block_size > 0) {
+      fec_block_done = rtp_quic_mux_sink_fec_protect (roqmux, sink, pad,
+          stream, buf);
     }
 
-    if (stream->stream_offset == 0) {
-      rtp_quic_mux_write_payload_header (&buf,
-          (roqmux->add_uni_stream_header)?(roqmux->uni_stream_type):(-1),
-          roqmux->rtp_flow_id, TRUE);
-    } else {
-      rtp_quic_mux_write_payload_header (&buf, -1, -1, TRUE);
+    rtp_quic_mux_write_payload_header (roqmux, &buf, -1, sink->rtp_flow_id,
+        FALSE);
+
+    RTP_QUIC_MUX_COUNT (roqmux->datagrams_sent, 1);
+
+    if (roqmux->pacing && stream != NULL) {
+      /* Through the stream's flow, so it stays in order with its frame */
+      rtp_quic_mux_stream_push_paced (roqmux, pad, stream,
+          gst_object_ref (roqmux->datagram_pad), buf, frame_start);
+      rv = GST_FLOW_OK;
+      goto done;
     }
 
-    target_pad = gst_object_ref (stream->stream_pad);
+    if (roqmux->datagram_batch_max_delay > 0 && sink->dgram_batchable) {
+      rv = rtp_quic_mux_sink_batch_datagram (roqmux, sink, buf, &push_batch);
+      goto done;
+    }
+  }
 
-    buf->offset = stream->stream_offset;
-    stream->stream_offset += gst_buffer_get_size (buf);
+  GST_INFO_OBJECT (roqmux, "Pushing buffer %p (size %lu, RTP frame length %lu)"
+      " in a datagram", buf, gst_buffer_get_size (buf), rtp_frame_len);
 
-    /* Hold until the end to stop the pad going way while we're using it */
-    g_mutex_unlock (&stream->mutex);
+  rv = gst_pad_push (roqmux->datagram_pad, buf);
 
-    GST_DEBUG_OBJECT (roqmux,
-        "Pushing buffer of length %lu bytes on unidirectional stream",
-        gst_buffer_get_size (buf));
+done:
+  if (fec_block_done) {
+    rtp_quic_mux_sink_push_fec (roqmux, sink, pad, stream);
+  }
 
-    roqmux->stream_frames_sent++;
-  } else {
-    if (roqmux->datagram_pad == NULL) {
-      _rtp_quic_mux_open_datagram_pad (roqmux, pad);
+  if (push_batch) {
+    GstFlowReturn push_rv = rtp_quic_mux_sink_push_batch (roqmux, sink);
+
+    if (rv == GST_FLOW_OK) {
+      rv = push_rv;
     }
+  }
 
-    target_pad = gst_object_ref (roqmux->datagram_pad);
+  GST_DEBUG_OBJECT (roqmux, "Returning %s",
+      rtp_quic_mux_flow_return_as_string (rv));
 
-    rtp_quic_mux_write_payload_header (&buf, -1, roqmux->rtp_flow_id, FALSE);
+  g_assert (rv >= 0);
 
-    GST_DEBUG_OBJECT (roqmux, "Pushing buffer of length %lu in a datagram",
-        gst_buffer_get_size (buf));
+  return rv;
+}
 
-    roqmux->datagrams_sent++;
+static gboolean
+rtp_quic_mux_datagram_list_prepare (GstBuffer **buf, guint idx,
+    gpointer user_data)
+{
+  RtpQuicMuxSink *sink = (RtpQuicMuxSink *) user_data;
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (GST_PAD_PARENT (sink->sink));
+
+  if (!rtp_quic_mux_datagram_fits (roqmux, *buf, sink->rtp_flow_id)) {
+    /* Setting the buffer to NULL removes it from the list */
+    gst_buffer_unref (*buf);
+    *buf = NULL;
+    return TRUE;
   }
 
-  if (target_pad == NULL) {
-    GST_ERROR_OBJECT (roqmux, "Couldn't find a target pad!");
-    return GST_FLOW_NOT_NEGOTIATED;
+  rtp_quic_mux_write_payload_header (roqmux, buf, -1, sink->rtp_flow_id,
+      FALSE);
+
+  RTP_QUIC_MUX_COUNT (roqmux->datagrams_sent, 1);
+
+  return TRUE;
+}
+
+/*
+ * Push all the buffers that have been collected for one QUIC stream as a
+ * single list.
+ */
+static GstFlowReturn
+rtp_quic_mux_stream_push_list (GstRtpQuicMux *roqmux, RtpQuicMuxStream *stream,
+    GstPad **target_pad, GstBufferList **list)
+{
+  GstFlowReturn rv = GST_FLOW_OK;
+
+  if (*target_pad == NULL) {
+    return rv;
   }
 
-  if (gst_debug_category_get_threshold (gst_rtp_quic_mux_debug)
-      >= GST_LEVEL_DEBUG) {
-    GstMapInfo map;
-    gsize off = 0;
-    guint64 uni_stream_type;
-    guint64 flow_id;
-    guint64 payload_length;
-    gboolean padding;
-    gboolean extension_present;
-    guint8 cc;
-    guint8 pt;
-    guint16 seq_num;
-    guint32 timestamp;
-    guint32 ssrc;
-
-    gst_buffer_map (buf, &map, GST_MAP_READ);
-    if (!roqmux->use_datagrams) {
-      if (buf->offset == 0) {
-        if (roqmux->add_uni_stream_header) {
-          off += gst_quiclib_get_varint (map.data + off, &uni_stream_type);
-        }
-        off += gst_quiclib_get_varint (map.data + off, &flow_id);
+  if (gst_buffer_list_length (*list) > 0) {
+    GST_DEBUG_OBJECT (roqmux, "Pushing list of %u buffers on pad %"
+        GST_PTR_FORMAT, gst_buffer_list_length (*list), *target_pad);
+
+    rv = gst_pad_push_list (*target_pad, *list);
+    rv = rtp_quic_mux_stream_handle_flow_return (roqmux, stream, rv);
+    *list = gst_buffer_list_new ();
+  }
+
+  gst_object_unref (*target_pad);
+  *target_pad = NULL;
+
+  return rv;
+}
+
+static GstFlowReturn
+gst_rtp_quic_mux_rtp_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  GstRtpQuicMux *roqmux = GST_RTPQUICMUX (parent);
+  RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
+  RtpQuicMuxStream *stream;
+  GstBufferList *out;
+  GstPad *out_pad = NULL;
+  GstFlowReturn rv = GST_FLOW_OK;
+  guint i, len;
+
+  GST_DEBUG_OBJECT (roqmux, "Received list of %u buffers",
+      gst_buffer_list_length (list));
+
+  if (((roqmux->hybrid_mapping || roqmux->datagram_fallback_threshold > 0 ||
+      roqmux->frame_marking_ext_id > 0) && !roqmux->use_datagrams) ||
+      roqmux->pacing || roqmux->fec_block_size > 0) {
+    /*
+     * Each buffer could go either way, or to a different layer's stream, or
+     * needs its own release time or repair packet, so take them one at a time
+     */
+    len = gst_buffer_list_length (list);
+    for (i = 0; i < len && rv == GST_FLOW_OK; i++) {
+      rv = gst_rtp_quic_mux_rtp_chain (pad, parent,
+          gst_buffer_ref (gst_buffer_list_get (list, i)));
+    }
+    gst_buffer_list_unref (list);
+    return rv;
+  }
+
+  if (roqmux->max_frame_age > 0) {
+    list = gst_buffer_list_make_writable (list);
+    for (i = 0; i < gst_buffer_list_length (list);) {
+      GstBuffer *buf = gst_buffer_list_get (list, i);
+      RtpQuicMuxStream *layer_stream = sink->stream;
+      gboolean frame_start;
+
+      if (layer_stream != NULL && roqmux->frame_marking_ext_id > 0) {
+        /* The layer's end of frame bit may set the marker */
+        buf = gst_buffer_list_get_writable (list, i);
+        layer_stream = rtp_quic_mux_stream_for_layer (roqmux, layer_stream,
+            &buf);
       }
-      off += gst_quiclib_get_varint (map.data + off, &payload_length);
-    } else {
-      /* Datagram */
-      off += gst_quiclib_get_varint (map.data + off, &flow_id);
-      payload_length = gst_buffer_get_size (buf) - off;
-    }
-    padding = (map.data[off] & 0x20) > 0;
-    extension_present = (map.data[off] & 0x10) > 0;
-    cc = map.data[off] & 0x0f;
-    pt = map.data[off + 1];
-    seq_num = (map.data[off + 2] << 8) + (map.data[off + 3]);
-    timestamp = (map.data[off + 4] << 24) + (map.data[off + 5] << 16) +
-      (map.data[off + 6] << 8) + (map.data[off + 7]);
-    ssrc = ntohl ((map.data[off + 8] << 24) + (map.data[off + 9] << 16) +
-      (map.data[off + 10] << 8) + (map.data[off + 11]));
-    gst_buffer_unmap (buf, &map);
-
-    if (roqmux->use_datagrams) {
-      GST_DEBUG_OBJECT (roqmux, "Sending RTP frame of size %lu bytes "
-          "(bufsize %lu) on datagram with flow identifier %lu, "
-          "marker bit %sset, payload type %u, sequence number %u, "
-          "timestamp %u, and ssrc %u. %u CSRCs present. Padding %spresent. "
-          "Extension %spresent", payload_length, gst_buffer_get_size (buf),
-          flow_id, (pt & 0x80)?(""):("not "), pt & 0x7f, seq_num, timestamp,
-          ssrc, cc, (padding)?(""):("not "), (extension_present)?(""):("not "));
-    } else if (buf->offset == 0) {
-      if (roqmux->add_uni_stream_header) {
-        GST_DEBUG_OBJECT (roqmux, "Sending RTP frame of size %lu bytes "
-            "(bufsize %lu) on stream with stream type %lu, flow identifier %lu,"
-            " marker bit %sset, payload type %u, sequence number %u, "
-            "timestamp %u, and ssrc %u. %u CSRCs present. Padding %spresent. "
-            "Extension %spresent", payload_length, gst_buffer_get_size (buf),
-            uni_stream_type, flow_id, (pt & 0x80)?(""):("not "), pt & 0x7f,
-            seq_num, timestamp, ssrc, cc, (padding)?(""):("not "),
-            (extension_present)?(""):("not "));
+
+      frame_start = rtp_quic_mux_frame_start (sink, layer_stream, buf);
+
+      if (rtp_quic_mux_sink_drop_stale (roqmux, sink, layer_stream, buf,
+              frame_start)) {
+        gst_buffer_list_remove (list, i, 1);
       } else {
-        GST_DEBUG_OBJECT (roqmux, "Sending RTP frame of size %lu bytes "
-            "(bufsize %lu) on stream, flow identifier %lu, marker bit %sset, "
-            "payload type %u, sequence number %u, timestamp %u, and ssrc %u. "
-            "%u CSRCs present. Padding %spresent. Extension %spresent",
-            payload_length, gst_buffer_get_size (buf), flow_id,
-            (pt & 0x80)?(""):("not "), pt & 0x7f, seq_num, timestamp, ssrc,
-            cc, (padding)?(""):("not "), (extension_present)?(""):("not "));
+        i++;
       }
-    } else {
-      GST_DEBUG_OBJECT (roqmux, "Sending RTP frame of size %lu bytes (bufsize "
-          "%lu) on stream, marker bit %sset, payload type %u, "
-          "sequence number %u, timestamp %u, and ssrc %u. %u CSRCs present. "
-          "Padding %spresent. Extension %spresent", payload_length,
-          gst_buffer_get_size (buf), (pt & 0x80)?(""):("not "), pt & 0x7f,
-          seq_num, timestamp, ssrc, cc, (padding)?(""):("not "),
-          (extension_present)?(""):("not "));
     }
   }
 
+  len = gst_buffer_list_length (list);
 
-  GST_INFO_OBJECT (roqmux, "Pushing buffer %p (size %lu, RTP frame length %lu)"
-      "on pad %" GST_PTR_FORMAT, buf, gst_buffer_get_size (buf), rtp_frame_len,
-      target_pad);
+  if (roqmux->use_datagrams) {
+    if (g_atomic_pointer_get (&roqmux->datagram_pad) == NULL) {
+      _rtp_quic_mux_open_datagram_pad (roqmux, pad);
+    }
 
-  rv = gst_pad_push (target_pad, buf);
+    if (!sink->payloader_checked) {
+      rtp_quic_mux_sink_fit_payloader (roqmux, sink);
+    }
 
-  gst_object_unref (target_pad);
+    /* Anything held back from single buffers goes first */
+    rv = rtp_quic_mux_sink_push_batch (roqmux, sink);
+    if (rv != GST_FLOW_OK) {
+      gst_buffer_list_unref (list);
+      return rv;
+    }
 
-  if (!roqmux->use_datagrams &&
-      roqmux->stream_boundary == STREAM_BOUNDARY_FRAME &&
-      ++stream->counter >= roqmux->stream_packing_ratio) {
-    GST_DEBUG_OBJECT (roqmux,
-        "End of frame, exceeding limit of %d, closing stream",
-        roqmux->stream_packing_ratio);
-    g_mutex_lock (&stream->mutex);
-    if (stream->stream_pad) {
-      gst_pad_set_active (stream->stream_pad, FALSE);
-      /* Force unlink? */
-      g_hash_table_remove (roqmux->src_pads, (gpointer) stream->stream_pad);
-      gst_element_remove_pad (GST_ELEMENT (roqmux), stream->stream_pad);
-      stream->stream_pad = NULL;
+    list = gst_buffer_list_make_writable (list);
+    gst_buffer_list_foreach (list, rtp_quic_mux_datagram_list_prepare, sink);
+
+    if (gst_buffer_list_length (list) == 0) {
+      gst_buffer_list_unref (list);
+      return GST_FLOW_OK;
     }
-    stream->counter = 0;
-    g_mutex_unlock (&stream->mutex);
+
+    return gst_pad_push_list (roqmux->datagram_pad, list);
   }
 
-  if (rv == GST_FLOW_QUIC_STREAM_CLOSED) {
+  stream = sink->stream;
+
+  if (G_UNLIKELY (stream == NULL)) {
+    GST_ERROR_OBJECT (roqmux, "No SSRC and payload type known for pad %"
+        GST_PTR_FORMAT ", cannot map buffer list to a stream", pad);
+    gst_buffer_list_unref (list);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (roqmux->send_queue_max_bytes > 0) {
     /*
-     * According to rtp-over-quic-09:
-     *
-     ** STOP_SENDING is not a request to the sender to stop sending RTP media,
-     ** only an indication that a RoQ receiver stopped reading the QUIC stream
-     ** being used. This can mean that the RoQ receiver is unable to make use of
-     ** the media frames being received because they are "too old" to be used. A
-     ** sender with additional media frames to send can continue sending them on
-     ** another QUIC stream. Alternatively, new media frames can be sent as QUIC
-     ** datagrams (see Section 5.3). In either case, a RoQ sender resuming 
-     ** operation after receiving STOP_SENDING can continue starting with the
-     ** newest media frames available for sending. This allows a RoQ receiver to
-     ** "fast forward" to media frames that are "new enough" to be used.
-     **
-     ** Any media frame that has already been sent on the QUIC stream that
-     ** received the STOP_SENDING frame, MUST NOT be sent again on the new QUIC
-     ** stream(s) or DATAGRAMs.
+     * A blocked list push doesn't say how much of the list was taken, so send
+     * through the queue one buffer at a time.
      */
+    for (i = 0; i < len && rv == GST_FLOW_OK; i++) {
+      rv = rtp_quic_mux_stream_send_queued (roqmux, pad, stream,
+          gst_buffer_ref (gst_buffer_list_get (list, i)));
+    }
+    gst_buffer_list_unref (list);
+    return rv;
+  }
 
-    g_assert (!roqmux->use_datagrams);
+  /*
+   * Collect consecutive buffers destined for the same QUIC stream into one
+   * list, pushing it whenever the stream boundary means the QUIC stream is
+   * about to be closed or replaced.
+   */
+  out = gst_buffer_list_new_sized (len);
 
-    GST_DEBUG_OBJECT (roqmux, "Stream closed, cancelling frame");
+  for (i = 0; i < len && rv == GST_FLOW_OK; i++) {
+    GstBuffer *buf = gst_buffer_ref (gst_buffer_list_get (list, i));
+    gboolean marker = GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER);
+    GstPad *target_pad;
+    gboolean complete;
 
-    g_mutex_lock (&stream->mutex);
-    stream->frame_cancelled = TRUE;
-    if (stream->stream_pad) {
-      g_hash_table_remove (roqmux->src_pads, (gpointer) stream->stream_pad);
-      gst_element_remove_pad (GST_ELEMENT (roqmux), stream->stream_pad);
-      stream->stream_pad = NULL;
+    /*
+     * Push what has been collected before the stream can move onto a new
+     * QUIC stream, so that a STREAM_CLOSED for the old pad is never taken to
+     * mean the new one.
+     */
+    if (out_pad != NULL &&
+        rtp_quic_mux_stream_may_switch_pad (roqmux, pad, stream, buf)) {
+      rv = rtp_quic_mux_stream_push_list (roqmux, stream, &out_pad, &out);
+      if (rv != GST_FLOW_OK) {
+        gst_buffer_unref (buf);
+        break;
+      }
     }
-    stream->counter = 0;
-    g_mutex_unlock (&stream->mutex);
 
-    rv = GST_FLOW_OK;
-  } else if (rv == GST_FLOW_QUIC_BLOCKED) {
-    GST_FIXME_OBJECT (roqmux,
-        "What to do when the QUIC connection/stream is blocked?");
+    rv = rtp_quic_mux_stream_prepare (roqmux, pad, stream, &buf, &target_pad);
+    complete = rtp_quic_mux_stream_is_complete (roqmux, stream, marker);
+
+    if (target_pad == NULL) {
+      continue;
+    }
+
+    if (target_pad != out_pad) {
+      rv = rtp_quic_mux_stream_push_list (roqmux, stream, &out_pad, &out);
+      if (rv != GST_FLOW_OK) {
+        gst_buffer_unref (buf);
+        gst_object_unref (target_pad);
+        break;
+      }
+      out_pad = target_pad;
+    } else {
+      gst_object_unref (target_pad);
+    }
+
+    gst_buffer_list_add (out, buf);
+
+    if (complete) {
+      rv = rtp_quic_mux_stream_push_list (roqmux, stream, &out_pad, &out);
+      rtp_quic_mux_stream_sent (roqmux, stream, marker);
+    }
+  }
+
+  if (out_pad != NULL) {
+    GstFlowReturn push_rv =
+        rtp_quic_mux_stream_push_list (roqmux, stream, &out_pad, &out);
+    if (rv == GST_FLOW_OK) {
+      rv = push_rv;
+    }
   }
 
+  gst_buffer_list_unref (out);
+  gst_buffer_list_unref (list);
+
   GST_DEBUG_OBJECT (roqmux, "Returning %s",
       rtp_quic_mux_flow_return_as_string (rv));
 
-  g_assert (rv >= 0);
-
   return rv;
 }
 
@@ -1252,32 +4637,43 @@ gst_rtp_quic_mux_rtcp_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
 {
   GstRtpQuicMux *roqmux;
   GstPad *target_pad = NULL;
+  RtpQuicMuxSink *sink = gst_pad_get_element_private (pad);
 
   roqmux = GST_RTPQUICMUX (parent);
 
-  if (roqmux->rtcp_flow_id == -1) {
-    roqmux->rtcp_flow_id = roqmux->rtp_flow_id + 1;
-  }
-
   if (roqmux->use_datagrams) {
-    if (roqmux->datagram_pad == NULL) {
+    if (g_atomic_pointer_get (&roqmux->datagram_pad) == NULL) {
       _rtp_quic_mux_open_datagram_pad (roqmux, pad);
     }
 
-    target_pad = gst_object_ref (roqmux->datagram_pad);
+    if (!rtp_quic_mux_datagram_fits (roqmux, buf, sink->rtcp_flow_id)) {
+      gst_buffer_unref (buf);
+      return GST_FLOW_OK;
+    }
+
+    /* The element owns the datagram pad for as long as it has sink pads */
+    target_pad = roqmux->datagram_pad;
 
-    rtp_quic_mux_write_payload_header (&buf, -1, roqmux->rtcp_flow_id, FALSE);
+    rtp_quic_mux_write_payload_header (roqmux, &buf, -1, sink->rtcp_flow_id,
+        FALSE);
 
     GST_DEBUG_OBJECT (roqmux, "Pushing buffer of length %lu in a datagram",
         gst_buffer_get_size (buf));
 
-    roqmux->datagrams_sent++;
+    RTP_QUIC_MUX_COUNT (roqmux->datagrams_sent, 1);
   } else {
-    if (!g_hash_table_lookup_extended (roqmux->rtcp_pads, (gconstpointer) pad,
-        NULL, (gpointer *) &target_pad)) {
+    gboolean found;
+
+    /* Only this pad's streaming thread adds its entry, but others share it */
+    GST_OBJECT_LOCK (roqmux);
+    found = g_hash_table_lookup_extended (roqmux->rtcp_pads,
+        (gconstpointer) pad, NULL, (gpointer *) &target_pad);
+    GST_OBJECT_UNLOCK (roqmux);
+
+    if (!found) {
       GST_DEBUG_OBJECT (roqmux, "Opening new RTCP stream for RTCP pad %"
           GST_PTR_FORMAT, pad);
-      
+
       target_pad = rtp_quic_mux_new_uni_src_pad (roqmux, pad);
 
       if (target_pad == NULL) {
@@ -1286,61 +4682,25 @@ gst_rtp_quic_mux_rtcp_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
         return GST_FLOW_NOT_LINKED;
       }
 
+      GST_OBJECT_LOCK (roqmux);
       g_hash_table_insert (roqmux->rtcp_pads, (gpointer) pad,
           (gpointer) target_pad);
+      GST_OBJECT_UNLOCK (roqmux);
 
-      rtp_quic_mux_write_payload_header (&buf,
+      rtp_quic_mux_write_payload_header (roqmux, &buf,
           (roqmux->add_uni_stream_header)?(roqmux->uni_stream_type):(-1),
-          roqmux->rtcp_flow_id, TRUE);
+          sink->rtcp_flow_id, TRUE);
     } else {
-      rtp_quic_mux_write_payload_header (&buf, -1, -1, TRUE);
+      rtp_quic_mux_write_payload_header (roqmux, &buf, -1, -1, TRUE);
     }
 
-    roqmux->stream_frames_sent++;
+    RTP_QUIC_MUX_COUNT (roqmux->stream_frames_sent, 1);
   }
 
   /*
    * TODO: Filter out RTCP messages that are duplicated by QUIC transport
    */
 
-  if (gst_debug_category_get_threshold (gst_rtp_quic_mux_debug)
-      >= GST_LEVEL_DEBUG) {
-    GstMapInfo map;
-    gsize off = 0;
-    guint64 uni_stream_type;
-    guint64 flow_id;
-    guint8 rc;
-    guint8 pt;
-    guint16 length;
-    guint32 ssrc;
-
-    gst_buffer_map (buf, &map, GST_MAP_READ);
-    if (!roqmux->use_datagrams && roqmux->add_uni_stream_header) {
-      off += gst_quiclib_get_varint (map.data + off, &uni_stream_type);
-    }
-    off += gst_quiclib_get_varint (map.data + off, &flow_id);
-    rc = map.data[off] & 0x1f;
-    pt = map.data[off + 1];
-    length = (map.data[off + 2] << 8) + (map.data[off + 3]);
-    ssrc = (map.data[off + 4] << 24) + (map.data[off + 5] << 16) +
-      (map.data[off+6] << 8) + (map.data[off+7]);
-    gst_buffer_unmap (buf, &map);
-
-    if (!roqmux->use_datagrams && roqmux->add_uni_stream_header) {
-      GST_DEBUG_OBJECT (roqmux, "Sending RTCP frame of size %lu bytes on "
-          "stream with stream type %lu, flow identifier %lu, record count %u, "
-          "payload type %u, length %u and ssrc %u",
-          gst_buffer_get_size (buf), uni_stream_type, flow_id, rc, pt, length,
-          ssrc);
-    } else {
-      GST_DEBUG_OBJECT (roqmux, "Sending RTCP frame of size %lu bytes on "
-          "%s, flow identifier %lu, record count %u, payload type %u, length "
-          "%u and ssrc %u", gst_buffer_get_size (buf),
-          (roqmux->use_datagrams)?("datagram"):("stream"), flow_id, rc, pt,
-          length, ssrc);
-    }
-  }
-
   return gst_pad_push (target_pad, buf);
 }
 
@@ -1357,22 +4717,15 @@ rtp_quic_mux_unlink_pad (gpointer data)
   GstPad *local = GST_PAD (data);
   GstElement *parent = gst_pad_get_parent_element (local);
 
-  g_hash_table_remove (GST_RTPQUICMUX (parent)->src_pads, (gpointer) local);
+  gst_pad_set_element_private (local, NULL);
   gst_element_remove_pad (parent, local);
 }
 
-void
-rtp_quic_mux_hash_value_destroy (GHashTable *pts)
-{
-  g_hash_table_destroy (pts);
-}
-
 void
 gst_rtp_quic_mux_set_quicmux (GstRtpQuicMux *roqmux, GstQuicMux *qmux)
 {
-  g_rec_mutex_lock (&roqmux->mutex);
-  roqmux->quicmux = GST_ELEMENT (qmux);
-  g_rec_mutex_unlock (&roqmux->mutex);
+  g_atomic_pointer_set (&roqmux->quicmux, GST_ELEMENT (qmux));
+  rtp_quic_mux_reset_max_datagram_payload (roqmux);
 }
 
 /* entry point to initialize the plug-in
@@ -61,33 +61,240 @@ GType gst_rtp_quic_mux_stream_boundary_get_type (void);
 typedef enum _GstRtpQuicMuxStreamBoundary {
     STREAM_BOUNDARY_FRAME,
     STREAM_BOUNDARY_GOP,
-    STREAM_BOUNDARY_SINGLE_STREAM
+    STREAM_BOUNDARY_SINGLE_STREAM,
+    STREAM_BOUNDARY_DURATION,
+    STREAM_BOUNDARY_AUTO
 } GstRtpQuicMuxStreamBoundary;
 
+#define GST_RTP_QUIC_MUX_TYPE_SEND_QUEUE_POLICY \
+  gst_rtp_quic_mux_send_queue_policy_get_type ()
+GType gst_rtp_quic_mux_send_queue_policy_get_type (void);
+typedef enum _GstRtpQuicMuxSendQueuePolicy {
+    SEND_QUEUE_POLICY_DROP_OLDEST_FRAME,
+    SEND_QUEUE_POLICY_DROP_NON_REFERENCE,
+    SEND_QUEUE_POLICY_BLOCK_UPSTREAM
+} GstRtpQuicMuxSendQueuePolicy;
+
+/*
+ * An RTP session multiplexed by this element on flow IDs of its own, picked by
+ * the session index in the names of its sink pads. Session 0 is the one set up
+ * by the rtp-flow-id and rtcp-flow-id properties, so it isn't kept as one of
+ * these.
+ */
 struct _RtpQuicMuxSession
 {
   guint session_id;
 
-  /* GList of GstPads */
-  GList *rtp_sink_pads;
-  GList *rtcp_sink_pads;
-  GList *quic_src_pads;
+  gint64 rtp_flow_id;
+  gint64 rtcp_flow_id;
 };
 
+typedef struct _RtpQuicMuxSession RtpQuicMuxSession;
+
+/*
+ * An RTP buffer waiting in a send queue, along with when it was queued.
+ */
+struct _RtpQuicMuxQueuedBuffer
+{
+  GstBuffer *buf;
+  GstClockTime queued_at;
+};
+
+typedef struct _RtpQuicMuxQueuedBuffer RtpQuicMuxQueuedBuffer;
+
+/*
+ * A RoQ stream, carrying the packets of one SSRC and payload type (or one
+ * layer of them) over a succession of QUIC streams. It belongs to the
+ * streaming thread of the sink pad that feeds it, so none of it is locked.
+ * The only thing written from elsewhere is unlinked_pad, which the pad
+ * unlinked callback sets atomically for the streaming thread to act on.
+ */
 struct _RtpQuicMuxStream
 {
   GstPad *stream_pad;
+  GstPad *unlinked_pad;
 
   guint64 stream_offset;
+  GstClockTime stream_start_time;
   guint counter;
   gboolean frame_cancelled;
+  gboolean mid_frame;
+  gsize frame_bytes;
+  gsize max_frame_bytes;
+
+  /*
+   * Whether the next packet starts a frame on this stream, because the last
+   * one carried the marker, and whether the frame it belongs to is being
+   * dropped as older than max-frame-age.
+   */
+  gboolean frame_start;
+  gboolean dropping_stale;
 
-  GMutex mutex;
-  GCond wait;
+  /*
+   * The buffer that the QUIC stream last refused as blocked. It already
+   * carries its RoQ header and offset for blocked_pad, so it must be retried
+   * first. Buffers in send_queue have not been mapped onto a stream yet.
+   */
+  GstBuffer *blocked_buf;
+  GstPad *blocked_pad;
+  GstClockTime blocked_at;
+  GQueue send_queue;
+  gsize send_queue_bytes;
+  gboolean drop_until_marker;
+
+  /* Falling back to datagrams after repeated STOP_SENDINGs */
+  guint stop_sending_count;
+  GstClockTime stop_sending_window_start;
+  gboolean datagram_fallback;
+  GstClockTime datagram_fallback_at;
+  gboolean frame_on_datagram;
+
+  /*
+   * Pacing, with release times in monotonic microseconds. Once the stream has
+   * been paced, everything it sends leaves through pacer_flow, in order. The
+   * stream holds a reference to the pacer to give the flow back to.
+   */
+  struct _GstRoQPacer *pacer;
+  struct _GstRoQPacerFlow *pacer_flow;
+  gint64 pace_next;
+  gint64 pace_deadline;
+  guint64 pace_rate;
+  GstClockTime pace_frame_start;
+  GstClockTime pace_frame_interval;
+
+  /*
+   * The number of sink pads whose caps map onto this stream. Sink pads with
+   * the same session, SSRC and payload type share it, and it's freed when the
+   * last of them is released.
+   */
+  guint sink_refs;
+
+  /* Recovering from a cancelled frame */
+  GstPad *sink_pad;
+  GstClockTime last_keyframe_request;
+  gboolean wait_for_keyframe;
+
+  /* Interned media type from the caps, for looking up stream priorities */
+  const gchar *media;
+
+  /* RoQ flow ID of the session the stream belongs to */
+  gint64 flow_id;
+
+  /*
+   * With frame marking, the temporal/spatial layer this stream carries, 0 for
+   * the base layer. The base layer stream owns a child stream for each
+   * enhancement layer it has seen.
+   *
+   * GHashTable <guint> { // Layer, TID | LID << 3
+   *   RtpQuicMuxStream;
+   * }
+   */
+  guint layer;
+  GHashTable *layers;
 };
 
 typedef struct _RtpQuicMuxStream RtpQuicMuxStream;
 
+/*
+ * A slot in the stream table, keyed on (session << 40 | SSRC << 8 | payload
+ * type). Empty slots have a NULL stream.
+ */
+struct _RtpQuicMuxStreamSlot
+{
+  guint64 key;
+  RtpQuicMuxStream *stream;
+};
+
+typedef struct _RtpQuicMuxStreamSlot RtpQuicMuxStreamSlot;
+
+/*
+ * Name of the sticky custom event structure sent down new stream pads to
+ * signal the priority of the QUIC stream. Urgency follows RFC 9218, where 0
+ * is the most urgent and 3 is the default.
+ */
+#define RTP_QUIC_MUX_PRIORITY_EVENT "roq-stream-priority"
+#define RTP_QUIC_MUX_DEFAULT_URGENCY 3
+#define RTP_QUIC_MUX_MAX_URGENCY 7
+
+/*
+ * Name of the custom query sent to quicmux to learn the peer's per-stream flow
+ * control limit, answered in a guint64 "max-stream-data" field. quicmux
+ * doesn't answer this yet, so until it does only max-stream-bytes applies.
+ */
+#define RTP_QUIC_MUX_MAX_STREAM_DATA_QUERY "roq-max-stream-data"
+
+/*
+ * Name of the custom query sent to quicmux to learn the largest QUIC DATAGRAM
+ * payload that the connection can carry, given the peer's
+ * max_datagram_frame_size and the path MTU, answered in a guint64
+ * "max-datagram-payload" field.
+ */
+#define RTP_QUIC_MUX_MAX_DATAGRAM_PAYLOAD_QUERY "roq-max-datagram-payload"
+
+/*
+ * Name of the custom query sent to quicmux to read the connection statistics
+ * used by the auto stream boundary and by pacing, answered in guint64 "rtt"
+ * (nanoseconds), "packets-sent", "packets-lost", "cwnd" (bytes) and
+ * "pacing-rate" (bits per second) fields. quicmux doesn't answer this yet.
+ */
+#define RTP_QUIC_MUX_CONNECTION_STATS_QUERY "roq-connection-stats"
+
+/*
+ * The largest RoQ header that can precede an RTP/RTCP packet: an optional
+ * unidirectional stream type, the flow identifier and the payload length, each
+ * a QUIC variable-length integer of up to 8 bytes.
+ */
+#define RTP_QUIC_MUX_MAX_HEADER_LEN 24
+
+/*
+ * Private data attached to each RTP and RTCP sink pad. The flow IDs of the
+ * pad's session, and for RTP the SSRC and payload type, are resolved to a
+ * stream object whenever the caps on the pad change, so that the chain
+ * functions don't need to touch the caps, the sessions or the stream tables at
+ * all.
+ */
+struct _RtpQuicMuxSink
+{
+  GstPad *sink;
+  gboolean rtcp;
+
+  guint session_id;
+  gint64 rtp_flow_id;
+  gint64 rtcp_flow_id;
+
+  guint32 ssrc;
+  gint32 payload_type;
+
+  RtpQuicMuxStream *stream;
+
+  /* Whether the payloader upstream has been made to fit in datagrams */
+  gboolean payloader_checked;
+
+  /* The FEC block being built from the packets sent in datagrams */
+  struct _GstRoQFecEncoder *fec;
+
+  /*
+   * Datagrams held back to be pushed in one list at the end of their frame,
+   * with the PTS of the frame and when (in monotonic microseconds) the first
+   * of them was held. Audio isn't batched.
+   */
+  GstBufferList *dgram_batch;
+  GstClockTime dgram_batch_pts;
+  gint64 dgram_batch_start;
+  gboolean dgram_batchable;
+
+  /*
+   * For working out how old each frame is against max-frame-age. Frames are
+   * tracked on the RoQ stream they are sent on, and only on the sink pad
+   * until the stream is known.
+   */
+  GstSegment segment;
+  gboolean frame_start;
+  gboolean dropping_stale;
+};
+
+typedef struct _RtpQuicMuxSink RtpQuicMuxSink;
+
 #define GST_TYPE_RTPQUICMUX (gst_rtp_quic_mux_get_type())
 G_DECLARE_FINAL_TYPE (GstRtpQuicMux, gst_rtp_quic_mux,
     GST, RTPQUICMUX, GstElement)
@@ -96,47 +303,163 @@ struct _GstRtpQuicMux
 {
   GstElement element;
 
+  /* Set once, atomically, by whichever pad first finds quicmux downstream */
   GstElement *quicmux;
 
   gint64 rtp_flow_id;
   gint64 rtcp_flow_id;
   GstRtpQuicMuxStreamBoundary stream_boundary;
   guint stream_packing_ratio;
+  GstClockTime stream_duration;
+  guint64 max_stream_bytes;
+  guint64 peer_max_stream_data;
+  /* Protected by the object lock */
+  gboolean max_stream_data_queried;
+  GstClockTime max_stream_data_next_query;
+
+  /*
+   * Automatic stream boundary selection. auto_boundary is written under the
+   * object lock and read atomically by the streaming threads.
+   */
+  GstRtpQuicMuxStreamBoundary auto_boundary;
+  GstClockTime auto_interval;
+  gdouble auto_loss_high;
+  gdouble auto_loss_low;
+  GstClockTime auto_rtt_high;
+  guint auto_hold;
+  /* Protected by the object lock */
+  GstClockTime auto_next_update;
+  guint64 auto_packets_sent;
+  guint64 auto_packets_lost;
+  gint auto_direction;
+  guint auto_votes;
+  gboolean auto_stats_warned;
+
   guint64 uni_stream_type;
   gboolean use_datagrams;
   gboolean add_uni_stream_header;
+  gboolean header_headroom;
+  GstAllocator *header_allocator;
+  /*
+   * Opened by whichever streaming thread first needs it, under
+   * datagram_pad_lock, and only published once it is ready to push on.
+   */
+  GMutex datagram_pad_lock;
   GstPad *datagram_pad;
   guint pad_n;
 
   /*
-   * GHashTable <guint> { // SSRCs
-   *    GHashTable <guint8> { // Payload type
-   *        RtpQuicMuxStream;
-   *    }
-   * }
+   * Stream pads that have already been linked to quicmux, waiting to be used
+   * for new QUIC streams. Protected by the object lock.
    */
-  GHashTable *ssrcs;
+  GQueue stream_pad_pool;
+  guint stream_pool_size;
+  gboolean stream_pool_refilling;
+
+  guint send_queue_max_bytes;
+  GstRtpQuicMuxSendQueuePolicy send_queue_policy;
   /*
-   * GHashTable <GstPad> { // src pad
-   *   RtpQuicMuxStream;
+   * Chain functions held back by the block-upstream send queue policy wait on
+   * send_queue_cond, which is signalled when they should give up because of a
+   * flush or a state change. send_queue_flushing is protected by
+   * send_queue_lock.
+   */
+  GMutex send_queue_lock;
+  GCond send_queue_cond;
+  gboolean send_queue_flushing;
+  GstClockTime max_frame_age;
+  gboolean hybrid_mapping;
+  guint datagram_mtu;
+  gboolean fit_payloader_mtu;
+  GstClockTime datagram_batch_max_delay;
+  /*
+   * Asked of quicmux again as datagrams are sent, and read by every streaming
+   * thread, so the answer is only touched atomically. When to ask next is
+   * protected by the object lock.
+   */
+  gsize max_datagram_payload;
+  GstClockTime max_datagram_payload_next_query;
+  guint datagram_fallback_threshold;
+  GstClockTime datagram_fallback_window;
+  GstClockTime datagram_fallback_quiet;
+  gboolean request_keyframe;
+  GstClockTime keyframe_request_interval;
+  gboolean wait_for_keyframe;
+  GstStructure *priority_map;
+  guint frame_marking_ext_id;
+
+  /*
+   * Sessions other than session 0, created as their first sink pad is
+   * requested. Protected by the object lock.
+   *
+   * GHashTable <guint> { // Session index
+   *   RtpQuicMuxSession;
    * }
    */
-  GHashTable *src_pads;
+  GHashTable *sessions;
+  GstStructure *session_flow_map;
+
+  /* Sender-side pacing */
+  gboolean pacing;
+  guint64 pacing_bitrate;
+  gdouble pacing_frame_fraction;
+  struct _GstRoQPacer *pacer;
+  guint64 transport_pacing_rate;
+  GstClockTime pacing_next_update;
+  gint pacing_rate_warned;
+
+  /* Forward error correction for datagrams */
+  guint fec_block_size;
+  gint64 fec_flow_id;
+
+  /*
+   * Open-addressing table of RtpQuicMuxStream, keyed on the SSRC and payload
+   * type packed together and probed linearly. The capacity is always a power
+   * of two. Protected by the object lock.
+   *
+   * Each open stream pad carries its RtpQuicMuxStream as its element private
+   * data, for going the other way.
+   */
+  RtpQuicMuxStreamSlot *streams;
+  guint streams_capacity;
+  guint streams_count;
 
   /*
    * GHashTable <GstPad> { // RTCP sink pad
    *   GstPad; // RTCP src pad
    * }
+   *
+   * Protected by the object lock.
    */
   GHashTable *rtcp_pads;
 
-  GRecMutex mutex;
-  GCond cond;
-
-  guint64 stream_frames_sent;
-  guint64 datagrams_sent;
+  /*
+   * Statistics, bumped from every sink pad's streaming thread. GLib has no
+   * 64-bit integer atomics, so the counters are pointer-sized and only touched
+   * with RTP_QUIC_MUX_COUNT() and RTP_QUIC_MUX_COUNTER_GET().
+   * send_queue_max_latency is protected by the object lock.
+   */
+  gsize stream_frames_sent;
+  gsize datagrams_sent;
+  gsize stream_pool_hits;
+  gsize send_queue_depth;
+  GstClockTime send_queue_max_latency;
+  gsize send_queue_dropped;
+  gsize stale_frames_dropped;
+  gsize stale_bytes_dropped;
+  gsize datagram_fallbacks;
+  gsize keyframe_requests;
+  gsize budget_rollovers;
+  gsize datagrams_oversized;
+  gsize fec_packets_sent;
+  gsize datagram_batches;
 };
 
+#define RTP_QUIC_MUX_COUNT(counter, n) \
+  ((void) g_atomic_pointer_add (&(counter), (n)))
+#define RTP_QUIC_MUX_COUNTER_GET(counter) \
+  ((guint64) (gsize) g_atomic_pointer_get (&(counter)))
+
 typedef struct _GstQuicMux GstQuicMux;
 
 void
@@ -147,17 +470,77 @@ gst_rtp_quic_mux_set_quicmux (GstRtpQuicMux *roqmux, GstQuicMux *qmux);
   PROP_RTCP_FLOW_ID, \
   PROP_STREAM_BOUNDARY, \
   PROP_STREAM_PACKING, \
+  PROP_STREAM_DURATION, \
+  PROP_MAX_STREAM_BYTES, \
+  PROP_AUTO_INTERVAL, \
+  PROP_AUTO_LOSS_HIGH, \
+  PROP_AUTO_LOSS_LOW, \
+  PROP_AUTO_RTT_HIGH, \
+  PROP_AUTO_HOLD, \
   PROP_UNI_STREAM_TYPE, \
   PROP_USE_DATAGRAM, \
-  PROP_USE_UNI_STREAM_HEADER
+  PROP_USE_UNI_STREAM_HEADER, \
+  PROP_HEADER_HEADROOM, \
+  PROP_STREAM_POOL_SIZE, \
+  PROP_SEND_QUEUE_MAX_BYTES, \
+  PROP_SEND_QUEUE_POLICY, \
+  PROP_MAX_FRAME_AGE, \
+  PROP_HYBRID_MAPPING, \
+  PROP_DATAGRAM_MTU, \
+  PROP_FIT_PAYLOADER_MTU, \
+  PROP_DATAGRAM_BATCH_MAX_DELAY, \
+  PROP_DATAGRAM_FALLBACK_THRESHOLD, \
+  PROP_DATAGRAM_FALLBACK_WINDOW, \
+  PROP_DATAGRAM_FALLBACK_QUIET, \
+  PROP_REQUEST_KEYFRAME, \
+  PROP_KEYFRAME_REQUEST_INTERVAL, \
+  PROP_WAIT_FOR_KEYFRAME, \
+  PROP_PRIORITY_MAP, \
+  PROP_FRAME_MARKING_EXT_ID, \
+  PROP_SESSION_FLOW_MAP, \
+  PROP_PACING, \
+  PROP_PACING_BITRATE, \
+  PROP_PACING_FRAME_FRACTION, \
+  PROP_FEC_BLOCK_SIZE, \
+  PROP_FEC_FLOW_ID
 
 #define PROP_RTPQUICMUX_ENUM_CASES PROP_RTP_FLOW_ID:\
   case PROP_RTCP_FLOW_ID: \
   case PROP_STREAM_BOUNDARY: \
   case PROP_STREAM_PACKING: \
+  case PROP_STREAM_DURATION: \
+  case PROP_MAX_STREAM_BYTES: \
+  case PROP_AUTO_INTERVAL: \
+  case PROP_AUTO_LOSS_HIGH: \
+  case PROP_AUTO_LOSS_LOW: \
+  case PROP_AUTO_RTT_HIGH: \
+  case PROP_AUTO_HOLD: \
   case PROP_UNI_STREAM_TYPE: \
   case PROP_USE_DATAGRAM: \
-  case PROP_USE_UNI_STREAM_HEADER
+  case PROP_USE_UNI_STREAM_HEADER: \
+  case PROP_HEADER_HEADROOM: \
+  case PROP_STREAM_POOL_SIZE: \
+  case PROP_SEND_QUEUE_MAX_BYTES: \
+  case PROP_SEND_QUEUE_POLICY: \
+  case PROP_MAX_FRAME_AGE: \
+  case PROP_HYBRID_MAPPING: \
+  case PROP_DATAGRAM_MTU: \
+  case PROP_FIT_PAYLOADER_MTU: \
+  case PROP_DATAGRAM_BATCH_MAX_DELAY: \
+  case PROP_DATAGRAM_FALLBACK_THRESHOLD: \
+  case PROP_DATAGRAM_FALLBACK_WINDOW: \
+  case PROP_DATAGRAM_FALLBACK_QUIET: \
+  case PROP_REQUEST_KEYFRAME: \
+  case PROP_KEYFRAME_REQUEST_INTERVAL: \
+  case PROP_WAIT_FOR_KEYFRAME: \
+  case PROP_PRIORITY_MAP: \
+  case PROP_FRAME_MARKING_EXT_ID: \
+  case PROP_SESSION_FLOW_MAP: \
+  case PROP_PACING: \
+  case PROP_PACING_BITRATE: \
+  case PROP_PACING_FRAME_FRACTION: \
+  case PROP_FEC_BLOCK_SIZE: \
+  case PROP_FEC_FLOW_ID
 
 #define gst_rtp_quic_mux_install_properties_map(klass) \
   g_object_class_install_property (gobject_class, PROP_RTP_FLOW_ID, \
@@ -186,6 +569,47 @@ gst_rtp_quic_mux_set_quicmux (GstRtpQuicMux *roqmux, GstQuicMux *qmux);
           "Acts as a multiplier to the stream boundary property, i.e. a value " \
           "of 5 with a GOP stream boundary means 5 GOPs per stream", \
           1, G_MAXUINT, 1, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_STREAM_DURATION, \
+      g_param_spec_uint ("stream-duration", "Stream duration", \
+          "Milliseconds of media running time to send on each stream when " \
+          "stream-boundary is duration. Streams are only cut between frames", \
+          1, G_MAXUINT, 500, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_MAX_STREAM_BYTES, \
+      g_param_spec_uint64 ("max-stream-bytes", "Maximum stream bytes", \
+          "Per-stream flow control limit to stay within if quicmux can't " \
+          "report the peer's. New streams are started at frame boundaries " \
+          "to stay under it. 0 means no limit", 0, G_MAXUINT64, 0, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_AUTO_INTERVAL, \
+      g_param_spec_uint ("auto-interval", "Auto boundary interval", \
+          "Milliseconds between connection statistics checks when " \
+          "stream-boundary is auto", 1, G_MAXUINT, 1000, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_AUTO_LOSS_HIGH, \
+      g_param_spec_double ("auto-loss-high", "Auto boundary high loss", \
+          "Packet loss ratio above which the auto stream boundary moves " \
+          "towards more streams", 0.0, 1.0, 0.02, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_AUTO_LOSS_LOW, \
+      g_param_spec_double ("auto-loss-low", "Auto boundary low loss", \
+          "Packet loss ratio below which the auto stream boundary moves " \
+          "towards fewer streams", 0.0, 1.0, 0.005, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_AUTO_RTT_HIGH, \
+      g_param_spec_uint ("auto-rtt-high", "Auto boundary high RTT", \
+          "RTT in milliseconds above which any loss over auto-loss-low " \
+          "moves the auto stream boundary towards more streams", \
+          0, G_MAXUINT, 150, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_AUTO_HOLD, \
+      g_param_spec_uint ("auto-hold", "Auto boundary hold", \
+          "Number of consecutive connection statistics checks that must " \
+          "agree before the auto stream boundary changes", \
+          1, G_MAXUINT, 3, G_PARAM_READWRITE)); \
 \
   g_object_class_install_property (gobject_class, PROP_UNI_STREAM_TYPE, \
       g_param_spec_uint64 ("uni-stream-type", \
@@ -203,7 +627,167 @@ gst_rtp_quic_mux_set_quicmux (GstRtpQuicMux *roqmux, GstQuicMux *qmux);
           "Use a unidirectional stream header", "Add a unidirectional stream " \
           "header to every new stream. Useful for using with protocols such " \
           "as SIP-over-QUIC. Mutually exclusive with use-datagram", FALSE, \
-          G_PARAM_READWRITE));
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_HEADER_HEADROOM, \
+      g_param_spec_boolean ("header-headroom", "Reserve header headroom", \
+          "Answer allocation queries from upstream with a memory prefix large " \
+          "enough for the RoQ headers, so that they can be written in place " \
+          "instead of being prepended as a separate memory", FALSE, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_STREAM_POOL_SIZE, \
+      g_param_spec_uint ("stream-pool-size", "Stream pool size", \
+          "Number of QUIC stream pads to keep opened and linked ahead of " \
+          "need, so that new streams don't wait for a pad to be linked. 0 " \
+          "disables the pool", 0, G_MAXUINT, 0, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_SEND_QUEUE_MAX_BYTES, \
+      g_param_spec_uint ("send-queue-max-bytes", "Send queue maximum bytes", \
+          "Size of the queue kept for each RoQ stream to hold data while its " \
+          "QUIC stream is blocked by flow control. 0 disables the queue, and " \
+          "blocked data is dropped", 0, G_MAXUINT, 0, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_SEND_QUEUE_POLICY, \
+      g_param_spec_enum ("send-queue-policy", "Send queue overflow policy", \
+          "What to do when a send queue is full", \
+          GST_RTP_QUIC_MUX_TYPE_SEND_QUEUE_POLICY, \
+          SEND_QUEUE_POLICY_DROP_OLDEST_FRAME, \
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)); \
+\
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAME_AGE, \
+      g_param_spec_uint64 ("max-frame-age", "Maximum frame age", \
+          "Drop whole frames whose running time is already more than this " \
+          "many nanoseconds behind the pipeline clock. 0 disables", \
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_HYBRID_MAPPING, \
+      g_param_spec_boolean ("hybrid-mapping", "Hybrid stream/datagram mapping", \
+          "Send delta frames that fit in datagram-mtu as QUIC datagrams, and " \
+          "everything else on QUIC streams. Ignored if use-datagram is set", \
+          FALSE, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_DATAGRAM_MTU, \
+      g_param_spec_uint ("datagram-mtu", "Datagram MTU", \
+          "The largest RoQ datagram payload in bytes, including the flow " \
+          "identifier, that will be sent as a QUIC datagram until the " \
+          "limit has been learned from quicmux", \
+          1, G_MAXUINT, 1200, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_FIT_PAYLOADER_MTU, \
+      g_param_spec_boolean ("fit-payloader-mtu", "Fit payloader MTU", \
+          "Lower the mtu property of the element upstream of each sink pad, " \
+          "such as an RTP payloader, so that its packets fit in QUIC " \
+          "datagrams. Otherwise a warning is logged if they won't fit", \
+          FALSE, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_DATAGRAM_BATCH_MAX_DELAY, \
+      g_param_spec_uint64 ("datagram-batch-max-delay", \
+          "Datagram batch maximum delay", "Hold the RTP datagrams of each " \
+          "video frame back until its last packet, and push them to quicmux " \
+          "as one buffer list. Once a batch is older than this many " \
+          "nanoseconds, the next packet to arrive pushes it; there is no " \
+          "timer. Audio is never held. 0 disables", 0, G_MAXUINT64, 0, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_DATAGRAM_FALLBACK_THRESHOLD, \
+      g_param_spec_uint ("datagram-fallback-threshold", \
+          "Datagram fallback threshold", "Number of STOP_SENDINGs within " \
+          "datagram-fallback-window after which a RoQ stream switches to " \
+          "sending in datagrams. 0 disables", 0, G_MAXUINT, 0, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_DATAGRAM_FALLBACK_WINDOW, \
+      g_param_spec_uint64 ("datagram-fallback-window", \
+          "Datagram fallback window", "Time window in nanoseconds over which " \
+          "STOP_SENDINGs are counted against datagram-fallback-threshold", \
+          1, G_MAXUINT64, GST_SECOND, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_DATAGRAM_FALLBACK_QUIET, \
+      g_param_spec_uint64 ("datagram-fallback-quiet", \
+          "Datagram fallback quiet period", "Time in nanoseconds after " \
+          "falling back to datagrams before trying QUIC streams again", \
+          0, G_MAXUINT64, 5 * GST_SECOND, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_REQUEST_KEYFRAME, \
+      g_param_spec_boolean ("request-keyframe", "Request keyframes", \
+          "Send a GstForceKeyUnit event upstream when a frame is cancelled " \
+          "because the receiver stopped reading its stream", FALSE, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_KEYFRAME_REQUEST_INTERVAL, \
+      g_param_spec_uint64 ("keyframe-request-interval", \
+          "Keyframe request interval", "Minimum time in nanoseconds between " \
+          "keyframe requests for the same RoQ stream", 0, G_MAXUINT64, \
+          GST_SECOND, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_WAIT_FOR_KEYFRAME, \
+      g_param_spec_boolean ("wait-for-keyframe", "Wait for keyframe", \
+          "After a frame is cancelled, drop delta units until the next " \
+          "keyframe instead of resuming at the next frame", FALSE, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_PRIORITY_MAP, \
+      g_param_spec_boxed ("priority-map", "Stream priority map", \
+          "Urgency of new QUIC streams by flow-<id>, <media>-enhancement, " \
+          "<media>-keyframe, <media>-delta, <media> or default, plus an " \
+          "incremental flag. Signalled to quicmux with a " \
+          "roq-stream-priority sticky event", \
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_FRAME_MARKING_EXT_ID, \
+      g_param_spec_uint ("frame-marking-ext-id", \
+          "Frame marking extension ID", "RTP header extension ID of the " \
+          "frame marking extension, used to send each temporal/spatial " \
+          "layer on its own QUIC streams. 0 disables", 0, 255, 0, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_SESSION_FLOW_MAP, \
+      g_param_spec_boxed ("session-flow-map", "Session flow ID map", \
+          "RTP flow ID for each session other than session 0 by " \
+          "session-<index>, and RTCP flow ID by session-<index>-rtcp. " \
+          "Sessions that aren't in the map are given unused flow IDs", \
+          GST_TYPE_STRUCTURE, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_PACING, \
+      g_param_spec_boolean ("pacing", "Pacing", \
+          "Spread the packets of each frame out over time from a pacing " \
+          "thread, instead of sending them to quicmux in a burst. Not " \
+          "applied to packets that go through the send queue when " \
+          "send-queue-max-bytes is set", FALSE, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_PACING_BITRATE, \
+      g_param_spec_uint64 ("pacing-bitrate", "Pacing bitrate", \
+          "Rate in bits per second to pace each RoQ stream at. 0 uses the " \
+          "pacing rate reported by the QUIC transport", 0, G_MAXUINT64, 0, \
+          G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, \
+      PROP_PACING_FRAME_FRACTION, \
+      g_param_spec_double ("pacing-frame-fraction", \
+          "Pacing frame fraction", "Fraction of the frame interval that " \
+          "the packets of a frame may be spread over, however low the " \
+          "pacing rate", 0.0, 1.0, 0.5, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_FEC_BLOCK_SIZE, \
+      g_param_spec_uint ("fec-block-size", "FEC block size", \
+          "Send an XOR repair packet for every this many RTP packets sent " \
+          "in datagrams, and at the end of every frame, so that the " \
+          "receiver can rebuild one lost packet in each block. 0 disables", \
+          0, 32, 0, G_PARAM_READWRITE)); \
+\
+  g_object_class_install_property (gobject_class, PROP_FEC_FLOW_ID, \
+      g_param_spec_int64 ("fec-flow-id", "FEC Flow Identifier", \
+          "Identifies the flow of FEC repair packets. -1 will result in an " \
+          "unused value being chosen once fec-block-size is set", \
+          -1, QUICLIB_VARINT_MAX, -1, G_PARAM_READWRITE));
 
 G_END_DECLS
 